@@ -0,0 +1,71 @@
+#include "boot_cache.h"
+#include "rv3028.h"
+#include <string.h>
+
+// Straight after the vault key, which takes the first 32 bytes
+#define BOOT_CACHE_EEPROM_ADDR 0x20
+#define RECORD_SIZE 9 // Next unlock and generation, little-endian, then a CRC-8
+
+static uint8_t record[RECORD_SIZE];
+static bool record_loaded = false;
+
+// CRC-8 (polynomial 0x07) seeded with 0xFF, so neither an erased nor a
+// zeroed EEPROM passes for a record
+static uint8_t record_crc(const uint8_t* data) {
+    uint8_t crc = 0xFF;
+    for (int i = 0; i < RECORD_SIZE - 1; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint32_t load_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store_le32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static bool load_record(void) {
+    if (!record_loaded) {
+        record_loaded = rv3028_read_user_eeprom(BOOT_CACHE_EEPROM_ADDR, record, RECORD_SIZE) == RV3028_SUCCESS;
+    }
+    return record_loaded;
+}
+
+bool boot_cache_read(uint32_t* next_unlock, uint32_t* generation) {
+    if (!load_record() || record[RECORD_SIZE - 1] != record_crc(record)) return false;
+    *next_unlock = load_le32(&record[0]);
+    *generation = load_le32(&record[4]);
+    return true;
+}
+
+bool boot_cache_write(uint32_t next_unlock, uint32_t generation) {
+    uint8_t updated[RECORD_SIZE];
+    store_le32(&updated[0], next_unlock);
+    store_le32(&updated[4], generation);
+    updated[RECORD_SIZE - 1] = record_crc(updated);
+
+    // Write from the first changed byte through the CRC. The CRC goes last,
+    // so a write cut short leaves a record that fails its check.
+    int first = 0;
+    if (load_record()) {
+        while (first < RECORD_SIZE && record[first] == updated[first]) first++;
+        if (first == RECORD_SIZE) return true;
+    }
+
+    record_loaded = false;
+    if (rv3028_write_user_eeprom(BOOT_CACHE_EEPROM_ADDR + first, &updated[first], RECORD_SIZE - first) != RV3028_SUCCESS) {
+        return false;
+    }
+    memcpy(record, updated, RECORD_SIZE);
+    record_loaded = true;
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef BOOT_CACHE_H
+#define BOOT_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Next unlock time when no capsule is locked
+#define BOOT_CACHE_NONE UINT32_MAX
+
+// A copy of the next unlock time kept in the RTC's user EEPROM, so a wake can
+// tell whether anything is due without mounting the vault. It is tagged with
+// the vault generation it was taken at; the full boot compares that with the
+// mounted vault and re-arms the wake if the copy missed a change.
+
+// Read the cached next unlock time, in seconds since 1970, and its vault
+// generation. Returns false if the cache was never written or is torn.
+bool boot_cache_read(uint32_t* next_unlock, uint32_t* generation);
+
+// Store the next unlock time, or BOOT_CACHE_NONE, for a vault generation.
+// Only the bytes that changed are written, to spare the EEPROM.
+bool boot_cache_write(uint32_t next_unlock, uint32_t generation);
+
+#endif // BOOT_CACHE_H
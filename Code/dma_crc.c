@@ -0,0 +1,68 @@
+#include "dma_crc.h"
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+#define CRC32_SEED 0xFFFFFFFF
+
+static int crc_channel = -1;
+static uint32_t crc_sink;
+static volatile bool transfer_pending = false;
+static volatile uint32_t transfer_crc;
+
+// Latch the checksum as soon as the transfer completes, so the next transfer
+// can be queued without waiting on the caller.
+static void dma_crc_irq_handler(void) {
+    if (dma_channel_get_irq0_status(crc_channel)) {
+        dma_channel_acknowledge_irq0(crc_channel);
+        transfer_crc = dma_sniffer_get_data_accumulator();
+        transfer_pending = false;
+    }
+}
+
+void dma_crc_init(void) {
+    if (crc_channel < 0) {
+        crc_channel = dma_claim_unused_channel(true);
+        dma_channel_set_irq0_enabled(crc_channel, true);
+        irq_add_shared_handler(DMA_IRQ_0, dma_crc_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0, true);
+    }
+}
+
+void dma_crc_start(const void* src, void* dst, size_t len) {
+    if (len == 0) {
+        transfer_crc = 0; // CRC-32 of no data
+        return;
+    }
+
+    dma_channel_config config = dma_channel_get_default_config(crc_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8); // Byte transfers keep the CRC independent of alignment
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, dst != NULL);
+    channel_config_set_sniff_enable(&config, true);
+
+    // Bit-reversed input with reversed, inverted output gives the standard (zlib) CRC-32
+    dma_sniffer_enable(crc_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_set_data_accumulator(CRC32_SEED);
+
+    transfer_pending = true;
+    dma_channel_configure(crc_channel, &config, dst ? dst : &crc_sink, src, len, true);
+}
+
+bool dma_crc_busy(void) {
+    return transfer_pending;
+}
+
+uint32_t dma_crc_finish(void) {
+    while (transfer_pending) {
+        tight_loop_contents();
+    }
+    return transfer_crc;
+}
+
+uint32_t dma_crc32(const void* src, void* dst, size_t len) {
+    dma_crc_start(src, dst, len);
+    return dma_crc_finish();
+}
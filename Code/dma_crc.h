@@ -0,0 +1,26 @@
+#ifndef DMA_CRC_H
+#define DMA_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Claim the DMA channel used for checksummed copies.
+void dma_crc_init(void);
+
+// Start copying len bytes from src to dst while the DMA sniffer accumulates a CRC-32.
+// Pass NULL as dst to only checksum the source.
+void dma_crc_start(const void* src, void* dst, size_t len);
+
+// Returns true while a transfer is in flight. Transfers may read from XIP, so
+// flash must not be erased or programmed until this is false.
+bool dma_crc_busy(void);
+
+// Wait for the transfer started by dma_crc_start() and return its CRC-32.
+// Completion is signalled from the DMA interrupt, so interrupts must be enabled.
+uint32_t dma_crc_finish(void);
+
+// Copy (or just checksum, if dst is NULL) len bytes and return their CRC-32.
+uint32_t dma_crc32(const void* src, void* dst, size_t len);
+
+#endif // DMA_CRC_H
@@ -1,23 +1,19 @@
 /*-----------------------------------------------------------------------*/
-/* Low level disk I/O module SKELETON for FatFs     (C)ChaN, 2025        */
+/* Low level disk I/O module for FatFs     (C)ChaN, 2025                 */
 /*-----------------------------------------------------------------------*/
-/* If a working storage control module is available, it should be        */
-/* attached to the FatFs via a glue function rather than modifying it.   */
-/* This is an example of glue functions to attach various exsisting      */
-/* storage control modules to the FatFs module with a defined API.       */
+/* Glue between FatFs and the public disk in the RP2040 flash, the same  */
+/* storage the USB mass storage callbacks expose to the host.            */
 /*-----------------------------------------------------------------------*/
 
 #include "ff.h"			/* Basic definitions of FatFs */
 #include "diskio.h"		/* Declarations FatFs MAI */
 
-/* Example: Declarations of the platform and disk functions in the project */
-#include "platform.h"
-#include "storage.h"
+#include "flash_disk.h"
+#include "hardware/flash.h"
+#include "rv3028.h"
 
-/* Example: Mapping of physical drive number for each drive */
-#define DEV_FLASH	0	/* Map FTL to physical drive 0 */
-#define DEV_MMC		1	/* Map MMC/SD card to physical drive 1 */
-#define DEV_USB		2	/* Map USB MSD to physical drive 2 */
+/* Mapping of physical drive number for each drive */
+#define DEV_FLASH	0	/* Public disk in the on-board flash */
 
 
 /*-----------------------------------------------------------------------*/
@@ -28,32 +24,7 @@ DSTATUS disk_status (
 	BYTE pdrv		/* Physical drive nmuber to identify the drive */
 )
 {
-	DSTATUS stat;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-		result = RAM_disk_status();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_MMC :
-		result = MMC_disk_status();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_USB :
-		result = USB_disk_status();
-
-		// translate the reslut code here
-
-		return stat;
-	}
-	return STA_NOINIT;
+	return (pdrv == DEV_FLASH) ? 0 : STA_NOINIT;
 }
 
 
@@ -66,32 +37,7 @@ DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {
-	DSTATUS stat;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-		result = RAM_disk_initialize();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_MMC :
-		result = MMC_disk_initialize();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_USB :
-		result = USB_disk_initialize();
-
-		// translate the reslut code here
-
-		return stat;
-	}
-	return STA_NOINIT;
+	return (pdrv == DEV_FLASH) ? 0 : STA_NOINIT;
 }
 
 
@@ -107,39 +53,10 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-	DRESULT res;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-		// translate the arguments here
-
-		result = RAM_disk_read(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_MMC :
-		// translate the arguments here
-
-		result = MMC_disk_read(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_USB :
-		// translate the arguments here
-
-		result = USB_disk_read(buff, sector, count);
+	if (pdrv != DEV_FLASH || sector + count > flash_disk_block_count()) return RES_PARERR;
 
-		// translate the reslut code here
-
-		return res;
-	}
-
-	return RES_PARERR;
+	flash_disk_read(sector, 0, buff, count * FLASH_DISK_BLOCK_SIZE);
+	return RES_OK;
 }
 
 
@@ -157,39 +74,9 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-	DRESULT res;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-		// translate the arguments here
-
-		result = RAM_disk_write(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_MMC :
-		// translate the arguments here
-
-		result = MMC_disk_write(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_USB :
-		// translate the arguments here
-
-		result = USB_disk_write(buff, sector, count);
-
-		// translate the reslut code here
+	if (pdrv != DEV_FLASH || sector + count > flash_disk_block_count()) return RES_PARERR;
 
-		return res;
-	}
-
-	return RES_PARERR;
+	return flash_disk_write(sector, 0, buff, count * FLASH_DISK_BLOCK_SIZE) ? RES_OK : RES_ERROR;
 }
 
 #endif
@@ -205,28 +92,45 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
-	DRESULT res;
-	int result;
+	if (pdrv != DEV_FLASH) return RES_PARERR;
 
-	switch (pdrv) {
-	case DEV_RAM :
+	switch (cmd) {
+	case CTRL_SYNC :		/* Writes go straight to flash */
+		return RES_OK;
 
-		// Process of the command for the RAM drive
+	case GET_SECTOR_COUNT :
+		*(LBA_t*)buff = flash_disk_block_count();
+		return RES_OK;
 
-		return res;
+	case GET_SECTOR_SIZE :
+		*(WORD*)buff = FLASH_DISK_BLOCK_SIZE;
+		return RES_OK;
 
-	case DEV_MMC :
+	case GET_BLOCK_SIZE :	/* Erase block size in sectors */
+		*(DWORD*)buff = FLASH_SECTOR_SIZE / FLASH_DISK_BLOCK_SIZE;
+		return RES_OK;
+	}
 
-		// Process of the command for the MMC/SD card
+	return RES_PARERR;
+}
 
-		return res;
 
-	case DEV_USB :
 
-		// Process of the command the USB drive
+/*-----------------------------------------------------------------------*/
+/* Timestamp for new and modified files, from the RTC                    */
+/*-----------------------------------------------------------------------*/
 
-		return res;
-	}
+#if !FF_FS_NORTC && !FF_FS_READONLY
 
-	return RES_PARERR;
+DWORD get_fattime (void)
+{
+	struct tm now;
+
+	if (rv3028_get_current_time(&now) != RV3028_SUCCESS) {
+		return ((DWORD)(FF_NORTC_YEAR - 1980) << 25 | (DWORD)FF_NORTC_MON << 21 | (DWORD)FF_NORTC_MDAY << 16);
+	}
+	return ((DWORD)(now.tm_year - 80) << 25 | (DWORD)(now.tm_mon + 1) << 21 | (DWORD)now.tm_mday << 16
+			| (DWORD)now.tm_hour << 11 | (DWORD)now.tm_min << 5 | (DWORD)now.tm_sec >> 1);
 }
+
+#endif
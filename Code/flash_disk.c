@@ -0,0 +1,239 @@
+#include "flash_disk.h"
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "dma_crc.h"
+#include "partition.h"
+#include <string.h>
+
+// Boot sector fields, see the FAT specification
+#define BPB_BYTES_PER_SECTOR 11
+#define BPB_SECTORS_PER_CLUSTER 13
+#define BPB_RESERVED_SECTORS 14
+#define BPB_NUM_FATS 16
+#define BPB_ROOT_ENTRIES 17
+#define BPB_TOTAL_SECTORS_16 19
+#define BPB_FAT_SIZE_16 22
+#define BPB_TOTAL_SECTORS_32 32
+#define BOOT_SIGNATURE 510
+#define MBR_PARTITION_ENTRY 446
+#define MBR_ENTRY_TYPE 4
+#define MBR_ENTRY_START 8
+#define MBR_ENTRY_SIZE 12
+
+#define FAT12_MAX_CLUSTERS 4084
+#define FAT16_MAX_CLUSTERS 65524
+#define MIN_VOLUME_BLOCKS 128 // FatFs does not recognise smaller FAT volumes
+#define HOST_WRITE_QUIET_US 2000000 // Time after a host write before the host counts as idle
+
+// Copies out of the disk through XIP. Host builds define this to charge them
+// as flash reads; on the board there is nothing to do.
+#ifndef XIP_READ
+#define XIP_READ(address, len)
+#endif
+
+typedef struct {
+    uint32_t start;           // First block of the volume on the disk
+    uint32_t total;           // Blocks in the volume
+    uint32_t data_start;      // First data block, relative to the volume
+    uint32_t fat_start;
+    uint32_t fat_entries;     // Entries the first FAT has room for
+    uint32_t cluster_blocks;
+    uint32_t clusters;
+    bool has_mbr;
+} fat_volume_t;
+
+static uint8_t sector_buffer[FLASH_SECTOR_SIZE];
+static bool media_changed = false;
+static uint64_t last_host_write_us;
+static bool host_has_written = false;
+
+static const uint8_t* disk_block(uint32_t lba) {
+    return (const uint8_t*)(XIP_BASE + partition_get(PARTITION_DISK)->offset + lba * FLASH_DISK_BLOCK_SIZE);
+}
+
+static uint16_t load_le16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t load_le32(const uint8_t* p) {
+    return load_le16(p) | ((uint32_t)load_le16(p + 2) << 16);
+}
+
+static void store_le16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void store_le32(uint8_t* p, uint32_t v) {
+    store_le16(p, v);
+    store_le16(p + 2, v >> 16);
+}
+
+uint32_t flash_disk_block_count(void) {
+    return partition_get(PARTITION_DISK)->size / FLASH_DISK_BLOCK_SIZE;
+}
+
+void flash_disk_read(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+    if (lba * FLASH_DISK_BLOCK_SIZE + offset + bufsize > partition_get(PARTITION_DISK)->size) {
+        memset(buffer, 0, bufsize); // Past the end of the disk; never read into the vault
+        return;
+    }
+    XIP_READ(disk_block(lba) + offset, bufsize);
+    memcpy(buffer, disk_block(lba) + offset, bufsize);
+}
+
+bool flash_disk_write(uint32_t lba, uint32_t offset, const void* buffer, uint32_t bufsize) {
+    const partition_t* disk = partition_get(PARTITION_DISK);
+    const uint8_t* data = buffer;
+    if (lba * FLASH_DISK_BLOCK_SIZE + offset + bufsize > disk->size) return false;
+    uint32_t block_addr_in_flash = disk->offset + lba * FLASH_DISK_BLOCK_SIZE + offset;
+
+    while (bufsize > 0) {
+        uint32_t sector_addr_in_flash = block_addr_in_flash & ~(FLASH_SECTOR_SIZE - 1);
+        uint32_t offset_in_sector = block_addr_in_flash - sector_addr_in_flash;
+        uint32_t len = FLASH_SECTOR_SIZE - offset_in_sector;
+        if (len > bufsize) len = bufsize;
+
+        XIP_READ((const void*)(XIP_BASE + sector_addr_in_flash), FLASH_SECTOR_SIZE);
+        memcpy(sector_buffer, (const void*)(XIP_BASE + sector_addr_in_flash), FLASH_SECTOR_SIZE);
+        memcpy(sector_buffer + offset_in_sector, data, len);
+
+        // XIP goes offline while the flash is written, so a DMA copy still
+        // reading from it (a vault restore prefetch) has to finish first
+        while (dma_crc_busy()) {
+            tight_loop_contents();
+        }
+
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_erase(sector_addr_in_flash, FLASH_SECTOR_SIZE);
+        flash_range_program(sector_addr_in_flash, sector_buffer, FLASH_SECTOR_SIZE);
+        restore_interrupts(ints);
+
+        block_addr_in_flash += len;
+        data += len;
+        bufsize -= len;
+    }
+    return true;
+}
+
+bool flash_disk_host_write(uint32_t lba, uint32_t offset, const void* buffer, uint32_t bufsize) {
+    last_host_write_us = time_us_64();
+    host_has_written = true;
+    return flash_disk_write(lba, offset, buffer, bufsize);
+}
+
+bool flash_disk_host_writing(void) {
+    return host_has_written && time_us_64() - last_host_write_us < HOST_WRITE_QUIET_US;
+}
+
+// Find the FAT volume, either at the start of the disk or in the first entry
+// of a partition table, and work out its geometry. Only FAT12 and FAT16
+// volumes are handled; FAT32 needs more clusters than the disk can hold.
+static bool find_volume(fat_volume_t* volume) {
+    const uint8_t* boot = disk_block(0);
+    if (load_le16(boot + BOOT_SIGNATURE) != 0xAA55) return false;
+
+    volume->start = 0;
+    volume->has_mbr = (boot[0] != 0xEB && boot[0] != 0xE9);
+    if (volume->has_mbr) {
+        const uint8_t* entry = boot + MBR_PARTITION_ENTRY;
+        if (entry[MBR_ENTRY_TYPE] == 0) return false;
+        volume->start = load_le32(entry + MBR_ENTRY_START);
+        if (volume->start >= flash_disk_block_count()) return false;
+        boot = disk_block(volume->start);
+        if (load_le16(boot + BOOT_SIGNATURE) != 0xAA55) return false;
+    }
+
+    uint32_t fat_size = load_le16(boot + BPB_FAT_SIZE_16);
+    uint32_t num_fats = boot[BPB_NUM_FATS];
+    volume->cluster_blocks = boot[BPB_SECTORS_PER_CLUSTER];
+    volume->total = load_le16(boot + BPB_TOTAL_SECTORS_16);
+    if (volume->total == 0) volume->total = load_le32(boot + BPB_TOTAL_SECTORS_32);
+    if (load_le16(boot + BPB_BYTES_PER_SECTOR) != FLASH_DISK_BLOCK_SIZE || fat_size == 0 || num_fats == 0 ||
+        volume->cluster_blocks == 0) {
+        return false;
+    }
+
+    uint32_t root_blocks = (load_le16(boot + BPB_ROOT_ENTRIES) * 32 + FLASH_DISK_BLOCK_SIZE - 1) / FLASH_DISK_BLOCK_SIZE;
+    volume->fat_start = load_le16(boot + BPB_RESERVED_SECTORS);
+    volume->data_start = volume->fat_start + num_fats * fat_size + root_blocks;
+    if (volume->total <= volume->data_start) return false;
+    volume->clusters = (volume->total - volume->data_start) / volume->cluster_blocks;
+
+    uint32_t fat_bits = volume->clusters <= FAT12_MAX_CLUSTERS ? 12 : 16;
+    volume->fat_entries = fat_size * FLASH_DISK_BLOCK_SIZE * 8 / fat_bits;
+    return volume->clusters <= FAT16_MAX_CLUSTERS;
+}
+
+static uint32_t fat_entry(const fat_volume_t* volume, uint32_t cluster) {
+    const uint8_t* fat = disk_block(volume->start + volume->fat_start);
+    if (volume->clusters > FAT12_MAX_CLUSTERS) {
+        return load_le16(fat + cluster * 2);
+    }
+    uint16_t pair = load_le16(fat + cluster + cluster / 2);
+    return (cluster & 1) ? pair >> 4 : pair & 0xFFF;
+}
+
+static uint32_t volume_end(const fat_volume_t* volume, uint32_t clusters) {
+    return volume->start + volume->data_start + clusters * volume->cluster_blocks;
+}
+
+uint32_t flash_disk_volume_blocks(void) {
+    fat_volume_t volume;
+    return find_volume(&volume) ? volume.start + volume.total : 0;
+}
+
+bool flash_disk_volume_limits(uint32_t* min_blocks, uint32_t* max_blocks) {
+    fat_volume_t volume;
+    if (!find_volume(&volume)) return false;
+
+    // Clusters are numbered from 2; keep everything up to the last one in use
+    uint32_t last_used = 1;
+    for (uint32_t cluster = volume.clusters + 1; cluster >= 2; cluster--) {
+        if (fat_entry(&volume, cluster) != 0) {
+            last_used = cluster;
+            break;
+        }
+    }
+
+    bool fat16 = volume.clusters > FAT12_MAX_CLUSTERS;
+    uint32_t min_clusters = last_used - 1;
+    uint32_t type_min = fat16 ? FAT12_MAX_CLUSTERS + 1 : 1;
+    if (min_clusters < type_min) min_clusters = type_min;
+
+    uint32_t max_clusters = volume.fat_entries - 2;
+    uint32_t type_max = fat16 ? FAT16_MAX_CLUSTERS : FAT12_MAX_CLUSTERS;
+    if (max_clusters > type_max) max_clusters = type_max;
+
+    *min_blocks = volume_end(&volume, min_clusters);
+    if (*min_blocks < volume.start + MIN_VOLUME_BLOCKS) *min_blocks = volume.start + MIN_VOLUME_BLOCKS;
+    *max_blocks = volume_end(&volume, max_clusters);
+    return *min_blocks <= *max_blocks;
+}
+
+bool flash_disk_resize_volume(uint32_t blocks) {
+    fat_volume_t volume;
+    if (!find_volume(&volume) || blocks <= volume.start + volume.data_start || blocks > flash_disk_block_count()) return false;
+    uint32_t total = blocks - volume.start;
+
+    uint8_t boot[FLASH_DISK_BLOCK_SIZE];
+    memcpy(boot, disk_block(volume.start), sizeof(boot));
+    store_le16(boot + BPB_TOTAL_SECTORS_16, total < 0x10000 ? total : 0);
+    store_le32(boot + BPB_TOTAL_SECTORS_32, total < 0x10000 ? 0 : total);
+    if (!flash_disk_write(volume.start, 0, boot, sizeof(boot))) return false;
+
+    if (volume.has_mbr) {
+        memcpy(boot, disk_block(0), sizeof(boot));
+        store_le32(boot + MBR_PARTITION_ENTRY + MBR_ENTRY_SIZE, total);
+        if (!flash_disk_write(0, 0, boot, sizeof(boot))) return false;
+    }
+
+    media_changed = true;
+    return true;
+}
+
+bool flash_disk_take_media_change(void) {
+    bool changed = media_changed;
+    media_changed = false;
+    return changed;
+}
@@ -0,0 +1,46 @@
+#ifndef FLASH_DISK_H
+#define FLASH_DISK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The public FAT disk, exposed over USB and mounted by FatFs, lives in the
+// disk partition after the firmware.
+#define FLASH_DISK_BLOCK_SIZE 512
+
+// Number of FLASH_DISK_BLOCK_SIZE blocks on the disk.
+uint32_t flash_disk_block_count(void);
+
+// Read bufsize bytes starting offset bytes into the given block.
+void flash_disk_read(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
+
+// Write bufsize bytes starting offset bytes into the given block, erasing and
+// reprogramming each flash sector it touches.
+bool flash_disk_write(uint32_t lba, uint32_t offset, const void* buffer, uint32_t bufsize);
+
+// A write from the USB host: as flash_disk_write(), and also noted for
+// flash_disk_host_writing().
+bool flash_disk_host_write(uint32_t lba, uint32_t offset, const void* buffer, uint32_t bufsize);
+
+// True if the USB host wrote to the disk in the last couple of seconds, and
+// so may be part way through a file.
+bool flash_disk_host_writing(void);
+
+// Size of the FAT volume on the disk in blocks, counted from the start of the
+// disk, or 0 if no FAT12/16 volume is found.
+uint32_t flash_disk_volume_blocks(void);
+
+// The range the FAT volume can be resized to: it can only shrink while the
+// clusters it gives up are free, can only grow as far as its FAT covers, and
+// must keep a cluster count of the same FAT type.
+bool flash_disk_volume_limits(uint32_t* min_blocks, uint32_t* max_blocks);
+
+// Rewrite the volume's boot sector (and partition entry, if it has one) for
+// a new size. FatFs must remount the volume afterwards.
+bool flash_disk_resize_volume(uint32_t blocks);
+
+// Returns true once after the disk's size has changed, so the host can be
+// told to re-read it.
+bool flash_disk_take_media_change(void);
+
+#endif // FLASH_DISK_H
@@ -2,31 +2,314 @@
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
 #include "fatfs/ff.h"
+#include "dma_crc.h"
+#include "vault_crypto.h"
+#include "vault_dedup.h"
+#include "vault_meta.h"
+#include "partition.h"
+#include "flash_disk.h"
+#include "iso8601.h"
+#include "trace.h"
+#include "tusb.h"
 #include <string.h>
 #include <time.h>
 
-#define PRIVATE_STORAGE_OFFSET (15 * 1024 * 1024)
-#define PRIVATE_STORAGE_SIZE (1 * 1024 * 1024)
-#define METADATA_SIZE 256
-
-static const uint32_t private_flash_address = XIP_BASE + PRIVATE_STORAGE_OFFSET;
-
+// The meta partition holds the journal, then one header sector per capsule,
+// then the two halves of the chunk index. Chunks themselves live in the
+// vault partition.
+#define HEADER_SIZE FLASH_SECTOR_SIZE
+#define HEADERS_SIZE (VAULT_MAX_CAPSULES * HEADER_SIZE)
+#define VAULT_MIN_SIZE FLASH_BLOCK_SIZE
+#define VAULT_STEP FLASH_BLOCK_SIZE // Granularity of disk/vault rebalancing
+#define RECIPE_OFFSET 512 // Chunk ids in file order, after metadata_t in the header sector
+#define MAX_RECIPE ((HEADER_SIZE - RECIPE_OFFSET) / sizeof(uint16_t))
+#define CHECKPOINT_CHUNKS 32 // Chunks between progress records in the journal
+#define MAX_REJECTED 32 // Files remembered as having failed to lock
+#define CHUNK_READ_ATTEMPTS 3 // Copies of a chunk tried before it is taken as bad
+
+#ifndef RESTORE_PREFETCH
+#define RESTORE_PREFETCH 1 // Copy the next chunk by DMA while a restore writes the current one
+#endif
+
+// The unlock time comes first, so checking which capsule is due only reads
+// the first few bytes of each header.
 typedef struct {
+    int64_t unlock_time;              // Seconds since 1970, worked out once when the file is stored
     char filename[256];
-    struct tm unlock_date;
     uint32_t file_size;
-    bool is_valid;
+    bool is_encrypted;
+    uint8_t nonce[VAULT_NONCE_SIZE];
+    uint8_t tag[VAULT_TAG_SIZE];      // MAC over the stored chunks in recipe order
+    uint32_t chunk_count;
 } metadata_t;
 
+// A file that could not be locked, as it was then, so the main loop does not
+// try it again on every pass
+typedef struct {
+    bool used;
+    uint32_t name_crc;
+    uint32_t size;
+    uint16_t date;
+    uint16_t time;
+} rejected_t;
+
+static uint16_t recipe[MAX_RECIPE];
+static uint8_t chunk_buffers[2][VAULT_CHUNK_MAX]; // On restore, one fills by DMA while the other is written out
+
 static const char* public_path = "0:";
 static FATFS fs_public;
+static uint32_t header_offset;
+static rejected_t rejected[MAX_REJECTED];
+static uint32_t rejected_next;
+static bool retry_rejected; // Set when a release may have made room
+static bool vault_online;   // Clear when an old volume holds the vault's place
+static bool rebalance_deferred; // Set when a resize waited for the host
+static void (*lock_handler)(int64_t unlock_time) = NULL;
+
+static const metadata_t* capsule_header(uint32_t capsule) {
+    return (const metadata_t*)(XIP_BASE + header_offset + capsule * HEADER_SIZE);
+}
+
+static const uint16_t* capsule_recipe(uint32_t capsule) {
+    return (const uint16_t*)((const uint8_t*)capsule_header(capsule) + RECIPE_OFFSET);
+}
+
+// The locked capsule that unlocks first, or -1 if none is locked. A capsule
+// whose restore was interrupted comes before any other; one that failed for
+// good is passed over.
+static int next_capsule(void) {
+    if (!vault_online) return -1;
+
+    int next = -1;
+    int64_t next_time = 0;
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        vault_state_t state = vault_meta_state(capsule);
+        if (state == VAULT_STATE_RESTORING) return capsule;
+        if (state != VAULT_STATE_LOCKED) continue;
+        int64_t unlock_time = capsule_header(capsule)->unlock_time;
+        if (next < 0 || unlock_time < next_time) {
+            next = capsule;
+            next_time = unlock_time;
+        }
+    }
+    return next;
+}
+
+static int free_capsule(void) {
+    if (!vault_online) return -1;
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        vault_state_t state = vault_meta_state(capsule);
+        if (state == VAULT_STATE_EMPTY || state == VAULT_STATE_RELEASED) return capsule;
+    }
+    return -1;
+}
+
+// An interrupted ingest of this file, or -1 if there is none. The file must
+// not have changed size since.
+static int find_ingest(const char* filename, uint32_t file_size) {
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        if (vault_meta_state(capsule) != VAULT_STATE_INGESTING) continue;
+        const metadata_t* header = capsule_header(capsule);
+        if (header->file_size == file_size && strcmp(header->filename, filename) == 0) return capsule;
+    }
+    return -1;
+}
+
+// Number of chunks a capsule holds references to. While it is being stored
+// that is only as far as its last checkpoint.
+static uint32_t held_chunks(uint32_t capsule) {
+    switch (vault_meta_state(capsule)) {
+    case VAULT_STATE_LOCKED:
+    case VAULT_STATE_RESTORING:
+    case VAULT_STATE_FAILED:
+        return capsule_header(capsule)->chunk_count;
+    case VAULT_STATE_INGESTING:
+        return vault_meta_progress(capsule);
+    default:
+        return 0;
+    }
+}
+
+// Length of the file covered by the first count chunks of a recipe. Fails if
+// any of them is no longer in the vault.
+static bool recipe_bytes(const uint16_t* chunk_ids, uint32_t count, uint32_t* bytes) {
+    *bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const vault_chunk_t* chunk = vault_dedup_chunk(chunk_ids[i]);
+        if (chunk == NULL) return false;
+        *bytes += chunk->length;
+    }
+    return true;
+}
+
+// Disks formatted before there was a partition table ran to the end of flash,
+// over the vault. Pull such a volume back inside the disk partition; this
+// fails if files lie past it.
+static bool fit_volume(void) {
+    uint32_t blocks = flash_disk_block_count();
+    if (flash_disk_volume_blocks() <= blocks) return true;
+
+    uint32_t min_blocks, max_blocks;
+    return flash_disk_volume_limits(&min_blocks, &max_blocks) && min_blocks <= blocks &&
+           flash_disk_resize_volume(blocks);
+}
 
 bool fs_init(void) {
+    dma_crc_init();
+
+    // Nothing is written past the volume until it fits its partition. An old
+    // volume that cannot be shrunk keeps the old layout with no vault, so
+    // what the host stored there is neither overwritten nor cut off.
+    bool saved = partition_init();
+    if (!fit_volume()) {
+        if (!saved) {
+            printf("Public volume has files where the vault goes; copy them off and reformat the disk\n");
+            partition_use_legacy_layout();
+            return false;
+        }
+        printf("Public volume overlaps the vault; blocks past the disk stay hidden until it is reformatted\n");
+    }
+    if (!saved && !partition_save()) return false;
+
+    const partition_t* meta = partition_get(PARTITION_META);
+    const partition_t* vault = partition_get(PARTITION_VAULT);
+    header_offset = meta->offset + VAULT_META_SIZE;
+    vault_meta_init(meta->offset);
+    vault_crypto_init();
+    vault_dedup_init(header_offset + HEADERS_SIZE, meta->size - VAULT_META_SIZE - HEADERS_SIZE, vault->offset, vault->size);
+
+    // Reference counts are not stored; rebuild them from the capsules
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        uint32_t count = held_chunks(capsule);
+        const uint16_t* chunk_ids = capsule_recipe(capsule);
+        for (uint32_t i = 0; i < count && i < MAX_RECIPE; i++) {
+            vault_dedup_ref(chunk_ids[i]);
+        }
+    }
+    vault_online = true;
+    return true;
+}
+
+static bool same_file(const rejected_t* entry, const FILINFO* fno) {
+    return entry->used && entry->size == fno->fsize && entry->date == fno->fdate && entry->time == fno->ftime &&
+           entry->name_crc == dma_crc32(fno->fname, NULL, strlen(fno->fname));
+}
+
+// Remember a file that failed to lock. It is tried again once it changes,
+// once a capsule has been released and its space reclaimed, or after the
+// next power-up.
+static void reject_file(const FILINFO* fno) {
+    rejected_t* entry = &rejected[rejected_next++ % MAX_REJECTED];
+    entry->used = true;
+    entry->name_crc = dma_crc32(fno->fname, NULL, strlen(fno->fname));
+    entry->size = fno->fsize;
+    entry->date = fno->fdate;
+    entry->time = fno->ftime;
+}
+
+static bool is_rejected(const FILINFO* fno) {
+    for (uint32_t i = 0; i < MAX_REJECTED; i++) {
+        if (same_file(&rejected[i], fno)) return true;
+    }
+    return false;
+}
+
+// The least room a file can take if none of its chunks are stored already:
+// its bytes, and an index entry per largest chunk. A file that would only
+// fit by sharing chunks already in the vault is turned away too.
+static bool vault_has_room(uint32_t file_size) {
+    uint32_t bytes, entries;
+    vault_dedup_room(&bytes, &entries);
+    return bytes >= file_size && entries >= (file_size + VAULT_CHUNK_MAX - 1) / VAULT_CHUNK_MAX;
+}
+
+static void log_throughput(const char* operation, const char* filename, uint32_t bytes, uint64_t start_us) {
+    uint64_t elapsed_us = time_us_64() - start_us;
+    uint32_t kb_per_s = elapsed_us ? (uint32_t)((uint64_t)bytes * 1000000 / 1024 / elapsed_us) : 0;
+    printf("%s %s: %lu bytes in %lu ms (%lu KB/s)\n", operation, filename,
+           (unsigned long)bytes, (unsigned long)(elapsed_us / 1000), (unsigned long)kb_per_s);
+}
+
+static bool is_erased_sector(uint32_t offset) {
+    const uint32_t* words = (const uint32_t*)(XIP_BASE + offset);
+    for (size_t i = 0; i < FLASH_SECTOR_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) return false;
+    }
     return true;
 }
 
+// A host part way through writing a file still has the volume's old size in
+// mind, so the disk is not resized under it
+static bool host_writing(void) {
+    return tud_mounted() && flash_disk_host_writing();
+}
+
+static uint32_t round_up(uint32_t value, uint32_t step) {
+    return (value + step - 1) / step * step;
+}
+
+// Move the boundary between the disk and the vault so the vault has room for
+// `needed` more bytes beyond what it stores, or with needed = 0, hand
+// everything it does not use back to the disk. The vault can only take
+// blocks at the end of the FAT volume that no file uses, and the volume can
+// only grow as far as its FAT reaches. FatFs is remounted afterwards, so no
+// file may be open. While the host is writing, handing space back waits for
+// fs_background_task().
+static bool rebalance_vault(uint32_t needed) {
+    const partition_t* disk = partition_get(PARTITION_DISK);
+    const partition_t* vault = partition_get(PARTITION_VAULT);
+    uint32_t vault_end = vault->offset + vault->size;
+    uint32_t want = round_up(vault_dedup_extent() + needed, VAULT_STEP);
+    if (want < VAULT_MIN_SIZE) want = VAULT_MIN_SIZE;
+    if (want > vault_end - disk->offset - FLASH_SECTOR_SIZE) want = vault_end - disk->offset - FLASH_SECTOR_SIZE;
+
+    uint32_t min_blocks, max_blocks;
+    uint32_t target = vault_end - want;
+    if (target == vault->offset) return true;
+    if (host_writing()) {
+        rebalance_deferred = true;
+        return vault->size >= want;
+    }
+    if (!flash_disk_volume_limits(&min_blocks, &max_blocks)) {
+        // Without a readable volume there is no telling what the disk holds
+        return vault->size >= want;
+    }
+
+    if (target < vault->offset) {
+        uint32_t disk_floor = round_up(disk->offset + min_blocks * FLASH_DISK_BLOCK_SIZE, FLASH_SECTOR_SIZE);
+        if (target < disk_floor) target = disk_floor;
+        if (target >= vault->offset) return false;
+
+        // Shrink the volume first and erase what it gave up; until the table
+        // is written the space is simply unused by both. Free clusters are
+        // often blank already and are left alone.
+        uint32_t disk_blocks = (target - disk->offset) / FLASH_DISK_BLOCK_SIZE;
+        if (flash_disk_volume_blocks() > disk_blocks && !flash_disk_resize_volume(disk_blocks)) return false;
+        for (uint32_t offset = target; offset < vault->offset; offset += FLASH_SECTOR_SIZE) {
+            if (is_erased_sector(offset)) continue;
+            uint32_t ints = save_and_disable_interrupts();
+            flash_range_erase(offset, FLASH_SECTOR_SIZE);
+            restore_interrupts(ints);
+        }
+        if (!partition_set_vault_offset(target)) return false;
+    } else {
+        // Give the space to the disk first, then let the volume grow into it
+        if (!partition_set_vault_offset(target)) return false;
+        uint32_t disk_blocks = flash_disk_block_count();
+        if (disk_blocks > max_blocks) disk_blocks = max_blocks;
+        if (disk_blocks > flash_disk_volume_blocks()) flash_disk_resize_volume(disk_blocks);
+    }
+
+    vault_dedup_set_store(vault->offset, vault->size);
+    f_mount(&fs_public, public_path, 1);
+    printf("Vault resized to %lu KB\n", (unsigned long)(vault->size / 1024));
+    return vault->size >= want;
+}
+
 bool fs_mount_partitions(void) {
+    TRACE_BEGIN(TRACE_FS_MOUNT, 0);
     FRESULT fr = f_mount(&fs_public, public_path, 1);
+    TRACE_END(TRACE_FS_MOUNT, fr);
     if (fr != FR_OK) {
         printf("Failed to mount public partition: %d\n", fr);
         return false;
@@ -34,96 +317,517 @@ bool fs_mount_partitions(void) {
     return true;
 }
 
-bool fs_move_to_private(const char* filename) {
+// Program part of a capsule's header sector a page at a time, with the rest
+// of each page left at 0xFF so what is already there is untouched.
+static void program_header(uint32_t capsule, uint32_t offset, const void* data, size_t len) {
+    const uint8_t* bytes = data;
+    uint8_t page[FLASH_PAGE_SIZE];
+    while (len > 0) {
+        uint32_t page_offset = offset & ~(FLASH_PAGE_SIZE - 1);
+        size_t n = page_offset + FLASH_PAGE_SIZE - offset;
+        if (n > len) n = len;
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page + (offset - page_offset), bytes, n);
+
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_program(header_offset + capsule * HEADER_SIZE + page_offset, page, FLASH_PAGE_SIZE);
+        restore_interrupts(ints);
+
+        offset += n;
+        bytes += n;
+        len -= n;
+    }
+}
+
+static void release_chunks(const uint16_t* chunk_ids, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vault_dedup_unref(chunk_ids[i]);
+    }
+}
+
+// Give up on a capsule that was being stored and free its slot.
+static void abandon_ingest(uint32_t capsule, uint32_t chunk_count) {
+    release_chunks(capsule_recipe(capsule), chunk_count);
+    vault_meta_commit(capsule, VAULT_STATE_EMPTY);
+}
+
+// Store one chunk, or find it already in the vault, append it to the recipe
+// in RAM and in the header, and add its stored bytes to the capsule's MAC.
+// Every CHECKPOINT_CHUNKS chunks the recipe so far is committed to the journal.
+static bool add_chunk(uint32_t capsule, metadata_t* metadata, vault_cipher_t* cipher, uint8_t* chunk, size_t len, uint32_t content_hash) {
+    if (metadata->chunk_count == MAX_RECIPE) {
+        printf("Too many chunks for one capsule\n");
+        return false;
+    }
+
+    uint16_t id = vault_dedup_put(chunk, len, content_hash);
+    if (id == VAULT_NO_CHUNK) return false;
+
+    // A resumed ingest may find slots past its checkpoint already written by
+    // the interrupted run; they can be kept only if they name the same chunk
+    uint16_t written = capsule_recipe(capsule)[metadata->chunk_count];
+    if (written != VAULT_NO_CHUNK && written != id) {
+        printf("Capsule recipe does not match its interrupted ingest\n");
+        vault_dedup_unref(id);
+        return false;
+    }
+    program_header(capsule, RECIPE_OFFSET + metadata->chunk_count * sizeof(uint16_t), &id, sizeof(id));
+    recipe[metadata->chunk_count++] = id;
+
+    if (metadata->is_encrypted) {
+        vault_cipher_authenticate(cipher, vault_dedup_data(vault_dedup_chunk(id)), len);
+    }
+    if (metadata->chunk_count % CHECKPOINT_CHUNKS == 0) {
+        vault_meta_checkpoint(capsule, VAULT_STATE_INGESTING, metadata->chunk_count);
+    }
+    return true;
+}
+
+// Set up a new capsule for a file and write everything but its MAC and
+// chunk count to the header, which stay erased until it is complete.
+static bool begin_ingest(uint32_t capsule, const char* filename, metadata_t* metadata, vault_cipher_t* cipher, FIL* fil) {
+    memset(metadata, 0, sizeof(metadata_t));
+    strncpy(metadata->filename, filename, sizeof(metadata->filename) - 1);
+    metadata->file_size = f_size(fil);
+
+    if (!iso8601_parse(filename, &metadata->unlock_time)) {
+        printf("%s does not start with an unlock date\n", filename);
+        return false;
+    }
+
+    if (metadata->file_size > MAX_RECIPE * VAULT_CHUNK_MAX) {
+        printf("File too large for private storage: %lu bytes\n", (unsigned long)metadata->file_size);
+        return false;
+    }
+
+    metadata->is_encrypted = VAULT_ENCRYPTION;
+    if (metadata->is_encrypted) {
+        if (!vault_crypto_ready()) {
+            printf("No vault key; refusing to lock %s unencrypted\n", filename);
+            return false;
+        }
+        vault_crypto_new_nonce(metadata->nonce);
+        vault_cipher_begin(cipher, metadata->nonce);
+    }
+
+    vault_dedup_reset_if_unused();
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(header_offset + capsule * HEADER_SIZE, HEADER_SIZE);
+    restore_interrupts(ints);
+
+    metadata_t pending;
+    memcpy(&pending, metadata, sizeof(pending));
+    memset(pending.tag, 0xFF, sizeof(pending.tag));
+    pending.chunk_count = 0xFFFFFFFF;
+    program_header(capsule, 0, &pending, sizeof(pending));
+    return vault_meta_commit(capsule, VAULT_STATE_INGESTING);
+}
+
+// Pick up an interrupted ingest at its last checkpoint. Chunks start afresh at
+// every boundary, so reading on from the end of the last stored chunk finds
+// the same boundaries the first run would have; the MAC is rebuilt from the
+// stored chunks.
+static bool resume_ingest(uint32_t capsule, metadata_t* metadata, vault_cipher_t* cipher, FIL* fil) {
+    memcpy(metadata, capsule_header(capsule), sizeof(metadata_t));
+    metadata->chunk_count = vault_meta_progress(capsule);
+    memcpy(recipe, capsule_recipe(capsule), metadata->chunk_count * sizeof(uint16_t));
+
+    uint32_t offset;
+    if (metadata->chunk_count > MAX_RECIPE || !recipe_bytes(recipe, metadata->chunk_count, &offset) ||
+        offset > metadata->file_size || f_lseek(fil, offset) != FR_OK) {
+        return false;
+    }
+
+    if (metadata->is_encrypted) {
+        if (!vault_crypto_ready()) return false;
+        vault_cipher_begin(cipher, metadata->nonce);
+        for (uint32_t i = 0; i < metadata->chunk_count; i++) {
+            const vault_chunk_t* chunk = vault_dedup_chunk(recipe[i]);
+            vault_cipher_authenticate(cipher, vault_dedup_data(chunk), chunk->length);
+        }
+    }
+    printf("Resuming %s at %lu of %lu bytes\n", metadata->filename, (unsigned long)offset, (unsigned long)metadata->file_size);
+    return true;
+}
+
+static bool move_to_private(const char* filename) {
     FIL fil;
     FRESULT fr;
     char public_filepath[256];
     snprintf(public_filepath, sizeof(public_filepath), "%s/%s", public_path, filename);
 
+    FILINFO fno;
+    if (f_stat(public_filepath, &fno) != FR_OK) return false;
+
+    int capsule = find_ingest(filename, fno.fsize);
+    bool resuming = capsule >= 0;
+    if (!resuming) capsule = free_capsule();
+    if (capsule < 0) {
+        printf("No free capsule slot for %s\n", filename);
+        return false;
+    }
+
+    // Locking grows the vault, which waits for the host to stop writing; the
+    // file is tried again on a later pass
+    if (host_writing()) return false;
+
+    vault_dedup_compact_abort();
+
+    // Make room before the file is opened, since resizing remounts the volume.
+    // Without dedup every chunk would be new and padded to a whole page, and
+    // a chunk that does not fit in the open sector starts the next one, which
+    // can leave up to half of each sector unused.
+    uint32_t worst_case = 2 * (fno.fsize + (fno.fsize / VAULT_CHUNK_MIN + 1) * FLASH_PAGE_SIZE);
+    if (!rebalance_vault(worst_case)) {
+        printf("Vault may not have room for %s\n", filename);
+    }
+
+    // Nothing is written before this, so a file that cannot fit costs no
+    // erase and no journal record
+    if (!resuming && !vault_has_room(fno.fsize)) {
+        printf("Vault has no room for %s\n", filename);
+        reject_file(&fno);
+        rebalance_vault(0);
+        return false;
+    }
+
     fr = f_open(&fil, public_filepath, FA_READ);
-    if (fr != FR_OK) return false;
+    if (fr != FR_OK) {
+        if (resuming) abandon_ingest(capsule, vault_meta_progress(capsule));
+        reject_file(&fno);
+        return false;
+    }
 
     UINT br;
-    uint8_t buffer[FLASH_SECTOR_SIZE];
     metadata_t metadata;
+    vault_cipher_t cipher;
+    uint64_t start_us = time_us_64();
+    uint32_t stored_before = vault_dedup_bytes_stored();
+
+    if (resuming) {
+        if (!resume_ingest(capsule, &metadata, &cipher, &fil)) {
+            printf("Cannot resume %s; starting over\n", filename);
+            abandon_ingest(capsule, vault_meta_progress(capsule));
+            f_close(&fil);
+            return false;
+        }
+    } else if (!begin_ingest(capsule, filename, &metadata, &cipher, &fil)) {
+        f_close(&fil);
+        reject_file(&fno);
+        return false;
+    }
 
-    strncpy(metadata.filename, filename, sizeof(metadata.filename) - 1);
-    metadata.filename[sizeof(metadata.filename) - 1] = '\0';
-    metadata.file_size = f_size(&fil);
-    metadata.is_valid = true;
+    // Chunk boundaries come from the content, not the read size, so bytes are
+    // gathered into the chunk buffer until the chunker finds one.
+    uint8_t* buffer = chunk_buffers[0];
+    uint8_t* chunk = chunk_buffers[1];
+    vault_chunker_t chunker;
+    size_t chunk_len = 0;
+    bool ok = true;
+    vault_chunker_reset(&chunker);
+    while (ok && (fr = f_read(&fil, buffer, VAULT_CHUNK_MAX, &br)) == FR_OK && br > 0) {
+        size_t used = 0;
+        while (ok && used < br) {
+            bool boundary;
+            size_t n = vault_chunker_scan(&chunker, buffer + used, br - used, &boundary);
+            memcpy(chunk + chunk_len, buffer + used, n);
+            chunk_len += n;
+            used += n;
+            if (boundary) {
+                ok = add_chunk(capsule, &metadata, &cipher, chunk, chunk_len, chunker.content_hash);
+                chunk_len = 0;
+                vault_chunker_reset(&chunker);
+            }
+        }
+    }
+    if (ok && fr != FR_OK) {
+        printf("Failed to read %s: %d\n", filename, fr);
+        ok = false;
+    }
+    if (ok && chunk_len > 0) {
+        ok = add_chunk(capsule, &metadata, &cipher, chunk, chunk_len, chunker.content_hash);
+    }
 
-    sscanf(filename, "%d-%d-%d", &metadata.unlock_date.tm_year, &metadata.unlock_date.tm_mon, &metadata.unlock_date.tm_mday);
-    metadata.unlock_date.tm_year -= 1900;
-    metadata.unlock_date.tm_mon -= 1;
+    // A capsule missing part of its file could never be restored, and the
+    // file is deleted once it is locked
+    uint32_t stored;
+    if (ok && (!recipe_bytes(recipe, metadata.chunk_count, &stored) || stored != metadata.file_size)) {
+        printf("Stored %lu of %lu bytes of %s\n", (unsigned long)stored, (unsigned long)metadata.file_size, filename);
+        ok = false;
+    }
 
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(PRIVATE_STORAGE_OFFSET, PRIVATE_STORAGE_SIZE);
-    flash_range_program(PRIVATE_STORAGE_OFFSET, (uint8_t*)&metadata, sizeof(metadata_t));
-    restore_interrupts(ints);
+    if (ok && metadata.is_encrypted) {
+        vault_cipher_finish(&cipher, metadata.tag);
+    }
 
-    uint32_t offset = METADATA_SIZE;
-    while (f_read(&fil, buffer, sizeof(buffer), &br) == FR_OK && br > 0) {
-        ints = save_and_disable_interrupts();
-        flash_range_program(PRIVATE_STORAGE_OFFSET + offset, buffer, br);
-        restore_interrupts(ints);
-        offset += br;
+    // The capsule only counts as locked once its journal record is in flash
+    if (ok) {
+        program_header(capsule, 0, &metadata, sizeof(metadata));
+        if (lock_handler) lock_handler(metadata.unlock_time);
+        ok = vault_meta_commit(capsule, VAULT_STATE_LOCKED);
+    }
+    if (!ok) {
+        abandon_ingest(capsule, metadata.chunk_count);
+        f_close(&fil);
+        reject_file(&fno);
+        rebalance_vault(0);
+        return false;
     }
 
     f_close(&fil);
     f_unlink(public_filepath);
+    log_throughput("Locked", filename, metadata.file_size, start_us);
+    printf("%lu chunks, %lu new bytes stored\n", (unsigned long)metadata.chunk_count,
+           (unsigned long)(vault_dedup_bytes_stored() - stored_before));
+    rebalance_vault(0);
     return true;
 }
 
+bool fs_move_to_private(const char* filename) {
+    if (!vault_online) return false;
+
+    TRACE_BEGIN(TRACE_FS_LOCK, 0);
+    bool ok = move_to_private(filename);
+    TRACE_END(TRACE_FS_LOCK, ok);
+    return ok;
+}
+
+void fs_set_lock_handler(void (*handler)(int64_t unlock_time)) {
+    lock_handler = handler;
+}
+
 bool fs_is_file_in_private(void) {
-    metadata_t metadata;
-    memcpy(&metadata, (void*)private_flash_address, sizeof(metadata_t));
-    return metadata.is_valid;
+    return next_capsule() >= 0;
 }
 
-bool fs_get_unlock_date(struct tm* unlock_date) {
-    metadata_t metadata;
-    memcpy(&metadata, (void*)private_flash_address, sizeof(metadata_t));
-    if (!metadata.is_valid) return false;
-    *unlock_date = metadata.unlock_date;
+bool fs_has_free_slot(void) {
+    return free_capsule() >= 0;
+}
+
+bool fs_get_unlock_time(int64_t* unlock_time) {
+    int capsule = next_capsule();
+    if (capsule < 0) return false;
+    *unlock_time = capsule_header(capsule)->unlock_time;
     return true;
 }
 
-bool fs_move_to_public(void) {
+uint32_t fs_vault_generation(void) {
+    return vault_meta_generation();
+}
+
+// Set aside a capsule that can never be restored, so the capsules after it
+// still unlock. Its chunks and slot are kept rather than thrown away.
+static void set_aside(uint32_t capsule, const char* filename) {
+    printf("%s cannot be restored; setting it aside\n", filename);
+    vault_meta_commit(capsule, VAULT_STATE_FAILED);
+}
+
+static bool move_to_public(void) {
+    int capsule = next_capsule();
+    if (capsule < 0) return false;
     metadata_t metadata;
-    memcpy(&metadata, (void*)private_flash_address, sizeof(metadata_t));
-    if (!metadata.is_valid) return false;
+    memcpy(&metadata, capsule_header(capsule), sizeof(metadata_t));
+    const uint16_t* chunk_ids = capsule_recipe(capsule);
+    vault_dedup_compact_abort();
+
+    // Every chunk the recipe names must still be in the index, and together
+    // they must add up to the file
+    uint32_t total;
+    if (metadata.chunk_count > MAX_RECIPE || !recipe_bytes(chunk_ids, metadata.chunk_count, &total) ||
+        total != metadata.file_size) {
+        printf("Capsule %s is missing chunks\n", metadata.filename);
+        set_aside(capsule, metadata.filename);
+        return true;
+    }
+
+    uint64_t start_us = time_us_64();
+    if (metadata.is_encrypted) {
+        if (!vault_crypto_ready()) {
+            printf("No vault key; cannot unlock %s\n", metadata.filename);
+            return false;
+        }
+
+        // Authenticate the whole capsule before releasing any plaintext
+        vault_cipher_t cipher;
+        vault_cipher_begin(&cipher, metadata.nonce);
+        for (uint32_t i = 0; i < metadata.chunk_count; i++) {
+            const vault_chunk_t* chunk = vault_dedup_chunk(chunk_ids[i]);
+            vault_cipher_authenticate(&cipher, vault_dedup_data(chunk), chunk->length);
+        }
+        if (!vault_cipher_verify(&cipher, metadata.tag)) {
+            printf("Authentication failed for %s\n", metadata.filename);
+            set_aside(capsule, metadata.filename);
+            return true;
+        }
+    }
 
     FIL fil;
     char public_filepath[256];
     snprintf(public_filepath, sizeof(public_filepath), "%s/%s", public_path, metadata.filename);
 
-    if (f_open(&fil, public_filepath, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return false;
+    // An interrupted restore carries on after the last chunk it checkpointed,
+    // as long as the file still reaches that far
+    uint32_t done = vault_meta_state(capsule) == VAULT_STATE_RESTORING ? vault_meta_progress(capsule) : 0;
+    uint32_t offset = 0;
+    if (f_open(&fil, public_filepath, FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) return false;
+    if (done > metadata.chunk_count || !recipe_bytes(chunk_ids, done, &offset) || f_size(&fil) < offset) {
+        done = 0;
+        offset = 0;
+    }
+    if (f_lseek(&fil, offset) != FR_OK || (done == 0 && !vault_meta_commit(capsule, VAULT_STATE_RESTORING))) {
+        f_close(&fil);
+        return false;
+    }
+    if (done > 0) {
+        printf("Resuming %s at %lu of %lu bytes\n", metadata.filename, (unsigned long)offset, (unsigned long)metadata.file_size);
+    }
 
     UINT bw;
-    uint32_t offset = METADATA_SIZE;
-    uint32_t remaining = metadata.file_size;
-    uint8_t buffer[FLASH_SECTOR_SIZE];
+    uint8_t* filling = chunk_buffers[0];
+    uint8_t* writing = chunk_buffers[1];
+
+    // Copy out of XIP by DMA so each chunk's CRC comes for free with the copy.
+    // While one buffer is decrypted and written to the FAT volume, the next
+    // chunk streams into the other; the disk layer waits for the DMA to finish
+    // before it takes XIP offline to erase or program. Without RESTORE_PREFETCH
+    // each chunk is copied only once the one before it is written.
+    const vault_chunk_t* next = done < metadata.chunk_count ? vault_dedup_chunk(chunk_ids[done]) : NULL;
+    if (RESTORE_PREFETCH && next) {
+        dma_crc_start(vault_dedup_data(next), filling, next->length);
+    }
+
+    for (uint32_t i = done; i < metadata.chunk_count; i++) {
+        const vault_chunk_t* current = next;
+        if (!RESTORE_PREFETCH) {
+            dma_crc_start(vault_dedup_data(current), filling, current->length);
+        }
+        uint32_t crc = dma_crc_finish();
+
+        // A bad read is copied again; a chunk that fails every time has gone
+        // bad in flash. The vault copy is the only one, so it is kept and the
+        // partial file dropped.
+        for (int attempt = 1; crc != current->crc && attempt < CHUNK_READ_ATTEMPTS; attempt++) {
+            dma_crc_start(vault_dedup_data(current), filling, current->length);
+            crc = dma_crc_finish();
+        }
+        if (crc != current->crc) {
+            printf("Integrity error in chunk %lu: expected %08lx, got %08lx\n",
+                   (unsigned long)i, (unsigned long)current->crc, (unsigned long)crc);
+            f_close(&fil);
+            f_unlink(public_filepath);
+            set_aside(capsule, metadata.filename);
+            return true;
+        }
+
+        // Nothing is reading flash between transfers, so this is where the
+        // file is flushed and its progress journaled
+        if (i > done && i % CHECKPOINT_CHUNKS == 0 && f_sync(&fil) == FR_OK) {
+            vault_meta_checkpoint(capsule, VAULT_STATE_RESTORING, i);
+        }
+
+        uint8_t* filled = filling;
+        filling = writing;
+        writing = filled;
+
+        next = i + 1 < metadata.chunk_count ? vault_dedup_chunk(chunk_ids[i + 1]) : NULL;
+        if (RESTORE_PREFETCH && next) {
+            dma_crc_start(vault_dedup_data(next), filling, next->length);
+        }
+
+        vault_dedup_decrypt(current, writing);
 
-    while (remaining > 0) {
-        uint32_t to_read = remaining > sizeof(buffer) ? sizeof(buffer) : remaining;
-        memcpy(buffer, (void*)(private_flash_address + offset), to_read);
-        f_write(&fil, buffer, to_read, &bw);
-        offset += bw;
-        remaining -= bw;
+        if (f_write(&fil, writing, current->length, &bw) != FR_OK || bw != current->length) {
+            printf("Failed to write %s\n", public_filepath);
+            if (RESTORE_PREFETCH && next) dma_crc_finish();
+            f_close(&fil);
+            return false;
+        }
     }
 
+    // A file left over from an earlier attempt may run past the end
+    if (f_truncate(&fil) != FR_OK) {
+        f_close(&fil);
+        return false;
+    }
     f_close(&fil);
+    log_throughput("Unlocked", metadata.filename, metadata.file_size, start_us); // Visible to FatFs from here
 
-    metadata.is_valid = false;
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(PRIVATE_STORAGE_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(PRIVATE_STORAGE_OFFSET, (uint8_t*)&metadata, sizeof(metadata_t));
-    restore_interrupts(ints);
-
+    if (!vault_meta_commit(capsule, VAULT_STATE_RELEASED)) return false;
+    release_chunks(chunk_ids, metadata.chunk_count);
+    vault_dedup_reset_if_unused();
+    rebalance_vault(0);
+    retry_rejected = true;
     return true;
 }
 
-bool fs_find_file_in_public(char* found_filename, size_t max_len) {
+bool fs_move_to_public(void) {
+    if (!vault_online) return false;
+
+    TRACE_BEGIN(TRACE_FS_UNLOCK, 0);
+    bool ok = move_to_public();
+    TRACE_END(TRACE_FS_UNLOCK, ok);
+    return ok;
+}
+
+bool fs_resume_transfers(void) {
+    if (!vault_online) return false;
+
+    TRACE_BEGIN(TRACE_FS_RESUME, 0);
+    bool resumed = false;
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        if (vault_meta_state(capsule) != VAULT_STATE_INGESTING) continue;
+
+        char filename[256];
+        char public_filepath[256];
+        FILINFO fno;
+        const metadata_t* header = capsule_header(capsule);
+        strncpy(filename, header->filename, sizeof(filename) - 1);
+        filename[sizeof(filename) - 1] = '\0';
+        snprintf(public_filepath, sizeof(public_filepath), "%s/%s", public_path, filename);
+
+        if (f_stat(public_filepath, &fno) == FR_OK && fno.fsize == header->file_size) {
+            resumed |= fs_move_to_private(filename);
+        } else {
+            printf("%s changed while it was being locked; dropping the partial capsule\n", filename);
+            abandon_ingest(capsule, vault_meta_progress(capsule));
+        }
+    }
+
+    int capsule = next_capsule();
+    if (capsule >= 0 && vault_meta_state(capsule) == VAULT_STATE_RESTORING) {
+        resumed |= fs_move_to_public();
+    }
+    TRACE_END(TRACE_FS_RESUME, resumed);
+    return resumed;
+}
+
+void fs_background_task(void) {
+    static bool compacting = false;
+
+    if (!vault_online) return;
+    if (vault_dedup_compact_step()) {
+        compacting = true;
+        return;
+    }
+    if (compacting) {
+        // Compaction gathers free space next to the disk; hand it over
+        compacting = false;
+        rebalance_vault(0);
+    } else if (rebalance_deferred && !host_writing()) {
+        rebalance_deferred = false;
+        rebalance_vault(0);
+    }
+
+    // Once what a release freed is reclaimed, files that did not fit get
+    // another try
+    if (retry_rejected) {
+        retry_rejected = false;
+        memset(rejected, 0, sizeof(rejected));
+    }
+}
+
+bool fs_find_file_in_public(int64_t now, char* found_filename, size_t max_len) {
     FRESULT fr;
     DIR dir;
     static FILINFO fno;
@@ -135,8 +839,10 @@ bool fs_find_file_in_public(char* found_filename, size_t max_len) {
             if (fr != FR_OK || fno.fname[0] == 0) break; // Break on error or end of dir
             if (fno.fattrib & AM_DIR) continue; // Skip directories
 
-            // For now, just find the first file that isn't a system file.
-            if (strcmp(fno.fname, "SYSTEM~1") != 0 && strcmp(fno.fname, "System Volume Information") != 0) {
+            // Find the first file named for a date still to come, passing
+            // over any that failed to lock as they are
+            int64_t unlock_time;
+            if (iso8601_parse(fno.fname, &unlock_time) && unlock_time > now && !is_rejected(&fno)) {
                 strncpy(found_filename, fno.fname, max_len - 1);
                 found_filename[max_len - 1] = '\0';
                 f_closedir(&dir);
@@ -158,10 +864,11 @@ bool fs_is_file_stable(const char* filename) {
     fr = f_stat(public_filepath, &fno1);
     if (fr != FR_OK) return false; // File not found or other error
 
+    TRACE_BEGIN(TRACE_FS_STABLE, 0);
     sleep_ms(500); // Wait a bit to see if the file size changes
 
     fr = f_stat(public_filepath, &fno2);
-    if (fr != FR_OK) return false;
-
-    return fno1.fsize == fno2.fsize;
+    bool stable = fr == FR_OK && fno1.fsize == fno2.fsize;
+    TRACE_END(TRACE_FS_STABLE, stable);
+    return stable;
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 #define FS_MANAGER_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 
 // Initialize the block device and file system.
 bool fs_init(void);
@@ -10,20 +12,50 @@ bool fs_init(void);
 // Mount both the public and private partitions.
 bool fs_mount_partitions(void);
 
-// Move a file from the public partition to the private one.
+// Move a file from the public partition to the private one. Returns false if
+// it was not locked; the file is then left where it was, and passed over by
+// fs_find_file_in_public() until it changes or a release makes room.
 bool fs_move_to_private(const char* filename);
 
+// Call handler with a capsule's unlock time just before it is committed as
+// locked, so copies of the next unlock kept elsewhere can be moved earlier
+// before the vault's own answer changes.
+void fs_set_lock_handler(void (*handler)(int64_t unlock_time));
+
 // Checks if a file is currently stored in the private area.
 bool fs_is_file_in_private(void);
 
-// Retrieves the unlock date from the private area.
-bool fs_get_unlock_date(struct tm* unlock_date);
+// Checks if the private area has room for another capsule.
+bool fs_has_free_slot(void);
+
+// Retrieves the earliest unlock time, in seconds since 1970, for comparing
+// against the clock without converting dates.
+bool fs_get_unlock_time(int64_t* unlock_time);
+
+// A number that changes whenever the vault does, for checking copies of
+// vault state kept elsewhere.
+uint32_t fs_vault_generation(void);
 
-// Move a file from the private partition back to the public one.
+// Move the file that unlocks first from the private partition back to the public one.
+// A capsule that can never be restored, with chunks missing, failing their CRC check
+// or failing authentication, is set aside in the vault with its failure reported, so
+// the capsules after it still unlock. Returns false if the file could not be written;
+// the capsule then stays first in line.
 bool fs_move_to_public(void);
 
-// Scan the public partition for a file to be processed.
-bool fs_find_file_in_public(char* found_filename, size_t max_len);
+// Finish any ingest or restore that a power cut interrupted, from its last
+// checkpoint. Call it once the partitions are mounted. Returns true if a
+// transfer was completed.
+bool fs_resume_transfers(void);
+
+// Do a small, bounded piece of vault upkeep such as compaction. Call it
+// between USB tasks in the main loop.
+void fs_background_task(void);
+
+// Scan the public partition for a file to be processed: one named for an
+// unlock time after now, in seconds since 1970. Files dated earlier are
+// capsules already unlocked, left for the owner to take.
+bool fs_find_file_in_public(int64_t now, char* found_filename, size_t max_len);
 
 // Checks if a file's size has been stable for a short period.
 bool fs_is_file_stable(const char* filename);
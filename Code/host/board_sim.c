@@ -0,0 +1,210 @@
+#include "board_sim.h"
+#include "sim_clock.h"
+#include "sim_shared.h"
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "hardware/irq.h"
+#include "bsp/board.h"
+#include "tusb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LATCH_GPIO 5
+#define GPIO_COUNT 30
+#define USB_FRAME_US 1000
+
+static bool usb_attached = false;
+static void (*usb_task)(void) = NULL;
+static void (*power_off)(void) = NULL;
+
+static enum gpio_function functions[GPIO_COUNT];
+static bool outputs[GPIO_COUNT];
+static bool levels[GPIO_COUNT];
+
+static uint64_t rand_state = 0;
+
+static board_sim_irq_stats_t* irq_stats;
+static uint32_t irq_depth = 0;
+static uint64_t irq_disabled_us;
+
+int board_sim_power_up(bool usb, int (*firmware)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        sim_clock_power_up();
+        usb_attached = usb;
+        firmware();
+        fflush(stdout);
+        _exit(1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+void board_sim_set_usb(bool attached) {
+    usb_attached = attached;
+}
+
+void board_sim_set_usb_task(void (*task)(void)) {
+    usb_task = task;
+}
+
+void board_sim_set_power_off(void (*handler)(void)) {
+    power_off = handler;
+}
+
+void board_sim_power_off(void) {
+    fflush(stdout);
+    _exit(0);
+}
+
+// The latch holds the power on until GPIO5 is pulsed; the pulse's falling
+// edge lets it go
+static void latch_released(void) {
+    if (usb_attached) return;
+    if (power_off != NULL) {
+        power_off();
+    } else {
+        board_sim_power_off();
+    }
+}
+
+void board_sim_reset_irq_stats(void) {
+    if (irq_stats == NULL) irq_stats = sim_shared_alloc(sizeof(board_sim_irq_stats_t));
+    *irq_stats = (board_sim_irq_stats_t){0};
+}
+
+board_sim_irq_stats_t board_sim_irq_stats(void) {
+    if (irq_stats == NULL) board_sim_reset_irq_stats();
+    return *irq_stats;
+}
+
+// Pico SDK and board calls
+void board_init(void) {}
+
+bool stdio_init_all(void) {
+    return true;
+}
+
+int getchar_timeout_us(uint32_t timeout_us) {
+    (void)timeout_us;
+    return PICO_ERROR_TIMEOUT;
+}
+
+void gpio_init(unsigned int gpio) {
+    if (gpio >= GPIO_COUNT) return;
+    functions[gpio] = GPIO_FUNC_SIO;
+    outputs[gpio] = false;
+    levels[gpio] = false;
+}
+
+void gpio_set_function(unsigned int gpio, enum gpio_function fn) {
+    if (gpio < GPIO_COUNT) functions[gpio] = fn;
+}
+
+void gpio_set_dir(unsigned int gpio, bool out) {
+    if (gpio < GPIO_COUNT) outputs[gpio] = out;
+}
+
+void gpio_put(unsigned int gpio, bool value) {
+    if (gpio >= GPIO_COUNT) return;
+    bool falling = levels[gpio] && !value;
+    levels[gpio] = value;
+    if (gpio == LATCH_GPIO && falling && functions[gpio] == GPIO_FUNC_SIO && outputs[gpio]) latch_released();
+}
+
+void gpio_pull_up(unsigned int gpio) {
+    (void)gpio;
+}
+
+bool gpio_get(unsigned int gpio) {
+    return gpio < GPIO_COUNT && levels[gpio];
+}
+
+void gpio_add_raw_irq_handler(unsigned int gpio, irq_handler_t handler) {
+    (void)gpio;
+    (void)handler;
+}
+
+void gpio_set_irq_enabled(unsigned int gpio, uint32_t events, bool enabled) {
+    (void)gpio;
+    (void)events;
+    (void)enabled;
+}
+
+uint32_t gpio_get_irq_event_mask(unsigned int gpio) {
+    (void)gpio;
+    return 0;
+}
+
+void gpio_acknowledge_irq(unsigned int gpio, uint32_t events) {
+    (void)gpio;
+    (void)events;
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    if (irq_depth++ == 0) irq_disabled_us = sim_clock_us();
+    return 0;
+}
+
+void restore_interrupts(uint32_t status) {
+    (void)status;
+    if (irq_depth == 0 || --irq_depth > 0) return;
+    if (irq_stats == NULL) board_sim_reset_irq_stats();
+    uint64_t window_us = sim_clock_us() - irq_disabled_us;
+    irq_stats->windows++;
+    irq_stats->total_us += window_us;
+    if (window_us > irq_stats->longest_us) irq_stats->longest_us = window_us;
+    if (window_us > BOARD_SIM_FRAME_US) irq_stats->over_frame++;
+    if (window_us > BOARD_SIM_CONTROL_TIMEOUT_US) irq_stats->over_control_timeout++;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    (void)num;
+    (void)enabled;
+}
+
+// Seeded from the clock at the first call, so each power-up draws its own
+// numbers and a run with the same inputs draws the same ones
+uint32_t get_rand_32(void) {
+    if (rand_state == 0) rand_state = sim_clock_us() * 0x9E3779B97F4A7C15ull | 1;
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return (uint32_t)(rand_state >> 32);
+}
+
+// TinyUSB device calls
+bool tusb_init(void) {
+    return true;
+}
+
+// One call per frame, with the host getting its turn in between
+void tud_task(void) {
+    sim_clock_advance(USB_FRAME_US);
+    if (usb_task != NULL) usb_task();
+}
+
+bool tud_mounted(void) {
+    return usb_attached;
+}
+
+bool tud_suspended(void) {
+    return false;
+}
+
+bool tud_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, uint8_t add_sense_qualifier) {
+    (void)lun;
+    (void)sense_key;
+    (void)add_sense_code;
+    (void)add_sense_qualifier;
+    return true;
+}
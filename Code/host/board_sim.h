@@ -0,0 +1,53 @@
+#ifndef BOARD_SIM_H
+#define BOARD_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The board around the RP2040 for host builds: whether USB is plugged in,
+// the host on the other end of it, and the power latch on GPIO5. Without
+// USB, releasing the latch cuts the board's power, which ends the process
+// the firmware runs in.
+
+// Power the board up, on USB or on battery, and run firmware in a process
+// of its own until the power goes. Returns the process's wait status:
+// an exit status of 0 when the board powered itself off or the USB task
+// unplugged it.
+int board_sim_power_up(bool usb, int (*firmware)(void));
+
+// Whether the board is plugged into a host, which also powers it
+void board_sim_set_usb(bool attached);
+
+// Cut the board's power from within it, as unplugging USB does to a board
+// with its latch released. Does not return.
+void board_sim_power_off(void);
+
+// Called from each tud_task(), to play the host's part while USB is attached
+// or to watch the board while it is not
+void board_sim_set_usb_task(void (*task)(void));
+
+// Called instead of cutting the power when the latch is released on battery.
+// By default the process exits with status 0.
+void board_sim_set_power_off(void (*power_off)(void));
+
+// Interrupts held off for longer than a USB frame delay the device's
+// endpoint handling; past the 50 ms the USB specification gives a control
+// request without a data stage, the host may give up on the device.
+#define BOARD_SIM_FRAME_US 1000
+#define BOARD_SIM_CONTROL_TIMEOUT_US 50000
+
+typedef struct {
+    uint32_t windows;            // Times interrupts were disabled
+    uint32_t over_frame;
+    uint32_t over_control_timeout;
+    uint64_t longest_us;
+    uint64_t total_us;
+} board_sim_irq_stats_t;
+
+// Clear the statistics on interrupts held off. They are shared with
+// children forked after the first call, so make it before the first fork.
+void board_sim_reset_irq_stats(void);
+
+board_sim_irq_stats_t board_sim_irq_stats(void);
+
+#endif // BOARD_SIM_H
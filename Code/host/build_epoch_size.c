@@ -0,0 +1,59 @@
+// An otherwise empty program that makes setup_rtc()'s fallback time, built
+// once from TIMECAPSULE_BUILD_EPOCH and once by parsing __DATE__ and
+// __TIME__ as it used to, so the difference in their sizes is what the
+// boot path costs. gmtime_r() and rv3028_tm_to_epoch() are linked in both,
+// as the wake scheduler already pulls them into the firmware. glibc's
+// gmtime_r() reaches sscanf() through its time zone code, so on the host
+// both carry the scanf family and only the parsing itself shows; newlib's
+// gmtime_r() does not, and nothing else in the firmware calls sscanf().
+
+#include <stdint.h>
+#include <time.h>
+#if BUILD_EPOCH_SIZE_DATE
+#include <stdio.h>
+#include <string.h>
+#endif
+#include "rv3028.h"
+
+#ifndef TIMECAPSULE_BUILD_EPOCH
+#define TIMECAPSULE_BUILD_EPOCH 1767225600LL
+#endif
+
+static volatile int64_t sink;
+
+// Stands in for rv3028_set_current_time()
+static void __attribute__((noinline)) set_clock(const struct tm* time) {
+    sink = rv3028_tm_to_epoch(time);
+}
+
+int main(int argc, char** argv) {
+    (void)argv;
+
+    // The rest of the firmware's use of the two calendar functions
+    time_t now_time = (time_t)argc * 86400;
+    struct tm current_time;
+    gmtime_r(&now_time, &current_time);
+    sink = rv3028_tm_to_epoch(&current_time);
+
+#if BUILD_EPOCH_SIZE_DATE
+    if (current_time.tm_year < 123) {
+        char s_month[5];
+        int month, day, year, hour, min, sec;
+        static const char month_names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        sscanf(__DATE__, "%s %d %d", s_month, &day, &year);
+        sscanf(__TIME__, "%d:%d:%d", &hour, &min, &sec);
+        month = (strstr(month_names, s_month) - month_names) / 3;
+
+        struct tm compile_time = { .tm_sec = sec, .tm_min = min, .tm_hour = hour, .tm_mday = day, .tm_mon = month, .tm_year = year - 1900 };
+        set_clock(&compile_time);
+    }
+#else
+    if (rv3028_tm_to_epoch(&current_time) < TIMECAPSULE_BUILD_EPOCH) {
+        time_t build_time = TIMECAPSULE_BUILD_EPOCH;
+        struct tm compile_time;
+        gmtime_r(&build_time, &compile_time);
+        set_clock(&compile_time);
+    }
+#endif
+    return 0;
+}
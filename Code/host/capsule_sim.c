@@ -0,0 +1,313 @@
+// Runs the whole firmware against the simulated board through a multi-year
+// schedule of capsules. Each power-up is a process of its own, forked from
+// this one, so the firmware starts from fresh RAM while the flash, the RTC
+// and the clock carry on in shared memory. Between power-ups, time jumps
+// straight to the next RTC interrupt.
+//
+// The board starts plugged in to a PC, which formats the disk and copies
+// capsules onto it until the vault is full. On battery it then wakes
+// whenever the RTC says to. Once a wake finds a capsule due, the PC is
+// plugged back in after the collection delay: it checks and deletes every
+// capsule restored to the disk and tops the vault up from the capsules not
+// yet loaded.
+//
+// Usage: capsule_sim [-n capsules] [-y years] [-k size_kb] [-c collect_hours]
+//                    [-d drift_ppm] [-f flash_image] [-t typical|max] [-s seed] [-v]
+//
+// Flash operations take the datasheet's typical times unless -t max is
+// given; the report gives the flash's busy time at both.
+
+#include "board_sim.h"
+#include "flash_sim.h"
+#include "host_disk.h"
+#include "host_pc.h"
+#include "host_stdio.h"
+#include "rv3028_model.h"
+#include "sim_clock.h"
+#include "sim_shared.h"
+#include "tusb.h"
+#include "flash_disk.h"
+#include "vault_meta.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define START_TIME 1798761600            // 2027-01-01, when the board is first plugged in
+#define SECONDS_PER_YEAR 31556952        // Average Gregorian year
+#define AWAKE_LIMIT_US (10 * 1000000ull) // A board on battery still up after this will not turn off
+#define SESSION_LIMIT_US (3600 * 1000000ull)
+#define MIN_LEAD_SECONDS 3600            // Capsules this close to unlocking are not worth loading
+#define CONTENT_SEED 0x2545F491
+
+int firmware_main(void);
+
+// Kept in shared memory, so the power-ups can report back
+typedef struct {
+    int capsule_count;
+    capsule_t* capsules;
+
+    bool formatted;
+    uint64_t session_start_us;
+    uint64_t boot_start_us;
+    bool stayed_awake;
+    bool session_stuck;
+} sim_state_t;
+
+static sim_state_t* sim;
+static uint32_t capsule_kb = 64;
+
+// The PC's side of a USB session, run from tud_task()
+
+static void usb_host_task(void) {
+    if (!tud_mounted()) {
+        if (sim_clock_us() - sim->boot_start_us > AWAKE_LIMIT_US) {
+            sim->stayed_awake = true;
+            board_sim_power_off();
+        }
+        return;
+    }
+
+    if (!sim->formatted) {
+        if (flash_disk_volume_blocks() == 0 && !host_disk_format()) {
+            printf("  Could not format the disk\n");
+            fflush(stdout);
+            _exit(1);
+        }
+        sim->formatted = true;
+    }
+
+    int64_t now = rv3028_model_calendar_time();
+    host_pc_scan_t scan = host_pc_scan(sim->capsules, sim->capsule_count, now);
+
+    // Top the vault up, one capsule at a time as the firmware takes them
+    if (scan.copied == 0 && scan.locked < VAULT_MAX_CAPSULES) {
+        for (int i = 0; i < sim->capsule_count; i++) {
+            capsule_t* capsule = &sim->capsules[i];
+            if (capsule->state != CAPSULE_QUEUED) continue;
+            if (capsule->unlock < now + MIN_LEAD_SECONDS) {
+                capsule->state = CAPSULE_SKIPPED;
+                continue;
+            }
+            if (host_pc_write_file(capsule->name, capsule->seed, capsule->size)) {
+                capsule->state = CAPSULE_COPIED;
+                scan.copied++;
+            } else {
+                printf("  Could not copy %s to the disk\n", capsule->name);
+                capsule->state = CAPSULE_SKIPPED;
+            }
+            break;
+        }
+    }
+
+    // Unplug once the firmware has nothing left to do for the PC
+    if (scan.copied == 0 && !scan.due) board_sim_power_off();
+    if (sim_clock_us() - sim->session_start_us > SESSION_LIMIT_US) {
+        sim->session_stuck = true;
+        board_sim_power_off();
+    }
+}
+
+// Power the board up, on USB or battery, and wait for it to turn off
+static void power_up(bool usb) {
+    sim->boot_start_us = sim_clock_us();
+    if (usb) sim->session_start_us = sim->boot_start_us;
+    int status = board_sim_power_up(usb, firmware_main);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Board crashed at %" PRId64 " (status 0x%x)\n", rv3028_model_calendar_time(), status);
+        exit(1);
+    }
+}
+
+// Schedule
+
+static int compare_unlocks(const void* a, const void* b) {
+    int64_t x = ((const capsule_t*)a)->unlock, y = ((const capsule_t*)b)->unlock;
+    return (x > y) - (x < y);
+}
+
+static void plan_capsules(int count, int years) {
+    sim->capsule_count = count;
+    sim->capsules = sim_shared_alloc(sizeof(capsule_t) * count);
+    for (int i = 0; i < count; i++) {
+        sim->capsules[i].unlock = START_TIME + 86400 + (int64_t)((double)rand() / RAND_MAX * ((double)years * SECONDS_PER_YEAR));
+        sim->capsules[i].size = capsule_kb * 1024 - (uint32_t)(rand() % 1024);
+    }
+    qsort(sim->capsules, count, sizeof(capsule_t), compare_unlocks);
+    for (int i = 0; i < count; i++) {
+        sim->capsules[i].seed = CONTENT_SEED + (uint32_t)i * 0x9E3779B9;
+        host_pc_name_capsule(&sim->capsules[i], i + 1);
+    }
+}
+
+static bool capsules_left(void) {
+    for (int i = 0; i < sim->capsule_count; i++) {
+        capsule_state_t state = sim->capsules[i].state;
+        if (state != CAPSULE_COLLECTED && state != CAPSULE_SKIPPED) return true;
+    }
+    return false;
+}
+
+// The first locked capsule due by the RTC and not yet counted, or NULL
+static capsule_t* newly_due(void) {
+    int64_t now = rv3028_model_calendar_time();
+    for (int i = 0; i < sim->capsule_count; i++) {
+        capsule_t* capsule = &sim->capsules[i];
+        if (capsule->state == CAPSULE_LOCKED && !capsule->due_seen && capsule->unlock <= now) return capsule;
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int capsules = 20;
+    int years = 7;
+    double collect_hours = 24;
+    double drift_ppm = 0;
+    const char* image_path = NULL;
+    unsigned seed = 1;
+    int option;
+    flash_sim_corner_t corner = FLASH_SIM_TYPICAL;
+    while ((option = getopt(argc, argv, "n:y:k:c:d:f:t:s:v")) != -1) {
+        switch (option) {
+            case 'n': capsules = atoi(optarg); break;
+            case 'y': years = atoi(optarg); break;
+            case 'k': capsule_kb = (uint32_t)atoi(optarg); break;
+            case 'c': collect_hours = atof(optarg); break;
+            case 'd': drift_ppm = atof(optarg); break;
+            case 'f': image_path = optarg; break;
+            case 't': corner = strcmp(optarg, "max") == 0 ? FLASH_SIM_MAX : FLASH_SIM_TYPICAL; break;
+            case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'v': host_stdio_set_verbose(true); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n capsules] [-y years] [-k size_kb] [-c collect_hours] [-d drift_ppm] [-f flash_image] [-t typical|max] [-s seed] [-v]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (capsules < 1 || years < 1 || years > 70 || capsule_kb < 1 || capsule_kb > 1024 || collect_hours < 0) {
+        fprintf(stderr, "Need at least one capsule of 1 to 1024 KB, 1 to 70 years and a collection delay\n");
+        return 2;
+    }
+    srand(seed);
+
+    sim_clock_us();
+    sim = sim_shared_alloc(sizeof(sim_state_t));
+    plan_capsules(capsules, years);
+    flash_sim_init(image_path);
+    flash_sim_erase_chip();
+    flash_sim_set_corner(corner);
+    board_sim_reset_irq_stats();
+    board_sim_set_usb_task(usb_host_task);
+    rv3028_model_init();
+    rv3028_model_set_time(START_TIME);
+    rv3028_model_set_drift_ppm(drift_ppm);
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    // Loading the vault
+    power_up(true);
+    flash_sim_stats_t loaded = flash_sim_stats();
+
+    int wakes = 0, sessions = 1, due_wakes = 0, stuck_sessions = 0, awake_wakes = 0;
+    uint64_t awake_us = 0, longest_wake_us = 0, usb_us = 0;
+    int64_t total_lateness = 0, worst_lateness = 0;
+    uint32_t battery_erases = 0, usb_erases = loaded.erases;
+    bool stopped = false;
+    while (capsules_left() && !stopped) {
+        uint64_t wake_us = rv3028_model_next_interrupt_us();
+        if (wake_us == UINT64_MAX) {
+            printf("No wake armed at %" PRId64 " with capsules still locked\n", rv3028_model_calendar_time());
+            break;
+        }
+        sim_clock_advance_to(wake_us);
+
+        uint32_t erases_before = flash_sim_stats().erases;
+        uint64_t wake_start_us = sim_clock_us();
+        power_up(false);
+        uint64_t wake_length_us = sim_clock_us() - wake_start_us;
+        wakes++;
+        awake_us += wake_length_us;
+        if (wake_length_us > longest_wake_us) longest_wake_us = wake_length_us;
+        battery_erases += flash_sim_stats().erases - erases_before;
+        if (sim->stayed_awake) {
+            if (awake_wakes++ < 5) printf("  Board stayed awake on battery at %" PRId64 "\n", rv3028_model_calendar_time());
+            sim->stayed_awake = false;
+        }
+
+        capsule_t* due = newly_due();
+        if (due == NULL) continue;
+        for (capsule_t* capsule = due; capsule != NULL; capsule = newly_due()) {
+            int64_t lateness = rv3028_model_calendar_time() - capsule->unlock;
+            total_lateness += lateness;
+            if (lateness > worst_lateness) worst_lateness = lateness;
+            capsule->due_seen = true;
+            due_wakes++;
+        }
+
+        // The owner plugs the board in some time later to collect it
+        sim_clock_advance((uint64_t)(collect_hours * 3600e6));
+        erases_before = flash_sim_stats().erases;
+        uint64_t session_start_us = sim_clock_us();
+        power_up(true);
+        usb_us += sim_clock_us() - session_start_us;
+        usb_erases += flash_sim_stats().erases - erases_before;
+        sessions++;
+        if (sim->session_stuck) {
+            printf("  USB session at %" PRId64 " did not settle within an hour\n", rv3028_model_calendar_time());
+            sim->session_stuck = false;
+            if (++stuck_sessions >= 3) stopped = true;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_ms = (double)(wall_end.tv_sec - wall_start.tv_sec) * 1e3 + (double)(wall_end.tv_nsec - wall_start.tv_nsec) / 1e6;
+
+    int never_loaded = 0, still_locked = 0, verified = 0, corrupt = 0;
+    for (int i = 0; i < sim->capsule_count; i++) {
+        const capsule_t* capsule = &sim->capsules[i];
+        if (capsule->state == CAPSULE_COLLECTED) {
+            if (capsule->intact) {
+                verified++;
+            } else if (corrupt++ < 5) {
+                printf("  %s came back wrong\n", capsule->name);
+            }
+        }
+        if (capsule->state == CAPSULE_LOCKED || capsule->state == CAPSULE_COPIED) still_locked++;
+        if (capsule->state == CAPSULE_SKIPPED) never_loaded++;
+    }
+
+    uint32_t busiest_sector = 0;
+    for (uint32_t sector = 0; sector < FLASH_SIM_SECTORS; sector++) {
+        if (flash_sim_sector_erases(sector) > flash_sim_sector_erases(busiest_sector)) busiest_sector = sector;
+    }
+    flash_sim_stats_t flash = flash_sim_stats();
+
+    printf("Capsules: %d of about %" PRIu32 " KB over %d years, collected %.0f h after unlock, drift %+.1f ppm\n",
+           capsules, capsule_kb, years, collect_hours, drift_ppm);
+    printf("  Battery wakes %d (%.1f per capsule), awake %.3f s in all, %.1f ms mean, %.1f ms longest\n", wakes,
+           (double)wakes / capsules, (double)awake_us / 1e6, wakes ? (double)awake_us / wakes / 1e3 : 0.0,
+           (double)longest_wake_us / 1e3);
+    printf("  Stayed awake on battery %d times\n", awake_wakes);
+    printf("  Unlocks found due %d, by the RTC %.1f s late on average, %" PRId64 " s at worst\n", due_wakes,
+           due_wakes ? (double)total_lateness / due_wakes : 0.0, worst_lateness);
+    printf("  USB sessions %d, %.1f s in all\n", sessions, (double)usb_us / 1e6);
+    printf("  Flash: %" PRIu32 " sector erases (%" PRIu32 " on battery, %" PRIu32 " on USB), %.1f MB programmed\n",
+           flash.erases, battery_erases, usb_erases, (double)flash.bytes_programmed / (1024 * 1024));
+    printf("  Flash busy %.1f s at typical timing, %.1f s at worst; %.1f MB read through XIP\n",
+           flash.busy_typical_us / 1e6, flash.busy_max_us / 1e6, flash.xip_bytes_read / (1024.0 * 1024));
+    board_sim_irq_stats_t irqs = board_sim_irq_stats();
+    printf("  Interrupts off %" PRIu32 " times, longest %.1f ms, %" PRIu32 " over a USB frame, %" PRIu32 " over %d ms\n",
+           irqs.windows, irqs.longest_us / 1e3, irqs.over_frame, irqs.over_control_timeout,
+           BOARD_SIM_CONTROL_TIMEOUT_US / 1000);
+    printf("  Programmed over unerased bits %" PRIu32 " times\n", flash.violations);
+    printf("  Busiest sector 0x%06" PRIx32 ", erased %" PRIu32 " times\n", busiest_sector * 4096,
+           flash_sim_sector_erases(busiest_sector));
+    printf("  RTC EEPROM bytes written %" PRIu32 "\n", rv3028_model_eeprom_writes());
+    printf("  Capsules verified %d, corrupt %d, still locked %d, never loaded %d\n", verified, corrupt,
+           still_locked, never_loaded);
+    printf("  Simulated %.1f days in %.0f ms\n", (double)(rv3028_model_calendar_time() - START_TIME) / 86400, wall_ms);
+    bool clean = corrupt == 0 && still_locked == 0 && awake_wakes == 0 && stuck_sessions == 0 && flash.violations == 0;
+    return clean ? 0 : 1;
+}
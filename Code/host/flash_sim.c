@@ -0,0 +1,211 @@
+#define _GNU_SOURCE // memfd_create
+#include "flash_sim.h"
+#include "sim_clock.h"
+#include "sim_shared.h"
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VIOLATIONS_REPORTED 5
+
+// tPP, tSE, tBE1 and tBE2
+static const flash_sim_timing_t timings[] = {
+    [FLASH_SIM_TYPICAL] = {400, 45000, 120000, 150000},
+    [FLASH_SIM_MAX] = {3000, 400000, 1600000, 2000000},
+};
+
+typedef struct {
+    uint32_t sector_erases[FLASH_SIM_SECTORS];
+    flash_sim_stats_t stats;
+    flash_sim_corner_t corner;
+
+    uint32_t operations;
+    bool cut_armed;
+    bool cut_inside;
+    uint32_t cut_operation;
+    uint32_t cut_seed;
+} flash_state_t;
+
+static uint8_t* image;
+static flash_state_t* flash;
+const uint8_t* flash_sim_xip;
+
+static void fail(const char* what) {
+    perror(what);
+    exit(1);
+}
+
+void flash_sim_init(const char* image_path) {
+    int fd = image_path ? open(image_path, O_RDWR | O_CREAT, 0644) : memfd_create("flash", 0);
+    if (fd < 0) fail(image_path ? image_path : "memfd_create");
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) fail("fstat");
+    bool fresh = info.st_size < FLASH_SIM_SIZE;
+    if (fresh && ftruncate(fd, FLASH_SIM_SIZE) != 0) fail("ftruncate");
+
+    image = mmap(NULL, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) fail("mmap");
+    void* xip = mmap(NULL, FLASH_SIM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (xip == MAP_FAILED) fail("mmap");
+    flash_sim_xip = xip;
+    close(fd);
+
+    flash = sim_shared_alloc(sizeof(flash_state_t));
+    if (fresh) memset(image, 0xFF, FLASH_SIM_SIZE);
+}
+
+void flash_sim_erase_chip(void) {
+    memset(image, 0xFF, FLASH_SIM_SIZE);
+    memset(flash->sector_erases, 0, sizeof(flash->sector_erases));
+    flash->stats = (flash_sim_stats_t){0};
+}
+
+void flash_sim_set_corner(flash_sim_corner_t corner) {
+    flash->corner = corner;
+}
+
+const flash_sim_timing_t* flash_sim_timing(flash_sim_corner_t corner) {
+    return &timings[corner];
+}
+
+uint64_t flash_sim_xip_background_read(const void* address, size_t len) {
+    const uint8_t* bytes = address;
+    if (bytes < flash_sim_xip || bytes >= flash_sim_xip + FLASH_SIM_SIZE) return 0;
+    uint64_t us = (len + FLASH_SIM_XIP_BYTES_PER_US - 1) / FLASH_SIM_XIP_BYTES_PER_US;
+    flash->stats.xip_bytes_read += len;
+    flash->stats.xip_read_us += us;
+    return us;
+}
+
+void flash_sim_xip_read(const void* address, size_t len) {
+    sim_clock_advance(flash_sim_xip_background_read(address, len));
+}
+
+void flash_sim_arm_power_cut(uint32_t operation, bool inside, uint32_t seed) {
+    flash->operations = 0;
+    flash->cut_armed = true;
+    flash->cut_inside = inside;
+    flash->cut_operation = operation;
+    flash->cut_seed = seed | 1;
+}
+
+void flash_sim_disarm_power_cut(void) {
+    flash->cut_armed = false;
+}
+
+uint32_t flash_sim_operations(void) {
+    return flash->operations;
+}
+
+void flash_sim_save(uint8_t* copy) {
+    memcpy(copy, image, FLASH_SIM_SIZE);
+}
+
+void flash_sim_restore(const uint8_t* copy) {
+    memcpy(image, copy, FLASH_SIM_SIZE);
+}
+
+static uint32_t cut_random(void) {
+    uint32_t* state = &flash->cut_seed;
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Count an operation on length bytes at offset, cutting the power before it
+// or partway through if this is the one. For a program, data is what was
+// to be programmed; for an erase it is NULL.
+static void begin_operation(uint32_t offset, const uint8_t* data, uint32_t length) {
+    uint32_t operation = flash->operations++;
+    if (!flash->cut_armed || operation != flash->cut_operation) return;
+
+    if (flash->cut_inside) {
+        uint8_t* bytes = image + offset;
+        if (data == NULL) {
+            // Cells come up unevenly; some bits of each byte have erased
+            for (uint32_t i = 0; i < length; i++) bytes[i] |= (uint8_t)(cut_random() & cut_random());
+        } else {
+            uint32_t done = cut_random() % length;
+            for (uint32_t i = 0; i < done; i++) bytes[i] &= data[i];
+            bytes[done] &= data[done] | (uint8_t)cut_random();
+        }
+    }
+    fflush(stdout);
+    _exit(FLASH_SIM_POWER_CUT_STATUS);
+}
+
+// Charge one operation, given its time at each corner
+static void charge(uint32_t typical_us, uint32_t max_us) {
+    flash->stats.busy_typical_us += typical_us;
+    flash->stats.busy_max_us += max_us;
+    sim_clock_advance(flash->corner == FLASH_SIM_MAX ? max_us : typical_us);
+}
+
+flash_sim_stats_t flash_sim_stats(void) {
+    return flash->stats;
+}
+
+uint32_t flash_sim_sector_erases(uint32_t sector) {
+    return sector < FLASH_SIM_SECTORS ? flash->sector_erases[sector] : 0;
+}
+
+// The SDK asserts on these; a firmware bug should stop the run just as loudly
+static void check_range(const char* operation, uint32_t offset, size_t count, uint32_t alignment) {
+    if (offset % alignment != 0 || count % alignment != 0 || offset > FLASH_SIM_SIZE || count > FLASH_SIM_SIZE - offset) {
+        fprintf(stderr, "%s: bad range 0x%lx + 0x%lx\n", operation, (unsigned long)offset, (unsigned long)count);
+        abort();
+    }
+}
+
+// Pico SDK flash API
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    check_range("flash_range_erase", flash_offs, count, FLASH_SECTOR_SIZE);
+    for (uint32_t sector = flash_offs / FLASH_SECTOR_SIZE; sector < (flash_offs + count) / FLASH_SECTOR_SIZE; sector++) {
+        flash->sector_erases[sector]++;
+        flash->stats.erases++;
+    }
+
+    // A 64 KB block erase wherever one fits, as the boot ROM does
+    while (count > 0) {
+        if (flash_offs % FLASH_BLOCK_SIZE == 0 && count >= FLASH_BLOCK_SIZE) {
+            begin_operation(flash_offs, NULL, FLASH_BLOCK_SIZE);
+            memset(image + flash_offs, 0xFF, FLASH_BLOCK_SIZE);
+            charge(timings[FLASH_SIM_TYPICAL].block64_erase_us, timings[FLASH_SIM_MAX].block64_erase_us);
+            flash->stats.block_erases++;
+            flash_offs += FLASH_BLOCK_SIZE;
+            count -= FLASH_BLOCK_SIZE;
+        } else {
+            begin_operation(flash_offs, NULL, FLASH_SECTOR_SIZE);
+            memset(image + flash_offs, 0xFF, FLASH_SECTOR_SIZE);
+            charge(timings[FLASH_SIM_TYPICAL].sector_erase_us, timings[FLASH_SIM_MAX].sector_erase_us);
+            flash_offs += FLASH_SECTOR_SIZE;
+            count -= FLASH_SECTOR_SIZE;
+        }
+    }
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    check_range("flash_range_program", flash_offs, count, FLASH_PAGE_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        if (i % FLASH_PAGE_SIZE == 0) begin_operation(flash_offs + i, data + i, FLASH_PAGE_SIZE);
+        uint8_t* byte = image + flash_offs + i;
+        if (data[i] != 0xFF && (data[i] & ~*byte) != 0 && flash->stats.violations++ < VIOLATIONS_REPORTED) {
+            fprintf(stderr, "flash_range_program: 0x%02x over 0x%02x at 0x%06lx without an erase\n", data[i], *byte,
+                    (unsigned long)(flash_offs + i));
+        }
+        *byte &= data[i];
+    }
+    flash->stats.programs++;
+    flash->stats.bytes_programmed += count;
+    for (size_t page = 0; page < count / FLASH_PAGE_SIZE; page++) {
+        charge(timings[FLASH_SIM_TYPICAL].page_program_us, timings[FLASH_SIM_MAX].page_program_us);
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef FLASH_SIM_H
+#define FLASH_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// The board's 16 MB QSPI flash for host builds, behind the SDK's
+// flash_range_erase() and flash_range_program(). The flash is a 16 MB image
+// mapped twice: writable for the flash API, and read-only at XIP_BASE, so a
+// stray store through XIP faults as it would on the board. The image can be
+// a file, to look at after a run or to start one from.
+//
+// It behaves as NOR flash: erasing sets a sector to 0xFF and programming can
+// only clear bits. Ranges must be sector aligned to erase and page aligned
+// to program, as the SDK requires, or the run stops. Programming a byte
+// that needs a bit set again without an erase in between is counted as a
+// violation; the byte keeps the cleared bit, as on the part. Bytes given as
+// 0xFF are left alone and never count.
+//
+// Each operation takes the W25Q128JV's datasheet time on the simulation
+// clock, typical or maximum, and the device time at both is added up. Like
+// the boot ROM, flash_range_erase() uses a 64 KB block erase wherever the
+// range allows and 4 KB sector erases elsewhere; it never issues the 32 KB
+// block erase. XIP reads cannot be seen as they happen, so the code that
+// makes them in bulk charges them with flash_sim_xip_read(): the disk layer
+// for every read and for the read-back of each sector it rewrites, through
+// XIP_READ(), and the DMA stand-in for its copies, which run in the
+// background until they are waited for.
+#define FLASH_SIM_SIZE (16 * 1024 * 1024)
+#define FLASH_SIM_SECTORS (FLASH_SIM_SIZE / 4096)
+
+typedef enum {
+    FLASH_SIM_TYPICAL,
+    FLASH_SIM_MAX
+} flash_sim_corner_t;
+
+// Times in microseconds, from the W25Q128JV datasheet
+typedef struct {
+    uint32_t page_program_us;
+    uint32_t sector_erase_us;    // 4 KB
+    uint32_t block32_erase_us;
+    uint32_t block64_erase_us;
+} flash_sim_timing_t;
+
+typedef struct {
+    uint32_t erases;             // Sectors erased, whether singly or in blocks
+    uint32_t block_erases;       // 64 KB block erases among them
+    uint32_t programs;           // Calls to flash_range_program()
+    uint64_t bytes_programmed;
+    uint32_t violations;         // Bytes programmed over bits that needed erasing
+    uint64_t busy_typical_us;    // Device time for the erases and programs, at typical timing
+    uint64_t busy_max_us;        // The same at maximum timing
+    uint64_t xip_bytes_read;
+    uint64_t xip_read_us;
+} flash_sim_stats_t;
+
+// XIP reads with a cache miss on every line, as in a long copy: quad I/O at
+// the default 62.5 MHz flash clock, about 18 MB/s
+#define FLASH_SIM_XIP_BYTES_PER_US 18
+
+// The read-only view, which XIP_BASE points at
+extern const uint8_t* flash_sim_xip;
+
+// Map the flash, from the image file at image_path or from memory if it is
+// NULL. A new image starts erased; an existing one is used as it is. The
+// flash is shared with children forked after this, so call it before the
+// first power-up.
+void flash_sim_init(const char* image_path);
+
+// Erase the whole chip, and clear the statistics
+void flash_sim_erase_chip(void);
+
+// Which datasheet times the simulation clock is charged; typical by default
+void flash_sim_set_corner(flash_sim_corner_t corner);
+
+const flash_sim_timing_t* flash_sim_timing(flash_sim_corner_t corner);
+
+// Charge a read of len bytes at address, if it is in the XIP view
+void flash_sim_xip_read(const void* address, size_t len);
+
+// Count the same read made in the background, as by DMA, and return how
+// long it takes without moving the clock
+uint64_t flash_sim_xip_background_read(const void* address, size_t len);
+
+flash_sim_stats_t flash_sim_stats(void);
+
+// Power cuts. Operations are counted from when a cut is armed, each sector
+// or block erase and each page programmed being one. A cut before an
+// operation leaves the flash as it was; a cut inside one leaves it partly
+// done: an erase with only some bits of the sector set again, or a page
+// programmed partway with one byte holding only some of its cleared bits.
+// Either way the process then exits with FLASH_SIM_POWER_CUT_STATUS. The
+// state is shared, so a cut armed before a fork happens in the child.
+#define FLASH_SIM_POWER_CUT_STATUS 75
+
+void flash_sim_arm_power_cut(uint32_t operation, bool inside, uint32_t seed);
+void flash_sim_disarm_power_cut(void);
+
+// Operations since the last cut was armed, or since init if none has been
+uint32_t flash_sim_operations(void);
+
+// Copy the whole image out, or back in; the statistics are left alone
+void flash_sim_save(uint8_t* copy);
+void flash_sim_restore(const uint8_t* copy);
+
+// Times the given sector has been erased since init
+uint32_t flash_sim_sector_erases(uint32_t sector);
+
+#endif // FLASH_SIM_H
@@ -0,0 +1,70 @@
+#include "host_disk.h"
+#include "flash_disk.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTOR_SIZE FLASH_DISK_BLOCK_SIZE
+#define SECTORS_PER_CLUSTER 4
+#define RESERVED_SECTORS 1
+#define FAT_COUNT 2
+#define ROOT_ENTRIES 512
+#define ROOT_SECTORS (ROOT_ENTRIES * 32 / SECTOR_SIZE)
+
+static void put16(uint8_t* at, uint32_t value) {
+    at[0] = (uint8_t)value;
+    at[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t* at, uint32_t value) {
+    put16(at, value);
+    put16(at + 2, value >> 16);
+}
+
+bool host_disk_format(void) {
+    uint32_t total = flash_disk_block_count();
+
+    // FAT size by the method in Microsoft's FAT specification
+    uint32_t fat_sectors = (total - RESERVED_SECTORS - ROOT_SECTORS + 256 * SECTORS_PER_CLUSTER + FAT_COUNT - 1) /
+                           (256 * SECTORS_PER_CLUSTER + FAT_COUNT);
+    uint32_t clusters = (total - RESERVED_SECTORS - FAT_COUNT * fat_sectors - ROOT_SECTORS) / SECTORS_PER_CLUSTER;
+    if (clusters < 4085 || clusters >= 65525) return false;
+
+    // The boot sector, both FATs and the root directory, written at once
+    uint32_t system_sectors = RESERVED_SECTORS + FAT_COUNT * fat_sectors + ROOT_SECTORS;
+    uint8_t* system = calloc(system_sectors, SECTOR_SIZE);
+    if (system == NULL) return false;
+
+    uint8_t* boot = system;
+    memcpy(boot, "\xEB\x3C\x90MSDOS5.0", 11);
+    put16(boot + 11, SECTOR_SIZE);
+    boot[13] = SECTORS_PER_CLUSTER;
+    put16(boot + 14, RESERVED_SECTORS);
+    boot[16] = FAT_COUNT;
+    put16(boot + 17, ROOT_ENTRIES);
+    if (total < 0x10000) {
+        put16(boot + 19, total);
+    } else {
+        put32(boot + 32, total);
+    }
+    boot[21] = 0xF8; // Fixed disk
+    put16(boot + 22, fat_sectors);
+    put16(boot + 24, 63);
+    put16(boot + 26, 255);
+    boot[36] = 0x80;
+    boot[38] = 0x29;
+    put32(boot + 39, 0x20270101);
+    memcpy(boot + 43, "TIMECAPSULEFAT16   ", 19);
+    boot[510] = 0x55;
+    boot[511] = 0xAA;
+
+    for (uint32_t fat = 0; fat < FAT_COUNT; fat++) {
+        uint8_t* entries = system + (RESERVED_SECTORS + fat * fat_sectors) * SECTOR_SIZE;
+        put16(entries, 0xFFF8);
+        put16(entries + 2, 0xFFFF);
+    }
+
+    bool ok = flash_disk_write(0, 0, system, system_sectors * SECTOR_SIZE);
+    free(system);
+    return ok;
+}
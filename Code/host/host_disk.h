@@ -0,0 +1,11 @@
+#ifndef HOST_DISK_H
+#define HOST_DISK_H
+
+#include <stdbool.h>
+
+// Format the public disk as FAT16 through flash_disk_write(), the way a PC
+// formats it over USB: no partition table, 2 KB clusters and a 512 entry
+// root directory. The firmware cannot format it itself.
+bool host_disk_format(void);
+
+#endif // HOST_DISK_H
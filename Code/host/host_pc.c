@@ -0,0 +1,99 @@
+#include "host_pc.h"
+#include "fatfs/ff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void file_path(const char* name, char* path, size_t size) {
+    snprintf(path, size, "0:/%s", name);
+}
+
+static void fill(uint32_t seed, uint8_t* buffer, uint32_t size) {
+    uint32_t state = seed | 1;
+    for (uint32_t i = 0; i < size; i += 4) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        for (uint32_t j = 0; j < 4 && i + j < size; j++) buffer[i + j] = (uint8_t)(state >> (8 * j));
+    }
+}
+
+void host_pc_name_capsule(capsule_t* capsule, int number) {
+    time_t unlock = (time_t)capsule->unlock;
+    struct tm fields;
+    gmtime_r(&unlock, &fields);
+    snprintf(capsule->name, sizeof(capsule->name), "%04d-%02d-%02dT%02d%02d%02dZ capsule %d.bin",
+             fields.tm_year + 1900, fields.tm_mon + 1, fields.tm_mday, fields.tm_hour, fields.tm_min, fields.tm_sec,
+             number);
+}
+
+bool host_pc_write_file(const char* name, uint32_t seed, uint32_t size) {
+    uint8_t* content = malloc(size);
+    fill(seed, content, size);
+
+    char path[80];
+    file_path(name, path, sizeof(path));
+    FIL file;
+    UINT written = 0;
+    bool ok = f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK;
+    if (ok) {
+        ok = f_write(&file, content, size, &written) == FR_OK && written == size;
+        ok = f_close(&file) == FR_OK && ok;
+    }
+    free(content);
+    return ok;
+}
+
+bool host_pc_has_file(const char* name) {
+    char path[80];
+    file_path(name, path, sizeof(path));
+    FILINFO info;
+    return f_stat(path, &info) == FR_OK;
+}
+
+bool host_pc_check_file(const char* name, uint32_t seed, uint32_t size) {
+    uint8_t* expected = malloc(size);
+    uint8_t* actual = malloc(size);
+    fill(seed, expected, size);
+
+    char path[80];
+    file_path(name, path, sizeof(path));
+    FIL file;
+    UINT read = 0;
+    bool ok = f_open(&file, path, FA_READ) == FR_OK;
+    if (ok) {
+        ok = f_size(&file) == size && f_read(&file, actual, size, &read) == FR_OK && read == size &&
+             memcmp(expected, actual, size) == 0;
+        f_close(&file);
+    }
+    free(expected);
+    free(actual);
+    return ok;
+}
+
+host_pc_scan_t host_pc_scan(capsule_t* capsules, int count, int64_t now) {
+    host_pc_scan_t scan = {0};
+    for (int i = 0; i < count; i++) {
+        capsule_t* capsule = &capsules[i];
+        bool present = (capsule->state == CAPSULE_COPIED || capsule->state == CAPSULE_LOCKED) &&
+                       host_pc_has_file(capsule->name);
+        if (capsule->state == CAPSULE_COPIED && !present) capsule->state = CAPSULE_LOCKED;
+        if (capsule->state == CAPSULE_LOCKED && present) {
+            char path[80];
+            file_path(capsule->name, path, sizeof(path));
+            // Collected once read, so a power cut while it is being deleted
+            // does not leave the PC waiting for it
+            capsule->intact = host_pc_check_file(capsule->name, capsule->seed, capsule->size);
+            capsule->state = CAPSULE_COLLECTED;
+            scan.collected++;
+            f_unlink(path);
+        }
+        if (capsule->state == CAPSULE_COPIED) scan.copied++;
+        if (capsule->state == CAPSULE_LOCKED) {
+            scan.locked++;
+            if (capsule->unlock <= now) scan.due = true;
+        }
+    }
+    return scan;
+}
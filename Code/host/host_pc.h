@@ -0,0 +1,55 @@
+#ifndef HOST_PC_H
+#define HOST_PC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// The PC's side of a USB session, for harnesses to call from the USB task
+// while the firmware runs: files written to and checked on the public disk
+// through the firmware's own FatFs, as the PC would see them, and the
+// capsules it has handed to the vault.
+
+typedef enum {
+    CAPSULE_QUEUED,    // Not yet copied to the disk
+    CAPSULE_COPIED,    // On the disk, waiting to be locked
+    CAPSULE_LOCKED,    // In the vault
+    CAPSULE_COLLECTED, // Restored, checked and deleted
+    CAPSULE_SKIPPED    // Too close to its unlock by the time the vault had room, or not copied
+} capsule_state_t;
+
+typedef struct {
+    int64_t unlock;
+    uint32_t size;
+    uint32_t seed;     // For the contents
+    capsule_state_t state;
+    bool due_seen;
+    bool intact;       // Once collected, whether it came back as copied
+    char name[64];
+} capsule_t;
+
+typedef struct {
+    int copied;        // On the disk, not yet locked
+    int locked;
+    int collected;     // By this call
+    bool due;          // A locked capsule is due, so the firmware should restore it
+} host_pc_scan_t;
+
+// Name a capsule for its unlock time, as its owner would
+void host_pc_name_capsule(capsule_t* capsule, int number);
+
+// Write a file of size bytes of the pattern seed gives, in the root of the disk
+bool host_pc_write_file(const char* name, uint32_t seed, uint32_t size);
+
+// Whether the file is in the root of the disk
+bool host_pc_has_file(const char* name);
+
+// Whether the file holds exactly what host_pc_write_file() wrote
+bool host_pc_check_file(const char* name, uint32_t seed, uint32_t size);
+
+// Follow the capsules' progress as of now, in seconds since 1970: a copied
+// capsule that has left the disk is locked, and a locked one back on it has
+// been restored, so it is checked and deleted.
+host_pc_scan_t host_pc_scan(capsule_t* capsules, int count, int64_t now);
+
+#endif // HOST_PC_H
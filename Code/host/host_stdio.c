@@ -0,0 +1,18 @@
+#include "host_stdio.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+static bool verbose = false;
+
+void host_stdio_set_verbose(bool enabled) {
+    verbose = enabled;
+}
+
+int host_printf(const char* format, ...) {
+    if (!verbose) return 0;
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written;
+}
@@ -0,0 +1,13 @@
+#ifndef HOST_STDIO_H
+#define HOST_STDIO_H
+
+#include <stdbool.h>
+
+// Firmware sources in host builds have printf redirected here, much as the
+// SDK wraps it for USB serial, so a harness can keep their messages out of
+// its report. They are dropped unless verbose is set.
+void host_stdio_set_verbose(bool verbose);
+
+int host_printf(const char* format, ...);
+
+#endif // HOST_STDIO_H
@@ -0,0 +1,29 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// A simulated I2C bus standing in for i2c_async.c in host builds. Each
+// transfer goes straight to the device model at its address, and the
+// simulation clock is moved on by the time the bytes take on the wire.
+
+// A device on the bus. It sees the bytes of one transaction: the write,
+// then, after a repeated start, the read. Returns false to NAK.
+typedef bool (*i2c_bus_device_t)(void* context, const uint8_t* write_data, size_t write_len,
+                                 uint8_t* read_data, size_t read_len);
+
+typedef struct {
+    uint32_t transfers;
+    uint32_t bytes;      // Payload plus address bytes, as rv3028_byte_count counts them
+    uint32_t naks;
+    uint64_t bus_time_us;
+} i2c_bus_stats_t;
+
+void i2c_bus_attach(uint8_t address, i2c_bus_device_t device, void* context);
+
+i2c_bus_stats_t i2c_bus_stats(void);
+void i2c_bus_reset_stats(void);
+
+#endif // I2C_BUS_H
@@ -0,0 +1,6 @@
+#ifndef HOST_BSP_BOARD_H
+#define HOST_BSP_BOARD_H
+
+void board_init(void);
+
+#endif // HOST_BSP_BOARD_H
@@ -0,0 +1,35 @@
+#ifndef HOST_HARDWARE_GPIO_H
+#define HOST_HARDWARE_GPIO_H
+
+// Pin functions and levels are tracked by board_sim.c, which watches the
+// power latch. Host builds set WAKE_INT_GPIO to -1, so the RTC is polled and
+// the interrupt calls are never made.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GPIO_IN 0
+#define GPIO_OUT 1
+#define GPIO_IRQ_EDGE_FALL 0x4u
+#define IO_IRQ_BANK0 13
+
+enum gpio_function {
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_NULL = 0x1f
+};
+
+typedef void (*irq_handler_t)(void);
+
+void gpio_init(unsigned int gpio);
+void gpio_set_function(unsigned int gpio, enum gpio_function fn);
+void gpio_set_dir(unsigned int gpio, bool out);
+void gpio_put(unsigned int gpio, bool value);
+void gpio_pull_up(unsigned int gpio);
+bool gpio_get(unsigned int gpio);
+void gpio_add_raw_irq_handler(unsigned int gpio, irq_handler_t handler);
+void gpio_set_irq_enabled(unsigned int gpio, uint32_t events, bool enabled);
+uint32_t gpio_get_irq_event_mask(unsigned int gpio);
+void gpio_acknowledge_irq(unsigned int gpio, uint32_t events);
+
+#endif // HOST_HARDWARE_GPIO_H
@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_I2C_H
+#define HOST_HARDWARE_I2C_H
+
+// Only the bus handle; transfers go through the simulated bus in i2c_bus.c
+
+#include "pico/stdlib.h"
+
+typedef struct i2c_inst i2c_inst_t;
+extern i2c_inst_t i2c0_inst;
+#define i2c0 (&i2c0_inst)
+
+#endif // HOST_HARDWARE_I2C_H
@@ -0,0 +1,11 @@
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+#include <stdint.h>
+
+// Nothing runs from interrupts on the host, but board_sim.c times how long
+// they are held off, for what that would cost USB on the board
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+#endif // HOST_HARDWARE_SYNC_H
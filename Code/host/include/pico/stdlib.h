@@ -0,0 +1,39 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// The parts of the Pico SDK's pico/stdlib.h the firmware uses, for host
+// builds. Time comes from the simulation clock in sim_clock.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+
+typedef unsigned int uint;
+
+// Flash reads go through the simulated flash's memory, wherever it is mapped
+extern const uint8_t* flash_sim_xip;
+#define XIP_BASE ((uintptr_t)flash_sim_xip)
+
+// Bulk copies out of XIP are charged on the simulation clock
+void flash_sim_xip_read(const void* address, size_t len);
+#define XIP_READ(address, len) flash_sim_xip_read(address, len)
+
+#define __not_in_flash_func(name) name
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+bool stdio_init_all(void);
+
+// Nothing is ever typed at the simulated board
+#define PICO_ERROR_TIMEOUT -1
+int getchar_timeout_us(uint32_t timeout_us);
+
+static inline void tight_loop_contents(void) {}
+
+#endif // HOST_PICO_STDLIB_H
@@ -0,0 +1,18 @@
+#ifndef HOST_TUSB_H
+#define HOST_TUSB_H
+
+// The TinyUSB device calls the firmware makes. The bus itself is played by
+// the harness, through board_sim.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCSI_SENSE_UNIT_ATTENTION 0x06
+
+bool tusb_init(void);
+void tud_task(void);
+bool tud_mounted(void);
+bool tud_suspended(void);
+bool tud_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, uint8_t add_sense_qualifier);
+
+#endif // HOST_TUSB_H
@@ -0,0 +1,213 @@
+// Checks iso8601_parse() three ways: a fixed list of names it must accept,
+// with the time each gives, and of names it must reject; random valid
+// dates in every layout it takes, against timegm() less the offset; and
+// random strings and damaged valid names over the grammar's own
+// characters, which only have to parse without faults. It is built with
+// ASan and UBSan.
+//
+// Usage: iso8601_fuzz [-n iterations] [-s seed]
+
+#include "iso8601.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char* text;
+    int64_t epoch;
+} accepted_t;
+
+static const accepted_t accepted[] = {
+    {"2030-01-01", 1893456000},
+    {"2030-01-01 capsule.bin", 1893456000},
+    {"2030-01-01Trip.txt", 1893456000},
+    {"20300101.txt", 1893456000},
+    {"2030-01-01T09:30+01:00", 1893486600},
+    {"2030-01-01T0930+0100 letter.txt", 1893486600},
+    {"2030-01-01T09:30-05:30", 1893510000},
+    {"2030-01-01T09:30-x.txt", 1893490200},
+    {"2024-02-29T23:59:59Z", 1709251199},
+    {"2024-02-29t235959z", 1709251199},
+    {"2000-02-29", 951782400},
+    {"2099-12-31T23:59:59Z", 4102444799},
+    {"1970-01-01T00:00Z", 0},
+    {"2030-06-15T12:00+14", 1907704800},
+};
+
+static const char* const rejected[] = {
+    "",
+    "2030",
+    "2030-01",
+    "2030-1-01",
+    "2030-01-1",
+    "203O-01-01",
+    "2030-0101",
+    "203001-01",
+    "2030-13-01",
+    "2030-00-10",
+    "2030-01-00",
+    "2030-01-32",
+    "2030-04-31",
+    "2030-02-29",
+    "2100-02-29",
+    "2030-01-011",
+    "2030-01-01T24:00",
+    "2030-01-01T12:60",
+    "2030-01-01T12:30:60",
+    "2030-01-01T1",
+    "2030-01-01T12:3",
+    "2030-01-01T12:30+15:00",
+    "2030-01-01T12:30+01:60",
+    "2030-01-01T12:30+1",
+    "2030-01-01T12:30:00Z1",
+};
+
+static int check_fixed(void) {
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(accepted) / sizeof(accepted[0]); i++) {
+        int64_t epoch;
+        if (!iso8601_parse(accepted[i].text, &epoch) || epoch != accepted[i].epoch) {
+            printf("  Not read as %" PRId64 ": \"%s\"\n", accepted[i].epoch, accepted[i].text);
+            failures++;
+        }
+    }
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); i++) {
+        int64_t epoch;
+        if (iso8601_parse(rejected[i], &epoch)) {
+            printf("  Not rejected: \"%s\"\n", rejected[i]);
+            failures++;
+        }
+    }
+    printf("Fixed cases: %zu accepted, %zu rejected, %d wrong\n", sizeof(accepted) / sizeof(accepted[0]),
+           sizeof(rejected) / sizeof(rejected[0]), failures);
+    return failures;
+}
+
+static int pick(int low, int high) {
+    return low + rand() % (high - low + 1);
+}
+
+// A valid name in a random layout, with the time it stands for
+static int64_t random_valid(char* text, size_t size) {
+    static const int month_days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    struct tm fields = {0};
+    int year = pick(1970, 2099), month = pick(1, 12);
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    int day = pick(1, month == 2 && leap ? 29 : month_days[month - 1]);
+    fields.tm_year = year - 1900;
+    fields.tm_mon = month - 1;
+    fields.tm_mday = day;
+
+    bool extended = rand() & 1;
+    int length = snprintf(text, size, extended ? "%04d-%02d-%02d" : "%04d%02d%02d", year, month, day);
+    int64_t offset = 0;
+    if (rand() & 1) {
+        bool colons = rand() & 1;
+        fields.tm_hour = pick(0, 23);
+        fields.tm_min = pick(0, 59);
+        length += snprintf(text + length, size - length, colons ? "T%02d:%02d" : "T%02d%02d", fields.tm_hour,
+                           fields.tm_min);
+        if (rand() & 1) {
+            fields.tm_sec = pick(0, 59);
+            length += snprintf(text + length, size - length, colons ? ":%02d" : "%02d", fields.tm_sec);
+        }
+        switch (rand() % 3) {
+            case 0: break;
+            case 1: length += snprintf(text + length, size - length, "Z"); break;
+            case 2: {
+                int hours = pick(0, 14), minutes = rand() & 1 ? pick(0, 59) : -1;
+                int sign = rand() & 1 ? 1 : -1;
+                length += snprintf(text + length, size - length, "%c%02d", sign > 0 ? '+' : '-', hours);
+                if (minutes >= 0) {
+                    length += snprintf(text + length, size - length, colons ? ":%02d" : "%02d", minutes);
+                }
+                offset = sign * ((int64_t)hours * 3600 + (minutes > 0 ? minutes : 0) * 60);
+                break;
+            }
+        }
+    }
+    if (rand() & 1) snprintf(text + length, size - length, " capsule.bin");
+    return (int64_t)timegm(&fields) - offset;
+}
+
+static int run_valid(long iterations) {
+    int failures = 0;
+    for (long i = 0; i < iterations; i++) {
+        char text[64];
+        int64_t expected = random_valid(text, sizeof(text));
+        int64_t epoch;
+        if (!iso8601_parse(text, &epoch) || epoch != expected) {
+            if (failures++ < 5) printf("  Not read as %" PRId64 ": \"%s\"\n", expected, text);
+        }
+    }
+    printf("Random valid names: %ld, %d wrong\n", iterations, failures);
+    return failures;
+}
+
+// Strings made of what the grammar uses, half of them valid names with a
+// few characters changed, dropped or added so they get some way in. A name
+// that parses must still come out within the years four digits can give.
+static int run_random(long iterations) {
+    static const char alphabet[] = "0123456789012345678901234567890123456789--::TtZz+ .x";
+    int failures = 0;
+    long parsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        char text[64];
+        int length;
+        if (i & 1) {
+            random_valid(text, sizeof(text));
+            length = (int)strlen(text);
+            for (int edits = pick(1, 3); edits > 0; edits--) {
+                int at = length > 0 ? rand() % length : 0;
+                char c = alphabet[rand() % (sizeof(alphabet) - 1)];
+                switch (rand() % 3) {
+                    case 0: if (length > 0) text[at] = c; break;
+                    case 1: if (length > 0) memmove(text + at, text + at + 1, length-- - at); break;
+                    default:
+                        if (length + 1 < (int)sizeof(text)) {
+                            memmove(text + at + 1, text + at, ++length - at);
+                            text[at] = c;
+                        }
+                        break;
+                }
+            }
+        } else {
+            length = rand() % 33;
+            for (int j = 0; j < length; j++) text[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        text[length] = '\0';
+
+        int64_t epoch;
+        if (!iso8601_parse(text, &epoch)) continue;
+        parsed++;
+        if (epoch < -62167219200 - 15 * 3600 || epoch > 253402300799 + 15 * 3600) {
+            if (failures++ < 5) printf("  Out of range: \"%s\" read as %" PRId64 "\n", text, epoch);
+        }
+    }
+    printf("Random strings: %ld, %ld parsed, %d out of range\n", iterations, parsed, failures);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    long iterations = 1000000;
+    unsigned seed = 1;
+    int option;
+    while ((option = getopt(argc, argv, "n:s:")) != -1) {
+        switch (option) {
+            case 'n': iterations = atol(optarg); break;
+            case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-s seed]\n", argv[0]);
+                return 2;
+        }
+    }
+    srand(seed);
+
+    int failures = check_fixed();
+    failures += run_valid(iterations);
+    failures += run_random(iterations);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+// An otherwise empty program that reads the date a name starts with, built
+// once with iso8601_parse() and once with the sscanf() it replaced, so the
+// difference in their sizes is what each costs.
+
+#include <stdint.h>
+#include <stdbool.h>
+#if ISO8601_SIZE_SSCANF
+#include "iso8601_sscanf.h"
+#define parse iso8601_sscanf_parse
+#else
+#include "iso8601.h"
+#define parse iso8601_parse
+#endif
+
+int main(int argc, char** argv) {
+    int64_t epoch = 0;
+    if (argc < 2 || !parse(argv[1], &epoch)) return 1;
+    return (int)(epoch & 0x7F);
+}
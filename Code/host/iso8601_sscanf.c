@@ -0,0 +1,13 @@
+#include "iso8601_sscanf.h"
+#include "rv3028.h"
+#include <stdio.h>
+#include <time.h>
+
+bool iso8601_sscanf_parse(const char* text, int64_t* epoch) {
+    struct tm date = {0};
+    if (sscanf(text, "%d-%d-%d", &date.tm_year, &date.tm_mon, &date.tm_mday) != 3) return false;
+    date.tm_year -= 1900;
+    date.tm_mon -= 1;
+    *epoch = rv3028_tm_to_epoch(&date);
+    return true;
+}
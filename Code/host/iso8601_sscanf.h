@@ -0,0 +1,11 @@
+#ifndef ISO8601_SSCANF_H
+#define ISO8601_SSCANF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The unlock date as fs_move_to_private() read it before iso8601.c: three
+// numbers by sscanf and no checks, kept to measure the parser against.
+bool iso8601_sscanf_parse(const char* text, int64_t* epoch);
+
+#endif // ISO8601_SSCANF_H
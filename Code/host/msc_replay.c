@@ -0,0 +1,236 @@
+// Replays recorded USB mass-storage traces against the firmware's MSC
+// callbacks over the simulated flash, to judge changes to the write path.
+// Each trace starts from a freshly formatted disk. A SCSI command is split
+// into callbacks of the endpoint buffer size, as TinyUSB splits it, and each
+// callback's latency is the simulated device time under it: the flash at
+// datasheet timing, typical unless -t max is given, and XIP reads.
+//
+// A trace holds one command per line, "R <first block> <blocks>" or
+// "W <first block> <blocks>"; lines starting with # are comments. Block
+// addresses are for the volume host_disk_format() makes. The traces in
+// traces/ are replayed when none are named.
+//
+// Usage: msc_replay [-b buffer_bytes] [-t typical|max] [-T events.json] [trace ...]
+//
+// -T writes the firmware's event trace of the last trace replayed, for
+// chrome://tracing or Perfetto.
+
+#include "board_sim.h"
+#include "flash_sim.h"
+#include "host_disk.h"
+#include "sim_clock.h"
+#include "flash_disk.h"
+#include "partition.h"
+#include "trace.h"
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_BUFFER_BYTES 512 // TinyUSB's usual CFG_TUD_MSC_EP_BUFSIZE
+#define MAX_TRACES 64
+
+int32_t tud_msc_read_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize);
+
+typedef struct {
+    uint64_t* us;
+    size_t count;
+    size_t capacity;
+} latencies_t;
+
+typedef struct {
+    uint32_t commands;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint32_t failures;
+    latencies_t writes;
+    latencies_t reads;
+} replay_t;
+
+static uint32_t buffer_bytes = DEFAULT_BUFFER_BYTES;
+
+static void record(latencies_t* latencies, uint64_t us) {
+    if (latencies->count == latencies->capacity) {
+        latencies->capacity = latencies->capacity ? latencies->capacity * 2 : 1024;
+        latencies->us = realloc(latencies->us, latencies->capacity * sizeof(uint64_t));
+    }
+    latencies->us[latencies->count++] = us;
+}
+
+static int compare_us(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void report_latency(const char* name, latencies_t* latencies) {
+    if (latencies->count == 0) return;
+    qsort(latencies->us, latencies->count, sizeof(uint64_t), compare_us);
+    uint64_t p50 = latencies->us[(latencies->count - 1) / 2];
+    uint64_t p99 = latencies->us[(latencies->count - 1) * 99 / 100];
+    uint64_t max = latencies->us[latencies->count - 1];
+    printf("  %s callbacks %zu: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", name, latencies->count, p50 / 1e3,
+           p99 / 1e3, max / 1e3);
+}
+
+// One SCSI READ(10) or WRITE(10), delivered a buffer at a time. Write data
+// is a pattern that never matches the erased state.
+static void run_command(replay_t* replay, char kind, uint32_t lba, uint32_t blocks) {
+    uint8_t* buffer = malloc(buffer_bytes);
+    uint64_t total = (uint64_t)blocks * FLASH_DISK_BLOCK_SIZE;
+    for (uint64_t done = 0; done < total; done += buffer_bytes) {
+        uint32_t length = total - done < buffer_bytes ? (uint32_t)(total - done) : buffer_bytes;
+        uint32_t block = lba + (uint32_t)(done / FLASH_DISK_BLOCK_SIZE);
+        uint32_t offset = (uint32_t)(done % FLASH_DISK_BLOCK_SIZE);
+        uint64_t start_us = sim_clock_us();
+        int32_t result;
+        if (kind == 'W') {
+            for (uint32_t i = 0; i < length; i++) buffer[i] = (uint8_t)(block * 7 + offset + i);
+            result = tud_msc_write10_cb(0, block, offset, buffer, length);
+            record(&replay->writes, sim_clock_us() - start_us);
+            replay->bytes_written += length;
+        } else {
+            result = tud_msc_read_cb(0, block, offset, buffer, length);
+            record(&replay->reads, sim_clock_us() - start_us);
+            replay->bytes_read += length;
+        }
+        if (result != (int32_t)length) replay->failures++;
+    }
+    free(buffer);
+}
+
+static bool replay_trace(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    // A fresh chip, laid out and formatted before anything is counted
+    flash_sim_erase_chip();
+    partition_init();
+    if (!host_disk_format()) {
+        printf("%s: could not format the disk\n", path);
+        fclose(file);
+        return false;
+    }
+    flash_sim_stats_t before = flash_sim_stats();
+    board_sim_reset_irq_stats();
+    trace_clear();
+
+    replay_t replay = {0};
+    char line[256];
+    int line_number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char kind;
+        uint32_t lba, blocks;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, " %c %" SCNu32 " %" SCNu32, &kind, &lba, &blocks) != 3 || (kind != 'R' && kind != 'W')) {
+            printf("%s:%d: not a trace line\n", path, line_number);
+            ok = false;
+            break;
+        }
+        run_command(&replay, kind, lba, blocks);
+        replay.commands++;
+    }
+    fclose(file);
+
+    flash_sim_stats_t after = flash_sim_stats();
+    uint64_t programmed = after.bytes_programmed - before.bytes_programmed;
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    printf("%s: %" PRIu32 " commands, %.1f KB written, %.1f KB read\n", name, replay.commands,
+           replay.bytes_written / 1024.0, replay.bytes_read / 1024.0);
+    printf("  Flash: %" PRIu32 " sector erases, %.1f KB programmed, write amplification %.2f\n",
+           after.erases - before.erases, programmed / 1024.0,
+           replay.bytes_written ? (double)programmed / replay.bytes_written : 0.0);
+    printf("  Flash busy %.2f s at typical timing, %.2f s at worst\n",
+           (after.busy_typical_us - before.busy_typical_us) / 1e6, (after.busy_max_us - before.busy_max_us) / 1e6);
+    report_latency("Write", &replay.writes);
+    report_latency("Read", &replay.reads);
+    board_sim_irq_stats_t irqs = board_sim_irq_stats();
+    printf("  Interrupts off %" PRIu32 " times, longest %.2f ms, %" PRIu32 " over a USB frame, %" PRIu32 " over %d ms\n",
+           irqs.windows, irqs.longest_us / 1e3, irqs.over_frame, irqs.over_control_timeout,
+           BOARD_SIM_CONTROL_TIMEOUT_US / 1000);
+    if (replay.failures) printf("  Failed callbacks %" PRIu32 "\n", replay.failures);
+    if (after.violations != before.violations) {
+        printf("  Programmed over unerased bits %" PRIu32 " times\n", after.violations - before.violations);
+    }
+    free(replay.writes.us);
+    free(replay.reads.us);
+    return ok && replay.failures == 0 && after.violations == before.violations;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// The bundled traces, in name order
+static int bundled_traces(char** paths) {
+    DIR* dir = opendir(MSC_TRACE_DIR);
+    if (dir == NULL) {
+        perror(MSC_TRACE_DIR);
+        return 0;
+    }
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL && count < MAX_TRACES) {
+        size_t length = strlen(entry->d_name);
+        if (length > 6 && strcmp(entry->d_name + length - 6, ".trace") == 0) {
+            paths[count] = malloc(sizeof(MSC_TRACE_DIR) + length + 1);
+            sprintf(paths[count], "%s/%s", MSC_TRACE_DIR, entry->d_name);
+            count++;
+        }
+    }
+    closedir(dir);
+    qsort(paths, count, sizeof(char*), compare_names);
+    return count;
+}
+
+int main(int argc, char** argv) {
+    flash_sim_corner_t corner = FLASH_SIM_TYPICAL;
+    const char* events_path = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "b:t:T:")) != -1) {
+        switch (option) {
+            case 'b': buffer_bytes = (uint32_t)atoi(optarg); break;
+            case 't': corner = strcmp(optarg, "max") == 0 ? FLASH_SIM_MAX : FLASH_SIM_TYPICAL; break;
+            case 'T': events_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b buffer_bytes] [-t typical|max] [-T events.json] [trace ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (buffer_bytes < 64 || buffer_bytes % 64 != 0) {
+        fprintf(stderr, "The buffer must be a whole number of 64 byte packets\n");
+        return 2;
+    }
+
+    char* bundled[MAX_TRACES];
+    char** paths = argv + optind;
+    int count = argc - optind;
+    if (count == 0) {
+        count = bundled_traces(bundled);
+        paths = bundled;
+    }
+
+    flash_sim_init(NULL);
+    flash_sim_set_corner(corner);
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!replay_trace(paths[i])) failed++;
+    }
+    if (events_path != NULL) {
+        FILE* events = fopen(events_path, "w");
+        if (events == NULL) {
+            perror(events_path);
+            return 1;
+        }
+        trace_dump(events);
+        fclose(events);
+    }
+    return failed == 0 && count > 0 ? 0 : 1;
+}
@@ -0,0 +1,474 @@
+// Cuts the board's power at every flash operation of a scenario and checks
+// that nothing the owner was promised is lost. A USB session first sets the
+// board up: a formatted disk with two ordinary files on it, and two capsules
+// locked in the vault. From that snapshot each scenario runs once uncut, to
+// count its flash operations, and then once for each operation with the
+// power cut just before it, and again with it cut partway through.
+//
+// Scenarios:
+//   write   the PC writes a new file to the disk
+//   lock    the PC copies a third capsule on, and the firmware locks it
+//   unlock  the first capsule falls due and the firmware restores it
+//
+// After each cut the board is plugged back in. The time from power-up to
+// USB starting is the recovery time, and the disk must mount. Time then
+// runs on, with the PC collecting every capsule as it is restored, and the
+// ordinary files are checked at the end. A trial is clean if every capsule
+// the PC had finished copying comes back as it was copied, the ordinary
+// files are intact, and a file the PC had finished writing is there.
+//
+// Losses are told apart by where they fall. The disk rewrites a whole
+// sector in place for each write, erase then program, so a cut in between
+// can take ordinary files with it, or the root directory. A directory
+// sector left half programmed ends in 0xFF bytes that FatFs reads as
+// entries past the directory's end, and puts new files after them where no
+// lookup reaches; the PC then cannot find the capsules the firmware
+// restores, and its session never settles. That is a known issue of the disk, not the vault. Anything
+// else, a capsule lost or damaged, a crash or a board left awake, is a
+// vault or boot bug.
+//
+// Usage: powercut_sim [-s write|lock|unlock] [-e every] [-b] [-d] [-t typical|max] [-v]
+//
+// -e cuts at every nth operation only, and -b skips the cuts partway
+// through an operation. A full sweep of all three takes several minutes.
+// The exit status is 1 if anything was lost, or with -d only if the vault
+// or boot path lost something; ctest runs a thinned sweep with -d.
+
+#include "board_sim.h"
+#include "flash_sim.h"
+#include "host_disk.h"
+#include "host_pc.h"
+#include "host_stdio.h"
+#include "rv3028_model.h"
+#include "sim_clock.h"
+#include "sim_shared.h"
+#include "tusb.h"
+#include "flash_disk.h"
+#include "ff.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define START_TIME 1798761600 // 2027-01-01
+#define CAPSULE_COUNT 3       // Two locked at setup, one for the lock scenario
+#define RESIDENT_COUNT 2
+#define FILE_SIZE (20 * 1024)
+#define CAPSULE_SIZE (16 * 1024)
+#define SESSION_LIMIT_US (600 * 1000000ull)
+#define AWAKE_LIMIT_US (10 * 1000000ull)
+#define COLLECT_DELAY_US (3600 * 1000000ull)
+#define SETTLE_WAKES 20
+#define INCIDENTS_REPORTED 5 // Losses on the disk described per scenario; vault losses always are
+#define CONTENT_SEED 0x6A09E667
+
+int firmware_main(void);
+
+typedef enum {
+    PHASE_SETUP,
+    PHASE_WRITE,
+    PHASE_LOCK,
+    PHASE_UNLOCK,
+    PHASE_RECOVER,
+    PHASE_COLLECT,
+    PHASE_INSPECT
+} phase_t;
+
+typedef struct {
+    const char* name;
+    phase_t phase;
+} scenario_t;
+
+typedef enum {
+    LOSS_NONE,
+    LOSS_DISK,  // Ordinary files or the directory on the public disk
+    LOSS_VAULT  // A capsule, or the board crashing or staying awake
+} loss_t;
+
+static const scenario_t scenarios[] = {
+    {"write", PHASE_WRITE},
+    {"lock", PHASE_LOCK},
+    {"unlock", PHASE_UNLOCK},
+};
+
+static const char* resident_names[RESIDENT_COUNT] = {"notes.txt", "photo.jpg"};
+static const char* new_file_name = "letter.txt";
+
+// Kept in shared memory, so the power-ups can report back
+typedef struct {
+    phase_t phase;
+    capsule_t capsules[CAPSULE_COUNT];
+    bool formatted;
+    bool residents_written;
+    bool file_written;    // The write scenario's file, once the PC has finished writing it
+    uint64_t boot_start_us;
+    bool usb_started;
+    uint64_t recovery_us;
+    bool mounted;
+    bool residents_intact;
+    bool directory_intact;
+    bool file_intact;
+    bool stayed_awake;
+    bool stuck;
+} sim_state_t;
+
+typedef struct {
+    uint8_t* flash;
+    void* rtc;
+    capsule_t capsules[CAPSULE_COUNT];
+} snapshot_t;
+
+static sim_state_t* sim;
+static snapshot_t snapshot;
+
+// The PC's side, run from tud_task()
+
+static bool disk_mounts(void) {
+    DIR dir;
+    if (flash_disk_volume_blocks() == 0 || f_opendir(&dir, "0:/") != FR_OK) return false;
+    f_closedir(&dir);
+    return true;
+}
+
+// Whether the root directory ends cleanly, with nothing after the first
+// entry marking its end
+static bool directory_intact(void) {
+    uint8_t block[FLASH_DISK_BLOCK_SIZE];
+    flash_disk_read(0, 0, block, sizeof(block));
+    uint32_t entries_per_block = FLASH_DISK_BLOCK_SIZE / 32;
+    uint32_t entries = block[17] | block[18] << 8;
+    uint32_t first = (block[14] | block[15] << 8) + block[16] * (block[22] | block[23] << 8);
+    if (!disk_mounts() || first + entries / entries_per_block > flash_disk_block_count()) return false;
+
+    bool ended = false;
+    for (uint32_t i = 0; i < entries; i++) {
+        if (i % entries_per_block == 0) flash_disk_read(first + i / entries_per_block, 0, block, sizeof(block));
+        bool end = block[i % entries_per_block * 32] == 0;
+        if (ended && !end) return false;
+        ended |= end;
+    }
+    return true;
+}
+
+// Copy the first capsule still queued, if there is one; it counts as
+// copied only once the write has finished
+static bool copy_next_capsule(int last) {
+    for (int i = 0; i <= last; i++) {
+        capsule_t* capsule = &sim->capsules[i];
+        if (capsule->state != CAPSULE_QUEUED) continue;
+        if (host_pc_write_file(capsule->name, capsule->seed, capsule->size)) capsule->state = CAPSULE_COPIED;
+        return true;
+    }
+    return false;
+}
+
+static void usb_host_task(void) {
+    if (!tud_mounted()) {
+        if (sim_clock_us() - sim->boot_start_us > AWAKE_LIMIT_US) {
+            sim->stayed_awake = true;
+            board_sim_power_off();
+        }
+        return;
+    }
+    if (!sim->usb_started) {
+        sim->usb_started = true;
+        sim->recovery_us = sim_clock_us() - sim->boot_start_us;
+        sim->mounted = disk_mounts();
+    }
+
+    int64_t now = rv3028_model_calendar_time();
+    host_pc_scan_t scan = host_pc_scan(sim->capsules, CAPSULE_COUNT, now);
+    bool done = scan.copied == 0 && !scan.due;
+    switch (sim->phase) {
+        case PHASE_SETUP:
+            if (!sim->formatted) {
+                if (!host_disk_format()) {
+                    printf("Could not format the disk\n");
+                    fflush(stdout);
+                    _exit(1);
+                }
+                sim->formatted = true;
+            }
+            if (!sim->residents_written) {
+                for (int i = 0; i < RESIDENT_COUNT; i++) {
+                    host_pc_write_file(resident_names[i], CONTENT_SEED + i, FILE_SIZE);
+                }
+                sim->residents_written = true;
+            }
+            if (scan.copied == 0 && copy_next_capsule(CAPSULE_COUNT - 2)) done = false;
+            break;
+        case PHASE_WRITE:
+            if (!sim->file_written) {
+                sim->file_written = host_pc_write_file(new_file_name, CONTENT_SEED + RESIDENT_COUNT, FILE_SIZE);
+            }
+            break;
+        case PHASE_LOCK:
+            if (sim->capsules[CAPSULE_COUNT - 1].state == CAPSULE_QUEUED) {
+                copy_next_capsule(CAPSULE_COUNT - 1);
+                done = false;
+            }
+            break;
+        case PHASE_INSPECT:
+            sim->residents_intact = true;
+            for (int i = 0; i < RESIDENT_COUNT; i++) {
+                if (!host_pc_check_file(resident_names[i], CONTENT_SEED + i, FILE_SIZE)) sim->residents_intact = false;
+            }
+            sim->file_intact = host_pc_check_file(new_file_name, CONTENT_SEED + RESIDENT_COUNT, FILE_SIZE);
+            sim->directory_intact = directory_intact();
+            done = true;
+            break;
+        default:
+            break;
+    }
+
+    // Unplug once the firmware has nothing left to do for the PC
+    if (done) board_sim_power_off();
+    if (sim_clock_us() - sim->boot_start_us > SESSION_LIMIT_US) {
+        sim->stuck = true;
+        board_sim_power_off();
+    }
+}
+
+// Power the board up in a phase and wait for the power to go. Returns
+// false if the firmware crashed rather than powering off or losing power.
+static bool power_up(phase_t phase, bool usb) {
+    sim->phase = phase;
+    sim->boot_start_us = sim_clock_us();
+    sim->usb_started = false;
+    int status = board_sim_power_up(usb, firmware_main);
+    if (!WIFEXITED(status)) return false;
+    return WEXITSTATUS(status) == 0 || WEXITSTATUS(status) == FLASH_SIM_POWER_CUT_STATUS;
+}
+
+// Snapshots
+
+static void take_snapshot(void) {
+    snapshot.flash = malloc(FLASH_SIM_SIZE);
+    snapshot.rtc = malloc(rv3028_model_state_size());
+    flash_sim_save(snapshot.flash);
+    rv3028_model_save(snapshot.rtc);
+    memcpy(snapshot.capsules, sim->capsules, sizeof(snapshot.capsules));
+}
+
+static void restore_snapshot(void) {
+    flash_sim_restore(snapshot.flash);
+    rv3028_model_restore(snapshot.rtc);
+    memcpy(sim->capsules, snapshot.capsules, sizeof(snapshot.capsules));
+    sim->file_written = false;
+    sim->stayed_awake = false;
+    sim->stuck = false;
+}
+
+static bool setup(void) {
+    for (int i = 0; i < CAPSULE_COUNT; i++) {
+        capsule_t* capsule = &sim->capsules[i];
+        capsule->unlock = START_TIME + (i + 1) * 86400 + 1234;
+        capsule->size = CAPSULE_SIZE - (uint32_t)i * 100;
+        capsule->seed = CONTENT_SEED + 0x100 + (uint32_t)i * 0x9E3779B9;
+        host_pc_name_capsule(capsule, i + 1);
+    }
+    if (!power_up(PHASE_SETUP, true) || sim->stuck) return false;
+    for (int i = 0; i < CAPSULE_COUNT - 1; i++) {
+        if (sim->capsules[i].state != CAPSULE_LOCKED) return false;
+    }
+    take_snapshot();
+    return true;
+}
+
+// A trial
+
+static bool capsules_pending(void) {
+    for (int i = 0; i < CAPSULE_COUNT; i++) {
+        if (sim->capsules[i].state == CAPSULE_COPIED || sim->capsules[i].state == CAPSULE_LOCKED) return true;
+    }
+    return false;
+}
+
+static bool capsule_due(void) {
+    int64_t now = rv3028_model_calendar_time();
+    for (int i = 0; i < CAPSULE_COUNT; i++) {
+        if (sim->capsules[i].state == CAPSULE_LOCKED && sim->capsules[i].unlock <= now) return true;
+    }
+    return false;
+}
+
+// Run the scenario, cutting the power at operation unless it is UINT32_MAX,
+// then recover and run until every capsule is collected. Gives the flash
+// operations the scenario took and the recovery time, and describes the
+// first thing lost in problem, which is left empty for a clean trial.
+// Returns where the loss fell.
+static loss_t run_trial(const scenario_t* scenario, uint32_t operation, bool inside, uint32_t* operations,
+                        uint64_t* recovery_us, char* problem, size_t size) {
+    restore_snapshot();
+    problem[0] = '\0';
+    if (scenario->phase == PHASE_UNLOCK) {
+        sim_clock_advance((uint64_t)(sim->capsules[0].unlock - rv3028_model_calendar_time() + 60) * 1000000);
+    }
+
+    bool crashed = false;
+    uint32_t first = flash_sim_operations();
+    if (operation != UINT32_MAX) flash_sim_arm_power_cut(operation, inside, operation * 2654435761u);
+    crashed |= !power_up(scenario->phase, true);
+    flash_sim_disarm_power_cut();
+    *operations = flash_sim_operations() - first;
+
+    // Plugged straight back in
+    crashed |= !power_up(PHASE_RECOVER, true);
+    bool mounted = sim->mounted;
+    *recovery_us = sim->recovery_us;
+
+    // Left to run until everything locked has come back
+    for (int wakes = 0; wakes < SETTLE_WAKES && capsules_pending() && !crashed; wakes++) {
+        uint64_t wake_us = rv3028_model_next_interrupt_us();
+        if (wake_us == UINT64_MAX) break;
+        sim_clock_advance_to(wake_us);
+        crashed |= !power_up(PHASE_COLLECT, false);
+        if (capsule_due()) {
+            sim_clock_advance(COLLECT_DELAY_US);
+            crashed |= !power_up(PHASE_COLLECT, true);
+        }
+    }
+    crashed |= !power_up(PHASE_INSPECT, true);
+
+    // A damaged disk is reported first: with its directory gone the PC
+    // cannot see what the firmware restores
+    if (crashed) {
+        snprintf(problem, size, "the firmware crashed");
+        return LOSS_VAULT;
+    } else if (!mounted) {
+        snprintf(problem, size, "the disk did not mount");
+        return LOSS_DISK;
+    } else if (!sim->residents_intact || !sim->directory_intact) {
+        snprintf(problem, size, "%s%s", sim->residents_intact ? "the root directory was damaged" : "an ordinary file was damaged",
+                 sim->stuck ? ", and the PC's session did not settle" : "");
+        return LOSS_DISK;
+    } else if (sim->file_written && !sim->file_intact) {
+        snprintf(problem, size, "%s was lost after the PC finished writing it", new_file_name);
+        return LOSS_DISK;
+    } else if (sim->stuck) {
+        snprintf(problem, size, "a USB session did not settle");
+        return LOSS_VAULT;
+    } else if (sim->stayed_awake) {
+        snprintf(problem, size, "the board stayed awake on battery");
+        return LOSS_VAULT;
+    }
+    for (int i = 0; i < CAPSULE_COUNT; i++) {
+        const capsule_t* capsule = &sim->capsules[i];
+        if (capsule->state == CAPSULE_COPIED || capsule->state == CAPSULE_LOCKED) {
+            snprintf(problem, size, "capsule %d never came back", i + 1);
+            return LOSS_VAULT;
+        } else if (capsule->state == CAPSULE_COLLECTED && !capsule->intact) {
+            snprintf(problem, size, "capsule %d came back wrong", i + 1);
+            return LOSS_VAULT;
+        }
+    }
+    return LOSS_NONE;
+}
+
+static int compare_us(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Sweep the cuts over a scenario and add up the losses by where they fell
+static void run_scenario(const scenario_t* scenario, uint32_t every, bool partway, uint32_t* disk_losses,
+                         uint32_t* vault_losses) {
+    char problem[128];
+    uint32_t operations, ran;
+    uint64_t uncut_us, trial_us;
+    if (run_trial(scenario, UINT32_MAX, false, &operations, &uncut_us, problem, sizeof(problem)) != LOSS_NONE) {
+        printf("%s: fails without a power cut: %s\n", scenario->name, problem);
+        (*vault_losses)++;
+        return;
+    }
+
+    uint32_t trials = 0, incidents = 0, recoveries = 0, on_disk = 0;
+    uint64_t* recovery_us = malloc(sizeof(uint64_t) * (operations * 2 + 1));
+    uint32_t violations = flash_sim_stats().violations;
+    for (uint32_t operation = 0; operation < operations; operation += every) {
+        for (int inside = 0; inside <= (partway ? 1 : 0); inside++) {
+            loss_t loss = run_trial(scenario, operation, inside, &ran, &trial_us, problem, sizeof(problem));
+            trials++;
+            if (loss != LOSS_NONE) {
+                incidents++;
+                if (loss == LOSS_DISK) on_disk++;
+                if (loss == LOSS_VAULT || on_disk <= INCIDENTS_REPORTED) {
+                    printf("  %s, cut %s operation %" PRIu32 ": %s\n", scenario->name, inside ? "inside" : "before",
+                           operation, problem);
+                }
+            } else {
+                recovery_us[recoveries++] = trial_us;
+            }
+        }
+    }
+
+    printf("%s: %" PRIu32 " flash operations, %" PRIu32 " power cuts, %" PRIu32 " clean, %" PRIu32
+           " lost data (%" PRIu32 " on the disk, %" PRIu32 " in the vault)\n",
+           scenario->name, operations, trials, trials - incidents, incidents, on_disk, incidents - on_disk);
+    if (recoveries > 0) {
+        qsort(recovery_us, recoveries, sizeof(uint64_t), compare_us);
+        printf("  Recovery to USB: p50 %.1f ms, max %.1f ms, against %.1f ms uncut\n",
+               recovery_us[(recoveries - 1) / 2] / 1e3, recovery_us[recoveries - 1] / 1e3, uncut_us / 1e3);
+    }
+    uint32_t new_violations = flash_sim_stats().violations - violations;
+    if (new_violations) printf("  Programmed over unerased bits %" PRIu32 " times\n", new_violations);
+    free(recovery_us);
+    *disk_losses += on_disk;
+    *vault_losses += incidents - on_disk;
+}
+
+int main(int argc, char** argv) {
+    const char* only = NULL;
+    uint32_t every = 1;
+    bool partway = true;
+    bool disk_known = false;
+    flash_sim_corner_t corner = FLASH_SIM_TYPICAL;
+    int option;
+    while ((option = getopt(argc, argv, "s:e:bdt:v")) != -1) {
+        switch (option) {
+            case 's': only = optarg; break;
+            case 'e': every = (uint32_t)atoi(optarg); break;
+            case 'b': partway = false; break;
+            case 'd': disk_known = true; break;
+            case 't': corner = strcmp(optarg, "max") == 0 ? FLASH_SIM_MAX : FLASH_SIM_TYPICAL; break;
+            case 'v': host_stdio_set_verbose(true); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s write|lock|unlock] [-e every] [-b] [-d] [-t typical|max] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (every < 1) {
+        fprintf(stderr, "Cut at every operation or fewer\n");
+        return 2;
+    }
+
+    sim_clock_us();
+    sim = sim_shared_alloc(sizeof(sim_state_t));
+    flash_sim_init(NULL);
+    flash_sim_erase_chip();
+    flash_sim_set_corner(corner);
+    board_sim_reset_irq_stats();
+    board_sim_set_usb_task(usb_host_task);
+    rv3028_model_init();
+    rv3028_model_set_time(START_TIME);
+    if (!setup()) {
+        printf("Could not set the board up\n");
+        return 1;
+    }
+
+    uint32_t disk_losses = 0, vault_losses = 0;
+    int run = 0;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (only != NULL && strcmp(only, scenarios[i].name) != 0) continue;
+        run_scenario(&scenarios[i], every, partway, &disk_losses, &vault_losses);
+        run++;
+    }
+    if (run == 0) {
+        fprintf(stderr, "No scenario named %s\n", only);
+        return 2;
+    }
+    if (vault_losses > 0) return 1;
+    return disk_losses == 0 || disk_known ? 0 : 1;
+}
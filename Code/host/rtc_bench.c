@@ -0,0 +1,210 @@
+// Runs the RV-3028 driver and the wake scheduler against the RTC model:
+// the bus cost of each driver call, a calendar round trip through every day
+// the RTC can hold, and a multi-year run of capsule unlocks where time jumps
+// straight from one wake to the next.
+//
+// Usage: rtc_bench [-n capsules] [-y years] [-d drift_ppm] [-s seed] [-v]
+
+#include "rv3028.h"
+#include "wake_scheduler.h"
+#include "rv3028_model.h"
+#include "i2c_bus.h"
+#include "sim_clock.h"
+#include "host_stdio.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SECONDS_PER_YEAR 31556952 // Average Gregorian year
+#define MAX_LATENESS 60           // The date alarm goes off on the minute
+
+typedef struct {
+    uint32_t transfers;
+    uint32_t bytes;
+    uint64_t start_us;
+} op_start_t;
+
+static op_start_t begin_op(void) {
+    return (op_start_t){rv3028_transaction_count(), rv3028_byte_count(), sim_clock_us()};
+}
+
+static void end_op(const char* name, op_start_t start, rv3028_result_t result) {
+    printf("  %-28s %4" PRIu32 " %6" PRIu32 " %9" PRIu64 "%s\n", name,
+           rv3028_transaction_count() - start.transfers, rv3028_byte_count() - start.bytes,
+           sim_clock_us() - start.start_us, result == RV3028_SUCCESS ? "" : "  failed");
+}
+
+static struct tm utc(int64_t seconds) {
+    time_t time_value = (time_t)seconds;
+    struct tm fields;
+    gmtime_r(&time_value, &fields);
+    return fields;
+}
+
+static void set_clock(int64_t seconds) {
+    struct tm fields = utc(seconds);
+    rv3028_set_current_time(&fields);
+}
+
+// Bus cost of each driver call, from a warm start
+static void run_costs(void) {
+    printf("Driver calls                 xfers  bytes   time us\n");
+    set_clock(1767225600); // 2026-01-01
+    struct tm fields;
+    rv3028_snapshot_t snapshot;
+    uint32_t unix_time;
+    uint8_t record[9];
+    memset(record, 0xA5, sizeof(record));
+    struct tm alarm = utc(1767225600 + 40 * 86400);
+    op_start_t op;
+
+    op = begin_op(); end_op("initialize", op, rv3028_initialize());
+    op = begin_op(); end_op("get_current_time", op, rv3028_get_current_time(&fields));
+    op = begin_op(); end_op("set_current_time", op, rv3028_set_current_time(&fields));
+    op = begin_op(); end_op("get_unix_time", op, rv3028_get_unix_time(&unix_time));
+    op = begin_op(); end_op("sync_unix_time", op, rv3028_sync_unix_time());
+    op = begin_op(); end_op("read_snapshot", op, rv3028_read_snapshot(&snapshot));
+    op = begin_op(); end_op("set_alarm", op, rv3028_set_alarm(&alarm));
+    op = begin_op(); end_op("set_alarm, re-armed", op, rv3028_set_alarm(&alarm));
+    op = begin_op(); end_op("start_countdown", op, rv3028_start_countdown(600));
+    op = begin_op(); end_op("stop_countdown", op, rv3028_stop_countdown());
+    op = begin_op(); end_op("wake_schedule, 10 min", op, wake_schedule(1767225600 + 600) ? RV3028_SUCCESS : RV3028_ERROR_I2C_WRITE_FAILED);
+    op = begin_op(); end_op("wake_schedule, 2 years", op, wake_schedule(1767225600 + 2 * SECONDS_PER_YEAR) ? RV3028_SUCCESS : RV3028_ERROR_I2C_WRITE_FAILED);
+    op = begin_op(); end_op("write_user_eeprom, 9 bytes", op, rv3028_write_user_eeprom(0x20, record, sizeof(record)));
+    op = begin_op(); end_op("read_user_eeprom, 9 bytes", op, rv3028_read_user_eeprom(0x20, record, sizeof(record)));
+    op = begin_op(); end_op("set_offset", op, rv3028_set_offset(-3));
+    op = begin_op(); end_op("set_offset, back to 0", op, rv3028_set_offset(0));
+    wake_cancel();
+}
+
+// Every day from 2000 to 2099 through the time registers and back
+static int run_calendar(void) {
+    int mismatches = 0;
+    int64_t first_day = 10957; // 2000-01-01
+    int64_t last_day = 47481;  // 2099-12-31
+    for (int64_t day = first_day; day <= last_day; day++) {
+        int64_t seconds = day * 86400 + rand() % 86400;
+        struct tm written = utc(seconds);
+        struct tm read;
+        uint32_t unix_time = 0;
+        if (rv3028_set_current_time(&written) != RV3028_SUCCESS || rv3028_get_current_time(&read) != RV3028_SUCCESS ||
+            rv3028_get_unix_time(&unix_time) != RV3028_SUCCESS) {
+            mismatches++;
+            continue;
+        }
+
+        bool same = read.tm_sec == written.tm_sec && read.tm_min == written.tm_min &&
+                    read.tm_hour == written.tm_hour && read.tm_wday == written.tm_wday &&
+                    read.tm_mday == written.tm_mday && read.tm_mon == written.tm_mon &&
+                    read.tm_year == written.tm_year && rv3028_tm_to_epoch(&read) == seconds &&
+                    rv3028_model_calendar_time() == seconds && unix_time == (uint32_t)seconds;
+        if (!same) {
+            if (mismatches < 5) printf("  Calendar mismatch at %" PRId64 "\n", seconds);
+            mismatches++;
+        }
+    }
+    printf("Calendar round trip: %" PRId64 " days, %d mismatches\n", last_day - first_day + 1, mismatches);
+    return mismatches;
+}
+
+static int compare_times(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Capsules scattered over the years, each woken for until it is due
+static int run_schedule(int capsules, int years, double drift_ppm) {
+    int64_t start = 1767225600 + rand() % 86400;
+    int64_t* unlocks = malloc(sizeof(int64_t) * capsules);
+    for (int i = 0; i < capsules; i++) {
+        unlocks[i] = start + 60 + (int64_t)((double)rand() / RAND_MAX * ((double)years * SECONDS_PER_YEAR));
+    }
+    qsort(unlocks, capsules, sizeof(int64_t), compare_times);
+
+    // The RTC keeps its settings from the runs before, as the driver's
+    // register copies expect; only the flags left over are cleared
+    rv3028_model_set_drift_ppm(drift_ppm);
+    set_clock(start);
+    rv3028_clear_alarm_flag();
+    rv3028_clear_timer_flag();
+    uint64_t start_us = sim_clock_us();
+    uint32_t start_transfers = rv3028_transaction_count();
+    clock_t wall_start = clock();
+
+    int wakes = 0, late = 0, failures = 0;
+    int64_t worst_lateness = 0, total_lateness = 0;
+    for (int i = 0; i < capsules && failures == 0; i++) {
+        for (;;) {
+            uint64_t wake_us = wake_schedule(unlocks[i]) ? rv3028_model_next_interrupt_us() : UINT64_MAX;
+            if (wake_us == UINT64_MAX) {
+                printf("  No wake scheduled for the unlock at %" PRId64 "\n", unlocks[i]);
+                failures++;
+                break;
+            }
+            sim_clock_advance_to(wake_us);
+
+            // Polled, as with INT unwired; the scheduler reads at most once a second
+            int64_t wake_time;
+            while (!wake_check(&wake_time)) sim_clock_advance(1000);
+            wakes++;
+            if (wake_time < unlocks[i]) continue;
+
+            int64_t lateness = wake_time - unlocks[i];
+            total_lateness += lateness;
+            if (lateness > worst_lateness) worst_lateness = lateness;
+            if (lateness > MAX_LATENESS && late++ < 5) {
+                printf("  Unlock at %" PRId64 " woken for %" PRId64 " s late\n", unlocks[i], lateness);
+            }
+            break;
+        }
+    }
+    double wall_ms = (double)(clock() - wall_start) * 1000.0 / CLOCKS_PER_SEC;
+
+    double elapsed_s = (double)(sim_clock_us() - start_us) / 1e6;
+    double rtc_error_s = (double)(rv3028_model_calendar_time() - start) - elapsed_s;
+    printf("Schedule: %d capsules over %d years, drift %+.1f ppm\n", capsules, years, drift_ppm);
+    printf("  Wakes %d (%.1f per capsule), I2C transfers %" PRIu32 "\n", wakes, (double)wakes / capsules,
+           rv3028_transaction_count() - start_transfers);
+    printf("  Unlock lateness by the RTC: mean %.1f s, worst %" PRId64 " s, %d over %d s\n",
+           (double)total_lateness / capsules, worst_lateness, late, MAX_LATENESS);
+    printf("  RTC off true time by %+.0f s at the end\n", rtc_error_s);
+    printf("  Simulated %.1f days in %.0f ms\n", elapsed_s / 86400, wall_ms);
+    free(unlocks);
+    return failures + late;
+}
+
+int main(int argc, char** argv) {
+    int capsules = 20;
+    int years = 7;
+    double drift_ppm = 0;
+    unsigned seed = 1;
+    int option;
+    while ((option = getopt(argc, argv, "n:y:d:s:v")) != -1) {
+        switch (option) {
+            case 'n': capsules = atoi(optarg); break;
+            case 'y': years = atoi(optarg); break;
+            case 'd': drift_ppm = atof(optarg); break;
+            case 's': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'v': host_stdio_set_verbose(true); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n capsules] [-y years] [-d drift_ppm] [-s seed] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (capsules < 1 || years < 1 || years > 70) {
+        fprintf(stderr, "Need at least one capsule and 1 to 70 years\n");
+        return 2;
+    }
+    srand(seed);
+
+    rv3028_model_init();
+    i2c_async_init(RV3028_I2C_PORT, RV3028_I2C_BAUDRATE);
+
+    run_costs();
+    int problems = run_calendar();
+    problems += run_schedule(capsules, years, drift_ppm);
+    return problems == 0 ? 0 : 1;
+}
@@ -0,0 +1,543 @@
+#include "rv3028_model.h"
+#include "rv3028.h"
+#include "i2c_bus.h"
+#include "sim_clock.h"
+#include "sim_shared.h"
+#include <string.h>
+#include <time.h>
+
+#define REGISTER_COUNT 0x40       // Addresses wrap from 3Fh back to 00h
+#define OSC_HZ 4096               // Prescaler stage the seconds and the countdown are taken from
+#define SECONDS_PER_DAY 86400
+#define STATUS_PORF 0x01          // Power-on reset flag
+#define STATUS_FLAGS 0x7F         // Cleared by writing 0; EEBUSY is read-only
+#define CONTROL1_TRPT 0x80        // The countdown reloads at zero rather than stopping
+#define TIMER_STATUS0_REG 0x0C    // Countdown value as it runs, bits 0-7
+#define TIMER_STATUS1_REG 0x0D
+#define ID_REG 0x28
+#define ID_VALUE 0x30
+#define CONFIG_REG 0x30           // Configuration RAM, refreshed from the configuration EEPROM
+#define CONFIG_SIZE 8
+#define EECMD_REFRESH 0x12
+#define OFFSET_STEP_PPM 0.9537
+#define ALARM_SEARCH_DAYS 400     // Any date or weekday alarm comes round well within this
+
+// EEPROM access times are approximate; the datasheet gives about 10 ms to
+// program a byte
+#define EEPROM_WRITE_US 10000
+#define EEPROM_READ_US 100
+
+// Everything the part holds, kept in memory shared with forked children so
+// it survives the simulated board powering down
+typedef struct {
+    uint8_t registers[REGISTER_COUNT];   // For the registers whose value is simply what was written
+    uint8_t register_pointer;
+    int64_t calendar;                    // Time registers, as seconds since 1970
+    int weekday_offset;                  // The weekday counter runs apart from the date
+    uint32_t unix_time;
+    uint32_t prescaler;                  // Ticks into the current second
+    uint16_t timer_value;
+    uint64_t timer_phase;                // Ticks to the next countdown step
+
+    uint8_t user_eeprom[RV3028_USER_EEPROM_SIZE];
+    uint8_t config_eeprom[CONFIG_SIZE];
+    bool eecmd_armed;
+    uint64_t eeprom_busy_until_us;
+    uint32_t eeprom_writes;
+
+    double drift_ppm;
+    uint64_t synced_us;                  // Simulation time the counters have been run up to
+    double tick_fraction;                // Part of a tick run up past synced_us
+} rtc_state_t;
+
+static rtc_state_t* rtc;
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static uint8_t to_bcd(int value) {
+    return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+static int from_bcd(uint8_t value) {
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+// Days from 1970-01-01, out-of-range days and months carrying over as the
+// counters would
+static int64_t days_from_civil(int64_t year, int month, int day) {
+    year += floor_div(month - 1, 12);
+    month = (int)(month - 1 - floor_div(month - 1, 12) * 12) + 1;
+    if (month <= 2) year--;
+    int64_t era = floor_div(year, 400);
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+static void calendar_fields(int64_t seconds, struct tm* fields) {
+    time_t time_value = (time_t)seconds;
+    gmtime_r(&time_value, fields);
+}
+
+// Weekday counter on a day since 1970, which was a Thursday
+static int weekday_on(int64_t day) {
+    int64_t weekday = (day + 4 + rtc->weekday_offset) % 7;
+    return (int)(weekday < 0 ? weekday + 7 : weekday);
+}
+
+static int16_t offset_steps(void) {
+    int16_t value = (int16_t)((rtc->registers[RV3028_EEPROM_OFFSET_REG] << 1) |
+                              ((rtc->registers[RV3028_EEPROM_BACKUP_REG] & RV3028_BACKUP_EEOFFSET0) ? 1 : 0));
+    return (value > RV3028_OFFSET_MAX) ? value - 512 : value;
+}
+
+static double ticks_per_us(void) {
+    return OSC_HZ / 1e6 * (1.0 + (rtc->drift_ppm - offset_steps() * OFFSET_STEP_PPM) * 1e-6);
+}
+
+// Alarm
+
+// First time after from at which the alarm registers match, on the minute,
+// or INT64_MAX if they never will
+static int64_t next_alarm(int64_t from) {
+    uint8_t minute_reg = rtc->registers[RV3028_ALARM_MINUTES_REG];
+    uint8_t hour_reg = rtc->registers[RV3028_ALARM_HOURS_REG];
+    uint8_t day_reg = rtc->registers[RV3028_ALARM_DATE_REG];
+    bool match_minute = !(minute_reg & RV3028_ALARM_AE);
+    bool match_hour = !(hour_reg & RV3028_ALARM_AE);
+    bool match_day = !(day_reg & RV3028_ALARM_AE);
+    if (!match_minute && !match_hour && !match_day) return INT64_MAX;
+
+    int minute = from_bcd(minute_reg & RV3028_MINUTES_MASK);
+    int hour = from_bcd(hour_reg & RV3028_HOURS_MASK);
+    bool by_date = rtc->registers[RV3028_CONTROL1_REG] & RV3028_CONTROL1_WADA;
+    int day = by_date ? from_bcd(day_reg & RV3028_DATE_MASK) : (day_reg & RV3028_WEEKDAY_MASK);
+
+    int64_t first_day = floor_div(from, SECONDS_PER_DAY);
+    for (int64_t d = first_day; d < first_day + ALARM_SEARCH_DAYS; d++) {
+        if (match_day) {
+            struct tm date;
+            calendar_fields(d * SECONDS_PER_DAY, &date);
+            if ((by_date ? date.tm_mday : weekday_on(d)) != day) continue;
+        }
+        for (int h = 0; h < 24; h++) {
+            if (match_hour && h != hour) continue;
+            for (int m = 0; m < 60; m++) {
+                if (match_minute && m != minute) continue;
+                int64_t t = d * SECONDS_PER_DAY + h * 3600 + m * 60;
+                if (t > from) return t;
+            }
+        }
+    }
+    return INT64_MAX;
+}
+
+// Countdown
+
+static uint64_t timer_period(void) {
+    switch (rtc->registers[RV3028_CONTROL1_REG] & RV3028_CONTROL1_TD_MASK) {
+        case 0: return 1;              // 4096 Hz
+        case 1: return OSC_HZ / 64;    // 64 Hz
+        case 2: return OSC_HZ;         // 1 Hz
+        default: return OSC_HZ * 60;   // 1/60 Hz
+    }
+}
+
+static uint16_t timer_preset(void) {
+    return (uint16_t)(rtc->registers[RV3028_TIMER_VALUE0_REG] | ((rtc->registers[RV3028_TIMER_VALUE1_REG] & 0x0F) << 8));
+}
+
+// The slow countdown clocks step with the seconds and minutes, so the first
+// step can come early
+static void start_countdown(void) {
+    rtc->timer_value = timer_preset();
+    uint64_t period = timer_period();
+    if (period == OSC_HZ * 60) {
+        struct tm now;
+        calendar_fields(rtc->calendar, &now);
+        rtc->timer_phase = (uint64_t)(59 - now.tm_sec) * OSC_HZ + (OSC_HZ - rtc->prescaler);
+    } else {
+        rtc->timer_phase = period - rtc->prescaler % period;
+    }
+}
+
+static uint64_t ticks_to_timer_zero(void) {
+    return rtc->timer_phase + (uint64_t)(rtc->timer_value - 1) * timer_period();
+}
+
+// Step the countdown within ticks that do not reach zero
+static void step_countdown(uint64_t ticks) {
+    if (ticks < rtc->timer_phase) {
+        rtc->timer_phase -= ticks;
+        return;
+    }
+    uint64_t period = timer_period();
+    uint64_t after = ticks - rtc->timer_phase;
+    rtc->timer_value -= (uint16_t)(1 + after / period);
+    rtc->timer_phase = period - after % period;
+}
+
+static void run_countdown(uint64_t ticks) {
+    if (!(rtc->registers[RV3028_CONTROL1_REG] & RV3028_CONTROL1_TE) || rtc->timer_value == 0) return;
+
+    uint64_t to_zero = ticks_to_timer_zero();
+    if (ticks < to_zero) {
+        step_countdown(ticks);
+        return;
+    }
+
+    rtc->registers[RV3028_STATUS_REG] |= RV3028_STATUS_TF;
+    uint16_t preset = timer_preset();
+    if (!(rtc->registers[RV3028_CONTROL1_REG] & CONTROL1_TRPT) || preset == 0) {
+        rtc->registers[RV3028_CONTROL1_REG] &= ~RV3028_CONTROL1_TE;
+        rtc->timer_value = 0;
+        return;
+    }
+
+    // Repeating: reload and carry on with the ticks past zero
+    uint64_t period = timer_period();
+    rtc->timer_value = preset;
+    rtc->timer_phase = period;
+    step_countdown((ticks - to_zero) % (preset * period));
+}
+
+// Counters
+
+static void refresh_config(void) {
+    memcpy(&rtc->registers[CONFIG_REG], rtc->config_eeprom, CONFIG_SIZE);
+}
+
+static void run_ticks(uint64_t ticks) {
+    if (ticks == 0) return;
+    run_countdown(ticks);
+
+    uint64_t seconds = (rtc->prescaler + ticks) / OSC_HZ;
+    rtc->prescaler = (uint32_t)((rtc->prescaler + ticks) % OSC_HZ);
+    if (seconds == 0) return;
+
+    int64_t before = rtc->calendar;
+    rtc->calendar += (int64_t)seconds;
+    rtc->unix_time += (uint32_t)seconds;
+
+    if (!(rtc->registers[RV3028_CONTROL1_REG] & RV3028_CONTROL1_USEL) || floor_div(before, 60) != floor_div(rtc->calendar, 60)) {
+        rtc->registers[RV3028_STATUS_REG] |= RV3028_STATUS_UF;
+    }
+    if (next_alarm(before) <= rtc->calendar) {
+        rtc->registers[RV3028_STATUS_REG] |= RV3028_STATUS_AF;
+    }
+
+    // The configuration RAM is refreshed from the EEPROM once a day, unless
+    // that is turned off
+    if (!(rtc->registers[RV3028_CONTROL1_REG] & RV3028_CONTROL1_EERD) &&
+        floor_div(before, SECONDS_PER_DAY) != floor_div(rtc->calendar, SECONDS_PER_DAY)) {
+        refresh_config();
+    }
+}
+
+static void catch_up(void) {
+    uint64_t now = sim_clock_us();
+    if (now <= rtc->synced_us) return;
+    double ticks = (double)(now - rtc->synced_us) * ticks_per_us() + rtc->tick_fraction;
+    uint64_t whole = (uint64_t)ticks;
+    rtc->tick_fraction = ticks - (double)whole;
+    rtc->synced_us = now;
+    run_ticks(whole);
+}
+
+// EEPROM
+
+static bool eeprom_busy(void) {
+    return sim_clock_us() < rtc->eeprom_busy_until_us;
+}
+
+static uint8_t* eeprom_byte(uint8_t address) {
+    if (address < RV3028_USER_EEPROM_SIZE) return &rtc->user_eeprom[address];
+    if (address >= CONFIG_REG && address < CONFIG_REG + CONFIG_SIZE) return &rtc->config_eeprom[address - CONFIG_REG];
+    return NULL;
+}
+
+// Commands only run straight after a 00h, and not while the EEPROM is busy
+static void eeprom_command(uint8_t command) {
+    if (eeprom_busy()) return;
+    if (command == 0x00) {
+        rtc->eecmd_armed = true;
+        return;
+    }
+    if (!rtc->eecmd_armed) return;
+    rtc->eecmd_armed = false;
+
+    uint64_t busy_us = 0;
+    uint8_t* byte = eeprom_byte(rtc->registers[RV3028_EEADDR_REG]);
+    switch (command) {
+        case RV3028_EECMD_UPDATE:
+            for (int i = 0; i < CONFIG_SIZE; i++) {
+                if (rtc->config_eeprom[i] != rtc->registers[CONFIG_REG + i]) {
+                    rtc->config_eeprom[i] = rtc->registers[CONFIG_REG + i];
+                    rtc->eeprom_writes++;
+                    busy_us += EEPROM_WRITE_US;
+                }
+            }
+            break;
+        case EECMD_REFRESH:
+            refresh_config();
+            busy_us = EEPROM_READ_US * CONFIG_SIZE;
+            break;
+        case RV3028_EECMD_WRITE_ONE:
+            if (byte) {
+                *byte = rtc->registers[RV3028_EEDATA_REG];
+                rtc->eeprom_writes++;
+                busy_us = EEPROM_WRITE_US;
+            }
+            break;
+        case RV3028_EECMD_READ_ONE:
+            if (byte) {
+                rtc->registers[RV3028_EEDATA_REG] = *byte;
+                busy_us = EEPROM_READ_US;
+            }
+            break;
+    }
+    rtc->eeprom_busy_until_us = sim_clock_us() + busy_us;
+}
+
+// Registers
+
+static uint8_t read_register(uint8_t address) {
+    struct tm now;
+    switch (address) {
+        case RV3028_SECONDS_REG:
+        case RV3028_MINUTES_REG:
+        case RV3028_HOURS_REG:
+        case RV3028_DATE_REG:
+        case RV3028_MONTH_REG:
+        case RV3028_YEAR_REG:
+            calendar_fields(rtc->calendar, &now);
+            if (address == RV3028_SECONDS_REG) return to_bcd(now.tm_sec);
+            if (address == RV3028_MINUTES_REG) return to_bcd(now.tm_min);
+            if (address == RV3028_HOURS_REG) return to_bcd(now.tm_hour);
+            if (address == RV3028_DATE_REG) return to_bcd(now.tm_mday);
+            if (address == RV3028_MONTH_REG) return to_bcd(now.tm_mon + 1);
+            return to_bcd(now.tm_year % 100);
+        case RV3028_WEEKDAY_REG:
+            return (uint8_t)weekday_on(floor_div(rtc->calendar, SECONDS_PER_DAY));
+        case TIMER_STATUS0_REG:
+            return rtc->timer_value & 0xFF;
+        case TIMER_STATUS1_REG:
+            return rtc->timer_value >> 8;
+        case RV3028_STATUS_REG:
+            return rtc->registers[RV3028_STATUS_REG] | (eeprom_busy() ? RV3028_STATUS_EEBUSY : 0);
+        case RV3028_UNIX_TIME0_REG:
+        case RV3028_UNIX_TIME0_REG + 1:
+        case RV3028_UNIX_TIME0_REG + 2:
+        case RV3028_UNIX_TIME0_REG + 3:
+            return (uint8_t)(rtc->unix_time >> (8 * (address - RV3028_UNIX_TIME0_REG)));
+        case ID_REG:
+            return ID_VALUE;
+        default:
+            return rtc->registers[address];
+    }
+}
+
+// A calendar register changed; the weekday counter is left as it was
+static void write_calendar(uint8_t address, uint8_t value) {
+    struct tm now;
+    calendar_fields(rtc->calendar, &now);
+    int weekday = weekday_on(floor_div(rtc->calendar, SECONDS_PER_DAY));
+
+    int64_t year = now.tm_year + 1900;
+    int month = now.tm_mon + 1;
+    int day = now.tm_mday;
+    int hour = now.tm_hour, minute = now.tm_min, second = now.tm_sec;
+    switch (address) {
+        case RV3028_SECONDS_REG:
+            second = from_bcd(value & RV3028_SECONDS_MASK);
+            rtc->prescaler = 0; // Writing the seconds restarts the second
+            break;
+        case RV3028_MINUTES_REG: minute = from_bcd(value & RV3028_MINUTES_MASK); break;
+        case RV3028_HOURS_REG: hour = from_bcd(value & RV3028_HOURS_MASK); break;
+        case RV3028_DATE_REG: day = from_bcd(value & RV3028_DATE_MASK); break;
+        case RV3028_MONTH_REG: month = from_bcd(value & RV3028_MONTH_MASK); break;
+        case RV3028_YEAR_REG: year = 2000 + from_bcd(value); break;
+    }
+
+    rtc->calendar = days_from_civil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+    rtc->weekday_offset = 0;
+    rtc->weekday_offset = (weekday - weekday_on(floor_div(rtc->calendar, SECONDS_PER_DAY)) + 7) % 7;
+}
+
+static void write_register(uint8_t address, uint8_t value) {
+    switch (address) {
+        case RV3028_SECONDS_REG:
+        case RV3028_MINUTES_REG:
+        case RV3028_HOURS_REG:
+        case RV3028_DATE_REG:
+        case RV3028_MONTH_REG:
+        case RV3028_YEAR_REG:
+            write_calendar(address, value);
+            break;
+        case RV3028_WEEKDAY_REG:
+            rtc->weekday_offset = 0;
+            rtc->weekday_offset = ((value & RV3028_WEEKDAY_MASK) - weekday_on(floor_div(rtc->calendar, SECONDS_PER_DAY)) + 7) % 7;
+            break;
+        case TIMER_STATUS0_REG:
+        case TIMER_STATUS1_REG:
+        case ID_REG:
+            break;
+        case RV3028_STATUS_REG:
+            rtc->registers[RV3028_STATUS_REG] &= value | ~STATUS_FLAGS;
+            break;
+        case RV3028_CONTROL1_REG: {
+            bool starting = !(rtc->registers[address] & RV3028_CONTROL1_TE) && (value & RV3028_CONTROL1_TE);
+            rtc->registers[address] = value;
+            if (starting) start_countdown();
+            break;
+        }
+        case RV3028_UNIX_TIME0_REG:
+        case RV3028_UNIX_TIME0_REG + 1:
+        case RV3028_UNIX_TIME0_REG + 2:
+        case RV3028_UNIX_TIME0_REG + 3: {
+            int shift = 8 * (address - RV3028_UNIX_TIME0_REG);
+            rtc->unix_time = (rtc->unix_time & ~(0xFFu << shift)) | ((uint32_t)value << shift);
+            break;
+        }
+        case RV3028_EECMD_REG:
+            eeprom_command(value);
+            break;
+        default:
+            rtc->registers[address] = value;
+            break;
+    }
+}
+
+// One transaction: the first byte written sets the register pointer, and
+// reads and writes carry on from it
+static bool model_transfer(void* context, const uint8_t* write_data, size_t write_len,
+                           uint8_t* read_data, size_t read_len) {
+    (void)context;
+    catch_up();
+
+    if (write_len > 0) {
+        rtc->register_pointer = write_data[0] % REGISTER_COUNT;
+        for (size_t i = 1; i < write_len; i++) {
+            write_register(rtc->register_pointer, write_data[i]);
+            rtc->register_pointer = (rtc->register_pointer + 1) % REGISTER_COUNT;
+        }
+    }
+    for (size_t i = 0; i < read_len; i++) {
+        read_data[i] = read_register(rtc->register_pointer);
+        rtc->register_pointer = (rtc->register_pointer + 1) % REGISTER_COUNT;
+    }
+    return true;
+}
+
+// Public API
+
+void rv3028_model_init(void) {
+    if (rtc == NULL) rtc = sim_shared_alloc(sizeof(rtc_state_t));
+    memset(rtc->registers, 0, sizeof(rtc->registers));
+    rtc->registers[RV3028_STATUS_REG] = STATUS_PORF;
+    rtc->registers[RV3028_ALARM_MINUTES_REG] = RV3028_ALARM_AE;
+    rtc->registers[RV3028_ALARM_HOURS_REG] = RV3028_ALARM_AE;
+    rtc->registers[RV3028_ALARM_DATE_REG] = RV3028_ALARM_AE;
+    rtc->register_pointer = 0;
+
+    memset(rtc->user_eeprom, 0, sizeof(rtc->user_eeprom));
+    memset(rtc->config_eeprom, 0, sizeof(rtc->config_eeprom));
+    rtc->config_eeprom[RV3028_EEPROM_BACKUP_REG - CONFIG_REG] = 0x10; // Fast edge detection, the factory setting
+    refresh_config();
+    rtc->eecmd_armed = false;
+    rtc->eeprom_busy_until_us = 0;
+    rtc->eeprom_writes = 0;
+
+    rtc->calendar = days_from_civil(2000, 1, 1) * SECONDS_PER_DAY;
+    rtc->weekday_offset = 0;
+    rtc->weekday_offset = (7 - weekday_on(floor_div(rtc->calendar, SECONDS_PER_DAY))) % 7; // The weekday counter starts at 0
+    rtc->unix_time = 0;
+    rtc->prescaler = 0;
+    rtc->timer_value = 0;
+    rtc->timer_phase = 0;
+
+    rtc->drift_ppm = 0;
+    rtc->synced_us = sim_clock_us();
+    rtc->tick_fraction = 0;
+
+    i2c_bus_attach(RV3028_I2C_ADDR, model_transfer, NULL);
+}
+
+void rv3028_model_set_time(int64_t seconds) {
+    catch_up();
+    rtc->calendar = seconds;
+    rtc->weekday_offset = 0;
+    rtc->unix_time = (uint32_t)seconds;
+    rtc->prescaler = 0;
+}
+
+void rv3028_model_set_drift_ppm(double ppm) {
+    catch_up();
+    rtc->drift_ppm = ppm;
+}
+
+bool rv3028_model_int_asserted(void) {
+    catch_up();
+    uint8_t status = rtc->registers[RV3028_STATUS_REG];
+    uint8_t control2 = rtc->registers[RV3028_CONTROL2_REG];
+    return ((status & RV3028_STATUS_AF) && (control2 & RV3028_CONTROL2_AIE)) ||
+           ((status & RV3028_STATUS_TF) && (control2 & RV3028_CONTROL2_TIE)) ||
+           ((status & RV3028_STATUS_UF) && (control2 & RV3028_CONTROL2_UIE));
+}
+
+uint64_t rv3028_model_next_interrupt_us(void) {
+    if (rv3028_model_int_asserted()) return rtc->synced_us;
+
+    uint64_t ticks = UINT64_MAX;
+    uint8_t control1 = rtc->registers[RV3028_CONTROL1_REG];
+    uint8_t control2 = rtc->registers[RV3028_CONTROL2_REG];
+    uint64_t to_next_second = OSC_HZ - rtc->prescaler;
+    if (control2 & RV3028_CONTROL2_UIE) {
+        uint64_t seconds = (control1 & RV3028_CONTROL1_USEL) ? 60 - (uint64_t)(rtc->calendar - floor_div(rtc->calendar, 60) * 60) : 1;
+        uint64_t candidate = (seconds - 1) * OSC_HZ + to_next_second;
+        if (candidate < ticks) ticks = candidate;
+    }
+    if (control2 & RV3028_CONTROL2_AIE) {
+        int64_t alarm = next_alarm(rtc->calendar);
+        if (alarm != INT64_MAX) {
+            uint64_t candidate = (uint64_t)(alarm - rtc->calendar - 1) * OSC_HZ + to_next_second;
+            if (candidate < ticks) ticks = candidate;
+        }
+    }
+    if ((control2 & RV3028_CONTROL2_TIE) && (control1 & RV3028_CONTROL1_TE) && rtc->timer_value > 0) {
+        uint64_t candidate = ticks_to_timer_zero();
+        if (candidate < ticks) ticks = candidate;
+    }
+    if (ticks == UINT64_MAX) return UINT64_MAX;
+
+    // Round up, and a microsecond more so the last tick has surely happened
+    double us = ((double)ticks - rtc->tick_fraction) / ticks_per_us();
+    return rtc->synced_us + (uint64_t)us + 2;
+}
+
+int64_t rv3028_model_calendar_time(void) {
+    catch_up();
+    return rtc->calendar;
+}
+
+uint32_t rv3028_model_eeprom_writes(void) {
+    return rtc->eeprom_writes;
+}
+
+size_t rv3028_model_state_size(void) {
+    return sizeof(rtc_state_t);
+}
+
+void rv3028_model_save(void* copy) {
+    catch_up();
+    memcpy(copy, rtc, sizeof(rtc_state_t));
+}
+
+void rv3028_model_restore(const void* copy) {
+    memcpy(rtc, copy, sizeof(rtc_state_t));
+    rtc->synced_us = sim_clock_us();
+    rtc->eeprom_busy_until_us = 0;
+}
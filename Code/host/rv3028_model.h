@@ -0,0 +1,48 @@
+#ifndef RV3028_MODEL_H
+#define RV3028_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A register-level model of the RV-3028 on the simulated I2C bus, for
+// running the driver on a host. It covers the calendar and UNIX counters,
+// the alarm, the countdown timer, the periodic update, the status flags and
+// INT, the user RAM and EEPROM, and the EEPROM commands with their busy time.
+// The oscillator runs off the simulation clock at a chosen error, trimmed by
+// the offset register as on the part. Time only moves when the simulation
+// clock does, so the model catches up whenever it is looked at.
+
+// Power the RTC up from scratch: 2000-01-01 00:00:00, the power-on reset
+// flag set, user EEPROM zeroed, and attached to the bus at RV3028_I2C_ADDR.
+void rv3028_model_init(void);
+
+// Set the calendar and the UNIX counter, as a board set up earlier would
+// have them, with the weekday to match and the second just starting
+void rv3028_model_set_time(int64_t seconds);
+
+// Oscillator error in ppm before the offset correction; positive runs fast
+void rv3028_model_set_drift_ppm(double ppm);
+
+// Whether INT is pulled low
+bool rv3028_model_int_asserted(void);
+
+// Simulation time at which INT is next pulled low with the registers as
+// they are, or UINT64_MAX if nothing enabled will pull it. Returns now if
+// it already is.
+uint64_t rv3028_model_next_interrupt_us(void);
+
+// The calendar registers as seconds since 1970, for checking the driver
+int64_t rv3028_model_calendar_time(void);
+
+// EEPROM bytes programmed since init, user and configuration alike
+uint32_t rv3028_model_eeprom_writes(void);
+
+// The whole state of the part, to put it back as it was for another run
+// from the same point. It carries on from the time it was saved at, and any
+// EEPROM write under way then has finished.
+size_t rv3028_model_state_size(void);
+void rv3028_model_save(void* copy);
+void rv3028_model_restore(const void* copy);
+
+#endif // RV3028_MODEL_H
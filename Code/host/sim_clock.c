@@ -0,0 +1,48 @@
+#include "sim_clock.h"
+#include "sim_shared.h"
+#include "pico/stdlib.h"
+
+// Shared, so time a forked child spends counts for the harness too. It is
+// taken on first use, which has to come before the first fork.
+static uint64_t* now_us;
+
+// When this process's board powered up, for the SDK's time since boot
+static uint64_t power_up_us = 0;
+
+static uint64_t* now(void) {
+    if (now_us == NULL) now_us = sim_shared_alloc(sizeof(uint64_t));
+    return now_us;
+}
+
+uint64_t sim_clock_us(void) {
+    return *now();
+}
+
+void sim_clock_advance(uint64_t us) {
+    *now() += us;
+}
+
+void sim_clock_advance_to(uint64_t us) {
+    if (us > *now()) *now() = us;
+}
+
+void sim_clock_power_up(void) {
+    power_up_us = sim_clock_us();
+}
+
+// Pico SDK time functions
+uint64_t time_us_64(void) {
+    return sim_clock_us() - power_up_us;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+void sleep_us(uint64_t us) {
+    sim_clock_advance(us);
+}
+
+void sleep_ms(uint32_t ms) {
+    sim_clock_advance((uint64_t)ms * 1000);
+}
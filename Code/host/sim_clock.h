@@ -0,0 +1,23 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <stdint.h>
+
+// Virtual time for host builds, in microseconds since the simulated board
+// powered up. Only the simulation moves it: sleeps and bus transfers add
+// what they would take on the board, and a harness can jump straight to
+// the next event, so years pass in however long the events take to handle.
+
+uint64_t sim_clock_us(void);
+
+// Move time forward by us
+void sim_clock_advance(uint64_t us);
+
+// Move time forward to at least us; earlier times are ignored
+void sim_clock_advance_to(uint64_t us);
+
+// Start the SDK's time since boot from now, in a process that has just
+// powered the board up. The simulation clock itself carries on.
+void sim_clock_power_up(void);
+
+#endif // SIM_CLOCK_H
@@ -0,0 +1,13 @@
+#include "sim_shared.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+void* sim_shared_alloc(size_t size) {
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("sim_shared_alloc");
+        exit(1);
+    }
+    return memory;
+}
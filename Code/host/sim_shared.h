@@ -0,0 +1,12 @@
+#ifndef SIM_SHARED_H
+#define SIM_SHARED_H
+
+#include <stddef.h>
+
+// Zeroed memory that stays shared with children forked after it is taken.
+// The simulated hardware keeps its state here, so a harness can run each
+// power-up of the board in a child of its own: the firmware starts from
+// fresh RAM every time while the flash, the RTC and the clock carry on.
+void* sim_shared_alloc(size_t size);
+
+#endif // SIM_SHARED_H
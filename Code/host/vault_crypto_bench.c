@@ -0,0 +1,114 @@
+// Times vault_crypto.c on the development machine over chunk-sized buffers,
+// as the vault uses it: encrypting a new chunk, which also feeds the MAC;
+// the keystream alone and the MAC alone, which a restore runs separately;
+// and a chunk fingerprint. The times are the host's, not the RP2040's; they
+// are for comparing changes to the cipher code, not for sizing the board.
+//
+// Usage: vault_crypto_bench [-n megabytes]
+
+#include "vault_crypto.h"
+#include "vault_dedup.h"
+#include "rv3028.h"
+#include "rv3028_model.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+    PASS_ENCRYPT,
+    PASS_XOR,
+    PASS_AUTHENTICATE
+} pass_t;
+
+static uint8_t chunk[VAULT_CHUNK_MAX];
+
+static double now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec * 1e9 + (double)time.tv_nsec;
+}
+
+// MB/s over one cipher per chunk, best of five runs so a preemption does
+// not count
+static double time_pass(pass_t pass, long chunks, uint32_t* checksum) {
+    static const uint8_t nonce[VAULT_NONCE_SIZE] = {0};
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        double start = now_ns();
+        for (long i = 0; i < chunks; i++) {
+            vault_cipher_t cipher;
+            uint8_t tag[VAULT_TAG_SIZE];
+            vault_cipher_begin(&cipher, nonce);
+            switch (pass) {
+                case PASS_ENCRYPT: vault_cipher_encrypt(&cipher, chunk, sizeof(chunk)); break;
+                case PASS_XOR: vault_cipher_xor(&cipher, chunk, sizeof(chunk)); break;
+                case PASS_AUTHENTICATE: vault_cipher_authenticate(&cipher, chunk, sizeof(chunk)); break;
+            }
+            vault_cipher_finish(&cipher, tag);
+            *checksum += tag[0] + chunk[i % sizeof(chunk)];
+        }
+        double mb_per_s = (double)chunks * sizeof(chunk) / ((now_ns() - start) / 1e3);
+        if (mb_per_s > best) best = mb_per_s;
+    }
+    return best;
+}
+
+// Nanoseconds per fingerprint, best of five runs
+static double time_fingerprint(long rounds, uint32_t* checksum) {
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        double start = now_ns();
+        for (long i = 0; i < rounds; i++) {
+            uint32_t input[3] = {(uint32_t)i, 0x1000, (uint32_t)i * 0x9E3779B9u};
+            uint32_t fingerprint[2];
+            vault_crypto_fingerprint(input, fingerprint);
+            *checksum += fingerprint[0];
+        }
+        double ns = (now_ns() - start) / (double)rounds;
+        if (run == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    long megabytes = 64;
+    int option;
+    while ((option = getopt(argc, argv, "n:")) != -1) {
+        switch (option) {
+            case 'n': megabytes = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n megabytes]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (megabytes < 1) {
+        fprintf(stderr, "Need at least one megabyte\n");
+        return 2;
+    }
+
+    // A blank user EEPROM makes vault_crypto_init() generate a key
+    rv3028_model_init();
+    i2c_async_init(RV3028_I2C_PORT, RV3028_I2C_BAUDRATE);
+    if (!vault_crypto_init()) {
+        fprintf(stderr, "Could not load a key\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(chunk); i++) chunk[i] = (uint8_t)(i * 7);
+
+    long chunks = megabytes * 1024 * 1024 / (long)sizeof(chunk);
+    uint32_t checksum = 0;
+    double encrypt = time_pass(PASS_ENCRYPT, chunks, &checksum);
+    double xor_only = time_pass(PASS_XOR, chunks, &checksum);
+    double authenticate = time_pass(PASS_AUTHENTICATE, chunks, &checksum);
+    double fingerprint = time_fingerprint(chunks * 16, &checksum);
+    printf("ChaCha20-Poly1305 over %ld MB in %zu-byte chunks:\n", megabytes, sizeof(chunk));
+    printf("  encrypt and MAC  %7.1f MB/s\n", encrypt);
+    printf("  ChaCha20 alone   %7.1f MB/s\n", xor_only);
+    printf("  Poly1305 alone   %7.1f MB/s\n", authenticate);
+    printf("  fingerprint      %7.1f ns\n", fingerprint);
+    printf("  (checksum %" PRIu32 ")\n", checksum);
+    return 0;
+}
@@ -0,0 +1,130 @@
+// Checks vault_crypto.c against the ChaCha20-Poly1305 AEAD test vector in
+// RFC 8439 section 2.8.2: the ciphertext and tag in one call and in pieces
+// that split blocks at every boundary the buffers have, decryption back to
+// the plaintext, and a tag that fails once a bit of the ciphertext or the
+// associated data is flipped. The key is loaded from the RTC model's user
+// EEPROM, the way the firmware loads it. It is built with ASan and UBSan.
+//
+// Usage: vault_crypto_vectors
+
+#include "vault_crypto.h"
+#include "rv3028.h"
+#include "rv3028_model.h"
+#include <stdio.h>
+#include <string.h>
+
+static const uint8_t key[VAULT_KEY_SIZE] = {
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+};
+
+static const uint8_t nonce[VAULT_NONCE_SIZE] = {
+    0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+};
+
+static const uint8_t aad[] = {
+    0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+};
+
+static const char plaintext[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+#define TEXT_SIZE (sizeof(plaintext) - 1)
+
+static const uint8_t ciphertext[TEXT_SIZE] = {
+    0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+    0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+    0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+    0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+    0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+    0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+    0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+    0x61, 0x16,
+};
+
+static const uint8_t tag[VAULT_TAG_SIZE] = {
+    0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91,
+};
+
+// Piece lengths adding up to the plaintext, crossing the 16-byte MAC blocks
+// and the 64-byte keystream blocks at different offsets
+static const size_t pieces[] = {1, 15, 16, 17, 1, 63, 1};
+
+static int check(const char* name, bool passed) {
+    printf("  %-46s %s\n", name, passed ? "ok" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+static int check_encrypt(void) {
+    int failures = 0;
+    vault_cipher_t cipher;
+    uint8_t data[TEXT_SIZE];
+    uint8_t computed[VAULT_TAG_SIZE];
+
+    memcpy(data, plaintext, TEXT_SIZE);
+    vault_cipher_begin(&cipher, nonce);
+    vault_cipher_associate(&cipher, aad, sizeof(aad));
+    vault_cipher_encrypt(&cipher, data, TEXT_SIZE);
+    vault_cipher_finish(&cipher, computed);
+    failures += check("Encrypt, one call: ciphertext", memcmp(data, ciphertext, TEXT_SIZE) == 0);
+    failures += check("Encrypt, one call: tag", memcmp(computed, tag, VAULT_TAG_SIZE) == 0);
+
+    memcpy(data, plaintext, TEXT_SIZE);
+    vault_cipher_begin(&cipher, nonce);
+    vault_cipher_associate(&cipher, aad, sizeof(aad));
+    size_t done = 0;
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        vault_cipher_encrypt(&cipher, data + done, pieces[i]);
+        done += pieces[i];
+    }
+    vault_cipher_finish(&cipher, computed);
+    failures += check("Encrypt, in pieces: ciphertext", done == TEXT_SIZE && memcmp(data, ciphertext, TEXT_SIZE) == 0);
+    failures += check("Encrypt, in pieces: tag", memcmp(computed, tag, VAULT_TAG_SIZE) == 0);
+    return failures;
+}
+
+// Authenticate the ciphertext as the restore path does, then decrypt it
+static bool decrypt(const uint8_t* associated, const uint8_t* text, uint8_t* data) {
+    vault_cipher_t cipher;
+    memcpy(data, text, TEXT_SIZE);
+    vault_cipher_begin(&cipher, nonce);
+    vault_cipher_associate(&cipher, associated, sizeof(aad));
+    vault_cipher_authenticate(&cipher, data, TEXT_SIZE);
+    vault_cipher_xor(&cipher, data, TEXT_SIZE);
+    return vault_cipher_verify(&cipher, tag);
+}
+
+static int check_decrypt(void) {
+    int failures = 0;
+    uint8_t data[TEXT_SIZE];
+    bool verified = decrypt(aad, ciphertext, data);
+    failures += check("Decrypt: tag verified", verified);
+    failures += check("Decrypt: plaintext", memcmp(data, plaintext, TEXT_SIZE) == 0);
+
+    uint8_t damaged[TEXT_SIZE];
+    memcpy(damaged, ciphertext, TEXT_SIZE);
+    damaged[TEXT_SIZE / 2] ^= 0x01;
+    failures += check("Decrypt, ciphertext bit flipped: rejected", !decrypt(aad, damaged, data));
+
+    uint8_t damaged_aad[sizeof(aad)];
+    memcpy(damaged_aad, aad, sizeof(aad));
+    damaged_aad[0] ^= 0x80;
+    failures += check("Decrypt, associated data bit flipped: rejected", !decrypt(damaged_aad, ciphertext, data));
+    return failures;
+}
+
+int main(void) {
+    rv3028_model_init();
+    i2c_async_init(RV3028_I2C_PORT, RV3028_I2C_BAUDRATE);
+
+    // The key goes at the start of the user EEPROM, where vault_crypto.c reads it
+    if (rv3028_write_user_eeprom(0x00, key, sizeof(key)) != RV3028_SUCCESS || !vault_crypto_init()) {
+        printf("Could not load the test key\n");
+        return 1;
+    }
+
+    printf("RFC 8439 section 2.8.2, AEAD_CHACHA20_POLY1305:\n");
+    int failures = check_encrypt();
+    failures += check_decrypt();
+    return failures == 0 ? 0 : 1;
+}
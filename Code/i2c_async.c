@@ -0,0 +1,178 @@
+#include "i2c_async.h"
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#define TRANSFER_TIMEOUT_US 10000 // 24 bytes take under 3 ms even at 100 kHz
+#define TX_DMA_LEVEL 8            // Refill the 16-entry TX FIFO once it is half empty
+#define RX_DRAIN_SPINS 100        // The last byte reaches RAM a few cycles after the stop
+
+static i2c_inst_t* bus;
+static int tx_channel = -1;
+static int rx_channel = -1;
+
+// The transfer on the bus and the ones waiting behind it
+static i2c_async_transfer_t* volatile current = NULL;
+static i2c_async_transfer_t* queue_head = NULL;
+static i2c_async_transfer_t* queue_tail = NULL;
+static bool current_aborted;
+static uint64_t current_start_us;
+
+// Each byte is one 16-bit DATA_CMD entry: data to write, or a read command
+// with the restart and stop bits placed where the transfer needs them
+static uint16_t commands[I2C_ASYNC_MAX_BYTES];
+
+static void start_next(void) {
+    i2c_async_transfer_t* transfer = queue_head;
+    if (transfer == NULL) return;
+    queue_head = transfer->next;
+    if (queue_head == NULL) queue_tail = NULL;
+
+    size_t count = 0;
+    for (size_t i = 0; i < transfer->write_len; i++) {
+        commands[count++] = transfer->write_data[i];
+    }
+    for (size_t i = 0; i < transfer->read_len; i++) {
+        commands[count++] = I2C_IC_DATA_CMD_CMD_BITS |
+                            (i == 0 && transfer->write_len > 0 ? I2C_IC_DATA_CMD_RESTART_BITS : 0);
+    }
+    commands[count - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+
+    i2c_hw_t* hw = i2c_get_hw(bus);
+    hw->enable = 0;
+    hw->tar = transfer->address;
+    hw->enable = I2C_IC_ENABLE_ENABLE_BITS;
+    (void)hw->clr_intr;
+
+    current = transfer;
+    current_aborted = false;
+    current_start_us = time_us_64();
+
+    // Reads are armed first so no byte arrives before its channel is listening
+    if (transfer->read_len > 0) {
+        dma_channel_config config = dma_channel_get_default_config(rx_channel);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_dreq(&config, i2c_get_dreq(bus, false));
+        dma_channel_configure(rx_channel, &config, transfer->read_data, &hw->data_cmd, transfer->read_len, true);
+    }
+
+    dma_channel_config config = dma_channel_get_default_config(tx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, i2c_get_dreq(bus, true));
+    dma_channel_configure(tx_channel, &config, &hw->data_cmd, commands, count, true);
+}
+
+// Runs with interrupts off, from the IRQ or from a poll that found the bus stuck
+static void finish_current(bool ok) {
+    i2c_async_transfer_t* transfer = current;
+    current = NULL;
+
+    if (!ok) {
+        // Stop feeding the bus and flush whatever is left in the FIFOs
+        dma_channel_abort(tx_channel);
+        dma_channel_abort(rx_channel);
+        i2c_get_hw(bus)->enable = 0;
+    }
+
+    i2c_async_callback_t callback = transfer->callback;
+    transfer->ok = ok;
+    transfer->done = true;
+    if (callback) callback(transfer);
+
+    // The callback may already have queued and started another transfer
+    if (current == NULL) start_next();
+}
+
+// A transfer ends with a stop condition whether it succeeded or was aborted,
+// for example by a NACK, so the stop is where it completes.
+static void i2c_async_irq_handler(void) {
+    i2c_hw_t* hw = i2c_get_hw(bus);
+    uint32_t status = hw->intr_stat;
+
+    if (status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        // Stop the TX channel before clearing the abort releases the FIFO,
+        // or the rest of the commands would start a new transaction
+        dma_channel_abort(tx_channel);
+        dma_channel_abort(rx_channel);
+        (void)hw->clr_tx_abrt;
+        current_aborted = true;
+    }
+    if (status & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        if (current == NULL) return;
+
+        if (!current_aborted) {
+            for (int spin = 0; spin < RX_DRAIN_SPINS && dma_channel_is_busy(rx_channel); spin++) {
+                tight_loop_contents();
+            }
+            if (dma_channel_is_busy(rx_channel)) current_aborted = true;
+        }
+        finish_current(!current_aborted);
+    }
+}
+
+uint i2c_async_init(i2c_inst_t* i2c, uint baudrate) {
+    bus = i2c;
+    uint actual = i2c_init(i2c, baudrate);
+
+    if (tx_channel < 0) {
+        tx_channel = dma_claim_unused_channel(true);
+        rx_channel = dma_claim_unused_channel(true);
+    }
+
+    i2c_hw_t* hw = i2c_get_hw(i2c);
+    hw->dma_cr = I2C_IC_DMA_CR_TDMAE_BITS | I2C_IC_DMA_CR_RDMAE_BITS;
+    hw->dma_tdlr = TX_DMA_LEVEL;
+    hw->dma_rdlr = 0; // A request for every byte received
+    hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+
+    uint irq = I2C0_IRQ + i2c_hw_index(i2c);
+    irq_set_exclusive_handler(irq, i2c_async_irq_handler);
+    irq_set_enabled(irq, true);
+    return actual;
+}
+
+bool i2c_async_submit(i2c_async_transfer_t* transfer) {
+    size_t length = transfer->write_len + transfer->read_len;
+    if (length == 0 || length > I2C_ASYNC_MAX_BYTES) return false;
+
+    transfer->done = false;
+    transfer->ok = false;
+    transfer->next = NULL;
+
+    uint32_t interrupts = save_and_disable_interrupts();
+    if (queue_tail) {
+        queue_tail->next = transfer;
+    } else {
+        queue_head = transfer;
+    }
+    queue_tail = transfer;
+    if (current == NULL) start_next();
+    restore_interrupts(interrupts);
+    return true;
+}
+
+bool i2c_async_poll(i2c_async_transfer_t* transfer) {
+    if (transfer->done) return true;
+
+    // A device holding the bus, or an abort without a stop, never raises the
+    // interrupt, so give up on the transfer and let the next one try
+    uint32_t interrupts = save_and_disable_interrupts();
+    if (current != NULL && time_us_64() - current_start_us > TRANSFER_TIMEOUT_US) {
+        finish_current(false);
+    }
+    restore_interrupts(interrupts);
+    return transfer->done;
+}
+
+bool i2c_async_wait(i2c_async_transfer_t* transfer) {
+    while (!i2c_async_poll(transfer)) {
+        tight_loop_contents();
+    }
+    return transfer->ok;
+}
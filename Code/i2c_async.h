@@ -0,0 +1,51 @@
+#ifndef I2C_ASYNC_H
+#define I2C_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/i2c.h"
+
+// Longest transfer, counting both the bytes written and the bytes read: a
+// register address and the RTC snapshot burst
+#define I2C_ASYNC_MAX_BYTES 32
+
+struct i2c_async_transfer;
+
+// Called from the I2C interrupt once a transfer has finished.
+typedef void (*i2c_async_callback_t)(struct i2c_async_transfer* transfer);
+
+// One transaction: write_len bytes, then, after a repeated start, read_len
+// bytes. Either part may be empty but not both. The caller owns the struct
+// and its buffers until the transfer is done.
+typedef struct i2c_async_transfer {
+    uint8_t address;
+    const uint8_t* write_data;
+    size_t write_len;
+    uint8_t* read_data;
+    size_t read_len;
+    i2c_async_callback_t callback; // May be NULL
+    void* context;
+
+    // Set by the engine
+    volatile bool done;
+    volatile bool ok;
+    struct i2c_async_transfer* next;
+} i2c_async_transfer_t;
+
+// Set up the bus at baudrate and claim the DMA channels that feed it.
+// Returns the baudrate actually set.
+uint i2c_async_init(i2c_inst_t* i2c, uint baudrate);
+
+// Queue a transfer. It starts straight away if the bus is idle, otherwise
+// once the ones ahead of it finish. Returns false if it is too long.
+bool i2c_async_submit(i2c_async_transfer_t* transfer);
+
+// Returns true once the transfer has finished, failing the transfer on the
+// bus if it has stalled. Call it from the main loop rather than an interrupt.
+bool i2c_async_poll(i2c_async_transfer_t* transfer);
+
+// Wait for a transfer to finish and return whether it succeeded.
+bool i2c_async_wait(i2c_async_transfer_t* transfer);
+
+#endif // I2C_ASYNC_H
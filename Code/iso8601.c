@@ -0,0 +1,86 @@
+#include "iso8601.h"
+#include "rv3028.h"
+#include <time.h>
+
+#define MAX_OFFSET_HOURS 14 // UTC+14 is the furthest any zone reaches
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Read exactly count digits and advance past them.
+static bool read_number(const char** cursor, int count, int* value) {
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        char c = (*cursor)[i];
+        if (!is_digit(c)) return false;
+        result = result * 10 + (c - '0');
+    }
+    *cursor += count;
+    *value = result;
+    return true;
+}
+
+static bool skip(const char** cursor, char separator) {
+    if (**cursor != separator) return false;
+    (*cursor)++;
+    return true;
+}
+
+static int days_in_month(int year, int month) {
+    static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return (month == 2 && leap) ? 29 : days[month - 1];
+}
+
+bool iso8601_parse(const char* text, int64_t* epoch) {
+    const char* cursor = text;
+    int year, month, day;
+    int hour = 0, minute = 0, second = 0;
+    int offset_seconds = 0;
+
+    // Date, with both dashes or neither
+    if (!read_number(&cursor, 4, &year)) return false;
+    bool extended = skip(&cursor, '-');
+    if (!read_number(&cursor, 2, &month)) return false;
+    if (extended && !skip(&cursor, '-')) return false;
+    if (!read_number(&cursor, 2, &day)) return false;
+    if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)) return false;
+
+    // A T only starts a time if a digit follows; otherwise the date simply
+    // ends there, as in 2030-01-01Trip.txt
+    if ((*cursor == 'T' || *cursor == 't') && is_digit(cursor[1])) {
+        cursor++;
+        if (!read_number(&cursor, 2, &hour)) return false;
+        bool colon = skip(&cursor, ':');
+        if (!read_number(&cursor, 2, &minute)) return false;
+        if (colon ? skip(&cursor, ':') : is_digit(*cursor)) {
+            if (!read_number(&cursor, 2, &second)) return false;
+        }
+        if (hour > 23 || minute > 59 || second > 59) return false;
+
+        // The zone can only follow a time, and like the T a sign only
+        // starts one if a digit follows
+        if (*cursor == 'Z' || *cursor == 'z') {
+            cursor++;
+        } else if ((*cursor == '+' || *cursor == '-') && is_digit(cursor[1])) {
+            int sign = (*cursor++ == '-') ? -1 : 1;
+            int offset_hours, offset_minutes = 0;
+            if (!read_number(&cursor, 2, &offset_hours)) return false;
+            if (skip(&cursor, ':') || is_digit(*cursor)) {
+                if (!read_number(&cursor, 2, &offset_minutes)) return false;
+            }
+            if (offset_hours > MAX_OFFSET_HOURS || offset_minutes > 59) return false;
+            offset_seconds = sign * (offset_hours * 3600 + offset_minutes * 60);
+        }
+    }
+
+    if (is_digit(*cursor)) return false;
+
+    struct tm date = {
+        .tm_sec = second, .tm_min = minute, .tm_hour = hour,
+        .tm_mday = day, .tm_mon = month - 1, .tm_year = year - 1900
+    };
+    *epoch = rv3028_tm_to_epoch(&date) - offset_seconds;
+    return true;
+}
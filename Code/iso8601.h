@@ -0,0 +1,19 @@
+#ifndef ISO8601_H
+#define ISO8601_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Parse the ISO-8601 date a capsule's filename starts with:
+//
+//   YYYY-MM-DD[THH:MM[:SS]][Z|+HH:MM|-HH:MM]
+//
+// FAT names cannot hold colons, so they may be left out of the time and
+// offset (2030-01-01T0930+0100), and the basic date form YYYYMMDD is
+// accepted too. A date without an offset is in the RTC's own time. The date
+// must be followed by the end of the string or anything but a digit.
+// Returns false for anything malformed or a day that does not exist;
+// otherwise stores the time in seconds since 1970.
+bool iso8601_parse(const char* text, int64_t* epoch);
+
+#endif // ISO8601_H
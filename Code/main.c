@@ -1,5 +1,4 @@
 #include <stdio.h>
-#include <string.h>
 
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
@@ -8,44 +7,47 @@
 
 #include <time.h>
 #include "rv3028.h"
+#include "i2c_async.h"
 #include "fs_manager.h"
-
-#define FLASH_TARGET_BASE_ADDR (XIP_BASE)
-#define FLASH_FILESYSTEM_OFFSET (2 * 1024 * 1024)
-
-const uint32_t FLASH_TOTAL_SIZE = 16 * 1024 * 1024;
-const uint32_t DISK_SIZE = FLASH_TOTAL_SIZE - FLASH_FILESYSTEM_OFFSET;
+#include "flash_disk.h"
+#include "wake_scheduler.h"
+#include "boot_cache.h"
+#include "trace.h"
+#if RTC_CALIBRATION
+#include "rtc_calibration.h"
+#endif
 
 void tud_msc_capability_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
-    *block_size = 512;
-    *block_count = DISK_SIZE / *block_size;
+    *block_size = FLASH_DISK_BLOCK_SIZE;
+    *block_count = flash_disk_block_count();
+}
+
+// After the vault and disk are rebalanced, report a medium change once so
+// the host re-reads the capacity and boot sector.
+bool tud_msc_test_unit_ready_cb(uint8_t lun) {
+    if (flash_disk_take_media_change()) {
+        tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+        return false;
+    }
+    return true;
 }
 
 int32_t tud_msc_read_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
-    const uint32_t flash_addr = FLASH_TARGET_BASE_ADDR + FLASH_FILESYSTEM_OFFSET + (lba * 512);
-    flash_read(flash_addr, buffer, bufsize);
+    TRACE_BEGIN(TRACE_MSC_READ, lba);
+    flash_disk_read(lba, offset, buffer, bufsize);
+    TRACE_END(TRACE_MSC_READ, lba);
     return bufsize;
 }
 
-static uint8_t sector_buffer[FLASH_SECTOR_SIZE];
 int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
-    uint32_t block_addr_in_flash = FLASH_FILESYSTEM_OFFSET + (lba * 512);
-    uint32_t sector_addr_in_flash = block_addr_in_flash & ~(FLASH_SECTOR_SIZE - 1);
-    flash_read(FLASH_TARGET_BASE_ADDR + sector_addr_in_flash, sector_buffer, FLASH_SECTOR_SIZE);
-    
-    uint32_t offset_in_sector = block_addr_in_flash - sector_addr_in_flash;
-    memcpy(sector_buffer + offset_in_sector, buffer, bufsize);
-
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(sector_addr_in_flash, FLASH_SECTOR_SIZE);
-    flash_range_program(sector_addr_in_flash, sector_buffer, FLASH_SECTOR_SIZE);
-    restore_interrupts(ints);
-
-    return bufsize;
+    TRACE_BEGIN(TRACE_MSC_WRITE, lba);
+    bool ok = flash_disk_host_write(lba, offset, buffer, bufsize);
+    TRACE_END(TRACE_MSC_WRITE, lba);
+    return ok ? (int32_t)bufsize : -1;
 }
 
 void setup_rtc(void) {
-    i2c_init(RV3028_I2C_PORT, 100 * 1000);
+    i2c_async_init(RV3028_I2C_PORT, RV3028_I2C_BAUDRATE);
     gpio_set_function(4, GPIO_FUNC_I2C); // Corrected I2C pins
     gpio_set_function(5, GPIO_FUNC_I2C);
     gpio_pull_up(4);
@@ -60,103 +62,266 @@ void setup_rtc(void) {
     struct tm current_time;
     rv3028_get_current_time(&current_time);
 
-    if (current_time.tm_year < 123) { // Check if RTC year < 2023
+    // A clock behind the build has lost its time, so start it from the build
+    if (rv3028_tm_to_epoch(&current_time) < TIMECAPSULE_BUILD_EPOCH) {
         printf("Setting RTC to compile time...\n");
-        char s_month[5];
-        int month, day, year, hour, min, sec;
-        static const char month_names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
-        sscanf(__DATE__, "%s %d %d", s_month, &day, &year);
-        sscanf(__TIME__, "%d:%d:%d", &hour, &min, &sec);
-        month = (strstr(month_names, s_month) - month_names) / 3;
-
-        struct tm compile_time = { .tm_sec = sec, .tm_min = min, .tm_hour = hour, .tm_mday = day, .tm_mon = month, .tm_year = year - 1900 };
+        time_t build_time = TIMECAPSULE_BUILD_EPOCH;
+        struct tm compile_time;
+        gmtime_r(&build_time, &compile_time);
         rv3028_set_current_time(&compile_time);
     }
+
+    // Unlock checks read the UNIX counter rather than the calendar
+    rv3028_sync_unix_time();
+}
+
+// An unlock time as the boot cache holds it
+static uint32_t cached_unlock(int64_t unlock_time) {
+    return (unlock_time < 0) ? 0 : (unlock_time >= BOOT_CACHE_NONE) ? BOOT_CACHE_NONE - 1 : (uint32_t)unlock_time;
+}
+
+// Mirror the next unlock time into the RTC, so the next wake can check it
+// without mounting anything.
+static void update_boot_cache(void) {
+    int64_t unlock_time;
+    uint32_t next_unlock = BOOT_CACHE_NONE;
+    if (fs_get_unlock_time(&unlock_time)) {
+        next_unlock = cached_unlock(unlock_time);
+    }
+    boot_cache_write(next_unlock, fs_vault_generation());
+}
+
+// True if the boot cache was taken at the mounted vault's generation. One
+// that missed a change may have let a wake power off, or armed the RTC for
+// the wrong capsule.
+static bool boot_cache_current(void) {
+    uint32_t next_unlock, generation;
+    if (!boot_cache_read(&next_unlock, &generation)) {
+        printf("Boot cache missing. Re-arming the wake.\n");
+        return false;
+    }
+    if (generation != fs_vault_generation()) {
+        printf("Boot cache is from vault generation %lu, vault is at %lu. Re-arming the wake.\n",
+               (unsigned long)generation, (unsigned long)fs_vault_generation());
+        return false;
+    }
+    return true;
+}
+
+// Arm the RTC for the capsule that unlocks first, or turn it off if there is none.
+static void schedule_next_wake(void) {
+    // The cache goes first: if power fails before the wake is armed, the old
+    // wake finds the new unlock time and does a full boot
+    update_boot_cache();
+
+    int64_t unlock_time;
+    if (fs_get_unlock_time(&unlock_time)) {
+        wake_schedule(unlock_time);
+    } else {
+        printf("No more locked files. Disabling alarm.\n");
+        wake_cancel();
+    }
+}
+
+// Set when a lock about to be committed moved the cache and the wake
+static bool lock_armed = false;
+
+// A capsule about to be locked that unlocks before the others gets the cache
+// and the wake first. A power cut before schedule_next_wake() then leaves
+// them early, which only costs a full boot, where otherwise the wake would
+// come after the new capsule's unlock.
+static void arm_for_lock(int64_t unlock_time) {
+    int64_t next_unlock;
+    if (fs_get_unlock_time(&next_unlock) && next_unlock <= unlock_time) return;
+    boot_cache_write(cached_unlock(unlock_time), fs_vault_generation());
+    wake_schedule(unlock_time);
+    lock_armed = true;
+}
+
+// The RTC's time for the main loop, read at most once a second
+static int64_t loop_time(void) {
+    static int64_t last_time = 0;
+    static uint64_t last_read_us = 0;
+    static bool have_time = false;
+
+    uint64_t now_us = time_us_64();
+    if (!have_time || now_us - last_read_us >= 1000000) {
+        uint32_t unix_time;
+        if (rv3028_get_unix_time(&unix_time) == RV3028_SUCCESS) {
+            last_time = unix_time;
+            last_read_us = now_us;
+            have_time = true;
+        }
+    }
+    return last_time + (int64_t)((now_us - last_read_us) / 1000000);
 }
 
 void check_and_process_files(void) {
-    bool is_alarm_triggered;
-    rv3028_check_alarm_flag(&is_alarm_triggered);
+    static bool first_check = true;
+    int64_t now;
+    int64_t unlock_time;
+    bool woken = wake_check(&now);
+
+    // The wake's flag is cleared before the capsule is moved, so if power
+    // failed in between, only the time shows a capsule is due
+    if (!woken && first_check && fs_get_unlock_time(&unlock_time) && loop_time() >= unlock_time) {
+        printf("Unlock missed while powered off.\n");
+        now = loop_time();
+        woken = true;
+    }
+    first_check = false;
 
-    if (is_alarm_triggered) {
+    if (woken) {
         printf("Alarm triggered! Checking for unlock.\n");
-        
-        // Clear the alarm flag first to avoid re-triggering
-        rv3028_clear_alarm_flag();
-
-        if (fs_is_file_in_private()) {
-            struct tm unlock_date, current_time;
-            fs_get_unlock_date(&unlock_date);
-            rv3028_get_current_time(&current_time);
-
-            if (mktime(&current_time) >= mktime(&unlock_date)) {
-                printf("Unlock date reached! Moving file to public.\n");
-                fs_move_to_public();
-
-                // After unlocking, check for the next locked file and set a new alarm
-                if (fs_is_file_in_private()) {
-                    struct tm next_unlock_date;
-                    fs_get_unlock_date(&next_unlock_date);
-                    rv3028_set_alarm(&next_unlock_date);
-                    printf("Next alarm set for new file.\n");
-                } else {
-                    printf("No more locked files. Disabling alarm.\n");
-                    rv3028_disable_alarm_interrupt();
-                }
+
+        if (fs_get_unlock_time(&unlock_time)) {
+            if (now >= unlock_time) {
+                // Several capsules can fall due together; release each of them
+                do {
+                    printf("Unlock date reached! Moving file to public.\n");
+                    if (!fs_move_to_public()) break;
+                } while (fs_get_unlock_time(&unlock_time) && now >= unlock_time);
             }
         }
+
+        // An early wake only needs the next one set up
+        schedule_next_wake();
     }
 
-    // This part handles the initial locking of a new file
-    if (!fs_is_file_in_private()) {
+    // This part handles the locking of new files while the vault has room.
+    // A capsule just restored is dated in the past, which keeps it from
+    // being locked again before its owner can take it.
+    if (fs_has_free_slot()) {
         char filename[256];
-        if (fs_find_file_in_public(filename, sizeof(filename))) {
+        if (fs_find_file_in_public(loop_time(), filename, sizeof(filename))) {
             if (fs_is_file_stable(filename)) {
                 printf("New file found: %s. Moving to private.\n", filename);
-                fs_move_to_private(filename);
 
-                // Set alarm for the new file's unlock date
-                struct tm unlock_date;
-                fs_get_unlock_date(&unlock_date);
-                rv3028_set_alarm(&unlock_date);
-                printf("Alarm set for the new locked file.\n");
+                // The new file may be the one that unlocks first. A file that
+                // failed to lock changed nothing, so the RTC and its EEPROM
+                // are left alone unless they were armed for it.
+                lock_armed = false;
+                if (fs_move_to_private(filename) || lock_armed) schedule_next_wake();
             }
         }
     }
 }
 
+static void release_power_latch(void) {
+    // Temporarily take control of GPIO5
+    gpio_set_function(5, GPIO_FUNC_SIO);
+    gpio_set_dir(5, GPIO_OUT);
+
+    gpio_put(5, 1); // Drive GPIO5 high
+    sleep_ms(500);  // Keep it high for a moment
+    gpio_put(5, 0); // Drive GPIO5 low again
+
+    // Return GPIO5 to I2C function
+    gpio_set_function(5, GPIO_FUNC_I2C);
+    gpio_pull_up(5);
+}
+
 void check_and_disable_latch(void) {
-    struct tm current_time, unlock_date;
+    uint32_t now = 0;
+    int64_t unlock_time;
     
-    rv3028_get_current_time(&current_time);
+    rv3028_get_unix_time(&now);
 
-    if (fs_is_file_in_private() && fs_get_unlock_date(&unlock_date)) {
-        if (mktime(&current_time) >= mktime(&unlock_date)) {
+    if (fs_get_unlock_time(&unlock_time)) {
+        if (now >= unlock_time) {
             printf("Unlock date has passed. Disabling MOSFET latch.\n");
-
-            // Temporarily take control of GPIO5
-            gpio_set_function(5, GPIO_FUNC_SIO);
-            gpio_set_dir(5, GPIO_OUT);
-            
-            gpio_put(5, 1); // Drive GPIO5 high
-            sleep_ms(500);  // Keep it high for a moment
-            gpio_put(5, 0); // Drive GPIO5 low again
-
-            // Return GPIO5 to I2C function
-            gpio_set_function(5, GPIO_FUNC_I2C);
-            gpio_pull_up(5);
+            release_power_latch();
         }
     }
 }
 
+// A wake with nothing due is settled from the RTC alone: one burst for the
+// time and flags, and the boot cache for the next unlock. Returns false if
+// a full boot is needed to find out.
+static bool fast_boot(void) {
+    rv3028_snapshot_t snapshot;
+    uint32_t next_unlock, generation;
+    if (rv3028_read_snapshot(&snapshot) != RV3028_SUCCESS || !boot_cache_read(&next_unlock, &generation)) {
+        return false;
+    }
+
+    int64_t now = snapshot.unix_time;
+    if (next_unlock != BOOT_CACHE_NONE && now >= next_unlock) return false;
+
+    // Without an alarm or timer flag this is not a scheduled wake, so
+    // leave it to the full boot to find out why the board is on
+    if (!wake_acknowledge(&snapshot)) return false;
+    if (next_unlock == BOOT_CACHE_NONE) {
+        wake_cancel();
+    } else if (!wake_schedule(next_unlock)) {
+        return false;
+    }
+
+    printf("Nothing due (vault generation %lu). Powering off %lu us after wake.\n",
+           (unsigned long)generation, (unsigned long)time_us_32());
+    release_power_latch();
+    return true;
+}
+
+#if TRACE
+// A 't' sent over USB serial dumps the trace ring, for a timeline viewer
+static void poll_trace_request(void) {
+    if (getchar_timeout_us(0) == 't') trace_dump(stdout);
+}
+#endif
+
+#if LOOP_STATS
+// Every ten seconds, report how long a main loop iteration takes on average
+// and how many RTC transfers and bytes the loop made.
+static void report_loop_stats(void) {
+    static uint64_t window_start_us = 0;
+    static uint32_t window_start_transactions = 0;
+    static uint32_t window_start_bytes = 0;
+    static uint32_t iterations = 0;
+
+    iterations++;
+    uint64_t elapsed_us = time_us_64() - window_start_us;
+    if (elapsed_us < 10 * 1000000) return;
+
+    uint32_t transactions = rv3028_transaction_count();
+    uint32_t bytes = rv3028_byte_count();
+    printf("Main loop: %lu iterations, %lu us each, %lu RTC transfers, %lu bytes\n", (unsigned long)iterations,
+           (unsigned long)(elapsed_us / iterations), (unsigned long)(transactions - window_start_transactions),
+           (unsigned long)(bytes - window_start_bytes));
+    window_start_us += elapsed_us;
+    window_start_transactions = transactions;
+    window_start_bytes = bytes;
+    iterations = 0;
+}
+#endif
+
 int main(void) {
     board_init();
     stdio_init_all();
     printf("Pico Time Capsule Initializing...\n");
 
     setup_rtc();
+    wake_init();
+#if RTC_CALIBRATION
+    rtc_calibration_init();
+#endif
+
+    // Still running after the latch is released means USB is powering the
+    // board, so carry on with a full boot
+    fast_boot();
+
     fs_init();
     fs_mount_partitions();
+    fs_set_lock_handler(arm_for_lock);
+
+    // A capsule finished here may change which one unlocks first, and a
+    // stale cache may have armed the wrong wake
+    bool cache_current = boot_cache_current();
+    if (fs_resume_transfers() || !cache_current) {
+        schedule_next_wake();
+    } else {
+        update_boot_cache();
+    }
 
     check_and_disable_latch();
 
@@ -164,7 +329,17 @@ int main(void) {
 
     while (1) {
         tud_task();
+        fs_background_task();
         check_and_process_files();
+#if RTC_CALIBRATION
+        rtc_calibration_task();
+#endif
+#if TRACE
+        poll_trace_request();
+#endif
+#if LOOP_STATS
+        report_loop_stats();
+#endif
     }
 
     return 0;
@@ -0,0 +1,131 @@
+#include "partition.h"
+#include "pico/stdlib.h"
+#include "dma_crc.h"
+#include <stddef.h>
+#include <string.h>
+
+#define TABLE_MAGIC 0x4C425450 // "PTBL"
+#define TABLE_COPIES (PARTITION_TABLE_SIZE / FLASH_SECTOR_SIZE)
+
+#define DEFAULT_FIRMWARE_SIZE (2 * 1024 * 1024)
+#define DEFAULT_META_SIZE (104 * 1024)
+#define DEFAULT_VAULT_OFFSET (15 * 1024 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    partition_t partitions[PARTITION_TYPE_COUNT];
+    uint32_t crc; // CRC-32 of everything above
+} partition_table_t;
+
+static partition_table_t table;
+static uint32_t table_copy; // Copy the cached table was read from or last written to
+static bool legacy_layout;
+
+static const partition_table_t* copy_at(uint32_t copy) {
+    return (const partition_table_t*)(XIP_BASE + PARTITION_TABLE_OFFSET + copy * FLASH_SECTOR_SIZE);
+}
+
+static uint32_t table_crc(const partition_table_t* t) {
+    return dma_crc32(t, NULL, offsetof(partition_table_t, crc));
+}
+
+// Partitions must be in order, adjacent and end where the table begins.
+static bool is_valid_table(const partition_table_t* t) {
+    if (t->magic != TABLE_MAGIC || t->crc != table_crc(t)) return false;
+
+    uint32_t end = 0;
+    for (int type = 0; type < PARTITION_TYPE_COUNT; type++) {
+        const partition_t* p = &t->partitions[type];
+        if (p->offset != end || p->size % FLASH_SECTOR_SIZE) return false;
+        end = p->offset + p->size;
+    }
+    return end == PARTITION_TABLE_OFFSET;
+}
+
+static void set_default_table(void) {
+    memset(&table, 0, sizeof(table));
+    table.magic = TABLE_MAGIC;
+    table.partitions[PARTITION_FIRMWARE] = (partition_t){ 0, DEFAULT_FIRMWARE_SIZE };
+    table.partitions[PARTITION_DISK] = (partition_t){ DEFAULT_FIRMWARE_SIZE, DEFAULT_VAULT_OFFSET - DEFAULT_FIRMWARE_SIZE };
+    table.partitions[PARTITION_VAULT] = (partition_t){ DEFAULT_VAULT_OFFSET, PARTITION_TABLE_OFFSET - DEFAULT_META_SIZE - DEFAULT_VAULT_OFFSET };
+    table.partitions[PARTITION_META] = (partition_t){ PARTITION_TABLE_OFFSET - DEFAULT_META_SIZE, DEFAULT_META_SIZE };
+}
+
+// Write the cached table over the older copy.
+static bool write_table(void) {
+    if (legacy_layout) return false;
+
+    uint32_t copy = (table_copy + 1) % TABLE_COPIES;
+    table.sequence++;
+    table.crc = table_crc(&table);
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &table, sizeof(table));
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(PARTITION_TABLE_OFFSET + copy * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    flash_range_program(PARTITION_TABLE_OFFSET + copy * FLASH_SECTOR_SIZE, page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+
+    if (!is_valid_table(copy_at(copy))) {
+        printf("Partition table write failed\n");
+        return false;
+    }
+    table_copy = copy;
+    return true;
+}
+
+bool partition_init(void) {
+    bool found = false;
+    for (uint32_t copy = 0; copy < TABLE_COPIES; copy++) {
+        const partition_table_t* t = copy_at(copy);
+        if (!is_valid_table(t)) continue;
+        if (!found || (int32_t)(t->sequence - table.sequence) > 0) {
+            table = *t;
+            table_copy = copy;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        printf("No partition table; using the default layout\n");
+        set_default_table();
+        table_copy = TABLE_COPIES - 1;
+    }
+    return found;
+}
+
+bool partition_save(void) {
+    return write_table();
+}
+
+void partition_use_legacy_layout(void) {
+    set_default_table();
+    table.partitions[PARTITION_DISK].size = FLASH_TOTAL_SIZE - DEFAULT_FIRMWARE_SIZE;
+    table.partitions[PARTITION_VAULT] = (partition_t){ FLASH_TOTAL_SIZE, 0 };
+    table.partitions[PARTITION_META] = (partition_t){ FLASH_TOTAL_SIZE, 0 };
+    legacy_layout = true;
+}
+
+const partition_t* partition_get(partition_type_t type) {
+    return &table.partitions[type];
+}
+
+bool partition_set_vault_offset(uint32_t offset) {
+    partition_t* disk = &table.partitions[PARTITION_DISK];
+    partition_t* vault = &table.partitions[PARTITION_VAULT];
+    uint32_t vault_end = vault->offset + vault->size;
+    if (offset % FLASH_SECTOR_SIZE || offset <= disk->offset || offset >= vault_end) return false;
+
+    partition_table_t previous = table;
+    disk->size = offset - disk->offset;
+    vault->offset = offset;
+    vault->size = vault_end - offset;
+    if (!write_table()) {
+        table = previous;
+        return false;
+    }
+    return true;
+}
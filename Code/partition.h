@@ -0,0 +1,47 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/flash.h"
+
+// The flash is split into typed partitions described by a small table kept
+// in the last two sectors, written alternately so an interrupted update
+// leaves the previous table intact. The disk and the vault are adjacent and
+// the boundary between them moves as capsules come and go.
+#define FLASH_TOTAL_SIZE (16 * 1024 * 1024)
+#define PARTITION_TABLE_SIZE (2 * FLASH_SECTOR_SIZE)
+#define PARTITION_TABLE_OFFSET (FLASH_TOTAL_SIZE - PARTITION_TABLE_SIZE)
+
+typedef enum {
+    PARTITION_FIRMWARE = 0,
+    PARTITION_DISK,        // Public FAT volume, exposed over USB
+    PARTITION_VAULT,       // Chunk store for locked capsules, grows down towards the disk
+    PARTITION_META,        // Vault journal, capsule headers and chunk index
+    PARTITION_TYPE_COUNT
+} partition_type_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} partition_t;
+
+// Load the newest valid table. Without one the default layout is cached but
+// not written, so the caller can first clear what is in its way, and false is
+// returned.
+bool partition_init(void);
+
+// Write the cached default layout, for a table partition_init() did not find.
+bool partition_save(void);
+
+// Cache the layout from before there was a table instead: the disk runs to
+// the end of flash and there is no vault. It is never written.
+void partition_use_legacy_layout(void);
+
+// The cached partition of the given type.
+const partition_t* partition_get(partition_type_t type);
+
+// Move the boundary between the disk and the vault and persist the table.
+bool partition_set_vault_offset(uint32_t offset);
+
+#endif // PARTITION_H
@@ -0,0 +1,193 @@
+#include "rtc_calibration.h"
+#include "rv3028.h"
+#include "wake_scheduler.h"
+#include "pico/stdlib.h"
+#include "hardware/structs/usb.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if WAKE_INT_GPIO < 0
+#error "RTC calibration needs the RTC's INT output wired to WAKE_INT_GPIO"
+#endif
+
+#define FRAMES_PER_SECOND 1000
+#define FRAME_MASK 0x7FF              // USB frame numbers are 11 bits
+#define BLOCK_SECONDS 64              // Edges per block; the block keeps its earliest-looking sample
+#define MIN_WINDOW_SECONDS 600        // Shortest window a correction is made from
+#define REPORT_BLOCKS 10              // How often, in blocks, the measured drift is logged
+#define MAX_CORRECTION_STEPS 8        // Largest change made from one window, about 8 ppm
+#define HISTORY_EEPROM_ADDR 0x29      // After the boot cache: corrections made, then the last one
+
+// Sampled from the INT edge at each seconds rollover
+static volatile uint16_t edge_frame;
+static volatile uint32_t edge_time_us;
+static volatile bool edge_seen = false;
+
+static bool running = false;
+static bool have_edge = false;
+static uint16_t last_frame;
+static uint32_t last_time_us;
+
+// An edge is sampled late whenever the IRQ is held off, as it is during a
+// flash erase, but never early. So each block of edges keeps only its
+// lowest count of frames beyond 1000 per second, and the drift is the
+// slope between the first block and the latest one.
+static bool window_open = false;
+static uint32_t window_edges;
+static int32_t excess_frames;      // Frames beyond 1000 per second since the window opened
+static int32_t block_min;
+static uint32_t block_min_edge;
+static uint32_t blocks;
+static int32_t first_min;
+static uint32_t first_min_edge;
+static int32_t latest_min;
+static uint32_t window_seconds;    // Between the first block's sample and the latest one's
+
+static rv3028_request_t clear_request;
+static bool clear_pending = false;
+
+static void calibration_edge(void) {
+    edge_frame = usb_hw->sof_rd & USB_SOF_RD_BITS;
+    edge_time_us = time_us_32();
+    edge_seen = true;
+}
+
+void rtc_calibration_init(void) {
+    rv3028_set_update_interrupt(false);
+    wake_set_edge_handler(calibration_edge);
+}
+
+static void reset_window(void) {
+    have_edge = false;
+    window_open = false;
+}
+
+static void open_window(void) {
+    window_open = true;
+    window_edges = 0;
+    excess_frames = 0;
+    block_min = INT32_MAX;
+    blocks = 0;
+}
+
+// Corrections made so far and the last one, in the two spare bytes of user EEPROM
+static void record_correction(int steps) {
+    uint8_t history[2];
+    if (rv3028_read_user_eeprom(HISTORY_EEPROM_ADDR, history, sizeof(history)) != RV3028_SUCCESS) return;
+    if (history[0] < UINT8_MAX) history[0]++;
+    history[1] = (uint8_t)(int8_t)steps;
+    rv3028_write_user_eeprom(HISTORY_EEPROM_ADDR, history, sizeof(history));
+}
+
+// Drift in parts per billion, positive when the RTC runs fast
+static int64_t window_drift_ppb(void) {
+    int64_t host_frames = (int64_t)window_seconds * FRAMES_PER_SECOND + (latest_min - first_min);
+    return -(int64_t)(latest_min - first_min) * 1000000000 / host_frames;
+}
+
+static void evaluate_window(void) {
+    int64_t drift_ppb = window_drift_ppb();
+
+    // Each end of the window is sampled to within a frame
+    int64_t uncertainty_ppb = 2LL * 1000000000 / ((int64_t)window_seconds * FRAMES_PER_SECOND);
+    if (blocks % REPORT_BLOCKS == 0) {
+        printf("RTC drift %+lld ppb over %lu s (+/- %lld ppb)\n", (long long)drift_ppb,
+               (unsigned long)window_seconds, (long long)uncertainty_ppb);
+    }
+    if (window_seconds < MIN_WINDOW_SECONDS || llabs(drift_ppb) < RV3028_OFFSET_STEP_PPB + uncertainty_ppb) return;
+
+    int steps = (int)((drift_ppb + (drift_ppb < 0 ? -1 : 1) * RV3028_OFFSET_STEP_PPB / 2) / RV3028_OFFSET_STEP_PPB);
+    if (steps > MAX_CORRECTION_STEPS) steps = MAX_CORRECTION_STEPS;
+    if (steps < -MAX_CORRECTION_STEPS) steps = -MAX_CORRECTION_STEPS;
+
+    int16_t offset;
+    if (rv3028_get_offset(&offset) != RV3028_SUCCESS) return;
+    int new_offset = offset + steps;
+    if (new_offset > RV3028_OFFSET_MAX) new_offset = RV3028_OFFSET_MAX;
+    if (new_offset < RV3028_OFFSET_MIN) new_offset = RV3028_OFFSET_MIN;
+    if (new_offset == offset) return;
+
+    if (rv3028_set_offset((int16_t)new_offset) != RV3028_SUCCESS) {
+        printf("RTC calibration: could not set offset\n");
+        return;
+    }
+    printf("RTC calibration: %+lld ppb over %lu s, offset %d -> %d\n", (long long)drift_ppb,
+           (unsigned long)window_seconds, offset, new_offset);
+    record_correction(new_offset - offset);
+
+    // The old measurement no longer describes the clock
+    window_open = false;
+}
+
+void rtc_calibration_task(void) {
+    bool attached = tud_mounted() && !tud_suspended();
+    if (attached != running) {
+        // Off the bus, the per-second interrupt would only wake the board
+        if (rv3028_set_update_interrupt(attached) != RV3028_SUCCESS) return;
+        running = attached;
+        reset_window();
+        printf("RTC calibration %s\n", attached ? "started" : "stopped");
+        return;
+    }
+
+    if (clear_pending) {
+        rv3028_result_t result;
+        if (rv3028_poll(&clear_request, &result)) clear_pending = false;
+    }
+    if (!running || !edge_seen) return;
+
+    uint32_t interrupts = save_and_disable_interrupts();
+    uint16_t frame = edge_frame;
+    uint32_t time_us = edge_time_us;
+    edge_seen = false;
+    restore_interrupts(interrupts);
+
+    // Release INT for the next second, without waiting on the bus
+    if (!clear_pending &&
+        rv3028_write_register_async(&clear_request, RV3028_STATUS_REG, (uint8_t)~RV3028_STATUS_UF) == RV3028_SUCCESS) {
+        clear_pending = true;
+    }
+
+    if (!have_edge) {
+        have_edge = true;
+        last_frame = frame;
+        last_time_us = time_us;
+        return;
+    }
+
+    uint32_t elapsed_us = time_us - last_time_us;
+    uint32_t frames = (frame - last_frame) & FRAME_MASK;
+    last_frame = frame;
+    last_time_us = time_us;
+
+    // Another INT source or a missed edge; the frame count cannot span it
+    if (elapsed_us < 500000 || elapsed_us > 1500000) {
+        reset_window();
+        return;
+    }
+
+    if (!window_open) {
+        open_window();
+        return;
+    }
+
+    window_edges++;
+    excess_frames += (int32_t)frames - FRAMES_PER_SECOND;
+    if (excess_frames < block_min) {
+        block_min = excess_frames;
+        block_min_edge = window_edges;
+    }
+    if (window_edges % BLOCK_SECONDS != 0) return;
+
+    if (++blocks == 1) {
+        first_min = block_min;
+        first_min_edge = block_min_edge;
+    } else {
+        latest_min = block_min;
+        window_seconds = block_min_edge - first_min_edge;
+        evaluate_window();
+    }
+    block_min = INT32_MAX;
+}
@@ -0,0 +1,18 @@
+#ifndef RTC_CALIBRATION_H
+#define RTC_CALIBRATION_H
+
+// While USB is attached, time the RTC's seconds against the host's 1 kHz
+// start-of-frame packets and trim the RV-3028's offset to match. The
+// correction is stored in the RTC's EEPROM, so it outlives the session.
+// It is only as good as the host's clock, which is usually within 50 ppm
+// and can be much better, so it is for hosts known to keep good time.
+
+// Turn off the RTC's per-second interrupt, in case a session was cut short
+// by unplugging, and start watching INT edges. Call it once the RTC is set up.
+void rtc_calibration_init(void);
+
+// Count the second that just ended, if any, and apply a correction once the
+// measured drift clearly exceeds one offset step. Call it from the main loop.
+void rtc_calibration_task(void);
+
+#endif // RTC_CALIBRATION_H
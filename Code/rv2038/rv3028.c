@@ -1,4 +1,5 @@
 #include "rv3028.h"
+#include "trace.h"
 #include <time.h>
 
 // Constants for validation
@@ -11,6 +12,7 @@
 #define MAX_BCD_VALUE   99
 #define BCD_ERROR_VALUE 0xFF
 #define YEAR_OFFSET_1900 100  // Years since 1900 for 2000+ dates
+#define EEPROM_TIMEOUT_MS 50  // EEPROM byte writes take up to ~10 ms
 
 // BCD Conversion Functions
 uint8_t decimal_to_bcd(uint8_t decimal_value) {
@@ -24,23 +26,117 @@ uint8_t bcd_to_decimal(uint8_t bcd_value) {
     return ((bcd_value >> 4) * 10) + (bcd_value & 0x0F);
 }
 
+// Time Conversion
+// Seconds since 1970-01-01 for a calendar time, counted as UTC like the RTC.
+// Unlike mktime this ignores the time zone and tm_isdst, and leaves the
+// struct alone.
+int64_t rv3028_tm_to_epoch(const struct tm *time_data) {
+    int64_t year = time_data->tm_year + 1900;
+    int month = time_data->tm_mon + 1;
+
+    // Count years from March so the leap day falls at the end of the year
+    if (month <= 2) {
+        year--;
+    }
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + time_data->tm_mday - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int64_t days = era * 146097 + day_of_era - 719468; // 719468 days from 0000-03-01 to 1970-01-01
+
+    return days * 86400 + time_data->tm_hour * 3600 + time_data->tm_min * 60 + time_data->tm_sec;
+}
+
 // I2C Communication Helpers
-static rv3028_result_t write_register_address(uint8_t register_address) {
-    int result = i2c_write_blocking(RV3028_I2C_PORT, RV3028_I2C_ADDR, 
-                                   &register_address, 1, true);
-    return (result == 1) ? RV3028_SUCCESS : RV3028_ERROR_I2C_WRITE_FAILED;
+static uint32_t transaction_count = 0;
+static uint32_t byte_count = 0;
+
+static void prepare_transfer(i2c_async_transfer_t *transfer, const uint8_t *write_data, size_t write_len,
+                             uint8_t *read_data, size_t read_len) {
+    *transfer = (i2c_async_transfer_t) {
+        .address = RV3028_I2C_ADDR,
+        .write_data = write_data, .write_len = write_len,
+        .read_data = read_data, .read_len = read_len
+    };
+    transaction_count++;
+    // Payload plus the address byte, which a read after a write sends again
+    byte_count += write_len + read_len + ((write_len > 0 && read_len > 0) ? 2 : 1);
+}
+
+static rv3028_result_t run_transfer(const uint8_t *write_data, size_t write_len, uint8_t *read_data, size_t read_len) {
+    i2c_async_transfer_t transfer;
+    uint32_t trace_arg = (write_len > 0 ? write_data[0] : 0) | (uint32_t)read_len << 8;
+    TRACE_BEGIN(TRACE_RTC_TRANSFER, trace_arg);
+    prepare_transfer(&transfer, write_data, write_len, read_data, read_len);
+    bool ok = i2c_async_submit(&transfer) && i2c_async_wait(&transfer);
+    TRACE_END(TRACE_RTC_TRANSFER, trace_arg);
+    if (ok) {
+        return RV3028_SUCCESS;
+    }
+    return (read_len > 0) ? RV3028_ERROR_I2C_READ_FAILED : RV3028_ERROR_I2C_WRITE_FAILED;
 }
 
-static rv3028_result_t read_registers(uint8_t *buffer, size_t buffer_size) {
-    int result = i2c_read_blocking(RV3028_I2C_PORT, RV3028_I2C_ADDR, 
-                                  buffer, buffer_size, false);
-    return (result == (int)buffer_size) ? RV3028_SUCCESS : RV3028_ERROR_I2C_READ_FAILED;
+// The register address and the read go out as one transaction, joined by a
+// repeated start
+static rv3028_result_t read_registers(uint8_t register_address, uint8_t *buffer, size_t buffer_size) {
+    return run_transfer(&register_address, 1, buffer, buffer_size);
 }
 
 static rv3028_result_t write_data_to_device(const uint8_t *data, size_t data_size) {
-    int result = i2c_write_blocking(RV3028_I2C_PORT, RV3028_I2C_ADDR, 
-                                   data, data_size, false);
-    return (result == (int)data_size) ? RV3028_SUCCESS : RV3028_ERROR_I2C_WRITE_FAILED;
+    return run_transfer(data, data_size, NULL, 0);
+}
+
+static rv3028_result_t read_register(uint8_t register_address, uint8_t *value) {
+    return read_registers(register_address, value, 1);
+}
+
+static rv3028_result_t write_register(uint8_t register_address, uint8_t value) {
+    uint8_t write_buffer[] = {register_address, value};
+    return write_data_to_device(write_buffer, sizeof(write_buffer));
+}
+
+uint32_t rv3028_transaction_count(void) {
+    return transaction_count;
+}
+
+uint32_t rv3028_byte_count(void) {
+    return byte_count;
+}
+
+// Asynchronous Access
+rv3028_result_t rv3028_read_async(rv3028_request_t *request, uint8_t register_address, uint8_t *buffer, size_t length) {
+    if (request == NULL || buffer == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+
+    request->buffer[0] = register_address;
+    TRACE_INSTANT(TRACE_RTC_ASYNC, register_address | (uint32_t)length << 8);
+    prepare_transfer(&request->transfer, request->buffer, 1, buffer, length);
+    return i2c_async_submit(&request->transfer) ? RV3028_SUCCESS : RV3028_ERROR_INVALID_ADDRESS;
+}
+
+rv3028_result_t rv3028_write_register_async(rv3028_request_t *request, uint8_t register_address, uint8_t value) {
+    if (request == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+
+    request->buffer[0] = register_address;
+    request->buffer[1] = value;
+    TRACE_INSTANT(TRACE_RTC_ASYNC, register_address);
+    prepare_transfer(&request->transfer, request->buffer, 2, NULL, 0);
+    return i2c_async_submit(&request->transfer) ? RV3028_SUCCESS : RV3028_ERROR_I2C_WRITE_FAILED;
+}
+
+bool rv3028_poll(rv3028_request_t *request, rv3028_result_t *result) {
+    if (!i2c_async_poll(&request->transfer)) {
+        return false;
+    }
+    if (request->transfer.ok) {
+        *result = RV3028_SUCCESS;
+    } else {
+        *result = (request->transfer.read_len > 0) ? RV3028_ERROR_I2C_READ_FAILED : RV3028_ERROR_I2C_WRITE_FAILED;
+    }
+    return true;
 }
 
 // Input Validation Functions
@@ -67,13 +163,8 @@ static rv3028_result_t validate_time_input(const struct tm *time_to_validate) {
 
 // Device Communication Functions
 rv3028_result_t rv3028_initialize(void) {
-    rv3028_result_t result = write_register_address(RV3028_STATUS_REG);
-    if (result != RV3028_SUCCESS) {
-        return result;
-    }
-    
     uint8_t status_data;
-    result = read_registers(&status_data, 1);
+    rv3028_result_t result = read_register(RV3028_STATUS_REG, &status_data);
     if (result != RV3028_SUCCESS) {
         return RV3028_ERROR_DEVICE_NOT_RESPONDING;
     }
@@ -102,7 +193,13 @@ rv3028_result_t rv3028_set_current_time(const struct tm *time_to_set) {
     uint8_t write_buffer[RV3028_WRITE_BUFFER_SIZE];
     populate_time_write_buffer(write_buffer, time_to_set);
     
-    return write_data_to_device(write_buffer, sizeof(write_buffer));
+    rv3028_result_t result = write_data_to_device(write_buffer, sizeof(write_buffer));
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    // The UNIX counter runs separately from the calendar, so keep it in step
+    return rv3028_set_unix_time((uint32_t)rv3028_tm_to_epoch(time_to_set));
 }
 
 // Time Reading Functions
@@ -125,22 +222,184 @@ rv3028_result_t rv3028_get_current_time(struct tm *time_buffer) {
         return RV3028_ERROR_NULL_POINTER;
     }
     
-    rv3028_result_t result = write_register_address(RV3028_SECONDS_REG);
+    uint8_t rtc_registers[RV3028_TIME_REGISTER_COUNT];
+    rv3028_result_t result = read_registers(RV3028_SECONDS_REG, rtc_registers, sizeof(rtc_registers));
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    uint8_t rtc_registers[RV3028_TIME_REGISTER_COUNT];
-    result = read_registers(rtc_registers, sizeof(rtc_registers));
+    convert_rtc_registers_to_tm(rtc_registers, time_buffer);
+    return RV3028_SUCCESS;
+}
+
+// UNIX Time Functions
+static rv3028_result_t read_unix_registers(uint32_t *unix_time) {
+    uint8_t unix_registers[4];
+    rv3028_result_t result = read_registers(RV3028_UNIX_TIME0_REG, unix_registers, sizeof(unix_registers));
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    convert_rtc_registers_to_tm(rtc_registers, time_buffer);
+    *unix_time = (uint32_t)unix_registers[0] | (uint32_t)unix_registers[1] << 8 |
+                 (uint32_t)unix_registers[2] << 16 | (uint32_t)unix_registers[3] << 24;
+    return RV3028_SUCCESS;
+}
+
+// The counter can tick between bytes of a read, so read until two agree
+rv3028_result_t rv3028_get_unix_time(uint32_t *unix_time) {
+    if (unix_time == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+
+    uint32_t first, second;
+    rv3028_result_t result = read_unix_registers(&first);
+    for (int attempt = 0; attempt < 3 && result == RV3028_SUCCESS; attempt++) {
+        result = read_unix_registers(&second);
+        if (result == RV3028_SUCCESS && second == first) {
+            *unix_time = first;
+            return RV3028_SUCCESS;
+        }
+        first = second;
+    }
+    return (result != RV3028_SUCCESS) ? result : RV3028_ERROR_I2C_READ_FAILED;
+}
+
+rv3028_result_t rv3028_set_unix_time(uint32_t unix_time) {
+    uint8_t write_buffer[] = {
+        RV3028_UNIX_TIME0_REG,
+        unix_time & 0xFF, (unix_time >> 8) & 0xFF, (unix_time >> 16) & 0xFF, unix_time >> 24
+    };
+    return write_data_to_device(write_buffer, sizeof(write_buffer));
+}
+
+// Clocks set before the counter was used have it at an arbitrary value;
+// take it from the calendar if the two disagree by more than a tick.
+rv3028_result_t rv3028_sync_unix_time(void) {
+    struct tm current_time;
+    uint32_t unix_time;
+    rv3028_result_t result = rv3028_get_current_time(&current_time);
+    if (result == RV3028_SUCCESS) {
+        result = rv3028_get_unix_time(&unix_time);
+    }
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    int64_t calendar_time = rv3028_tm_to_epoch(&current_time);
+    int64_t difference = (int64_t)unix_time - calendar_time;
+    if (difference >= -1 && difference <= 1) {
+        return RV3028_SUCCESS;
+    }
+    return rv3028_set_unix_time((uint32_t)calendar_time);
+}
+
+// Register Shadows
+// Control 1 and 2 change only when we write them, apart from TE, so a copy turns
+// read-modify-write updates into single writes. The RTC keeps its settings
+// across our resets, so the copy is read on first use, and it is dropped
+// after a failed write.
+static uint8_t control_shadow[2];
+static bool control_shadow_valid = false;
+
+static rv3028_result_t load_control_shadow(void) {
+    if (control_shadow_valid) {
+        return RV3028_SUCCESS;
+    }
+    rv3028_result_t result = read_registers(RV3028_CONTROL1_REG, control_shadow, sizeof(control_shadow));
+    control_shadow_valid = (result == RV3028_SUCCESS);
+    return result;
+}
+
+// Set the bits in mask of Control 1 or 2 to the matching bits of value,
+// skipping the write if nothing changes
+static rv3028_result_t update_register(uint8_t register_address, uint8_t mask, uint8_t value) {
+    // A one-shot countdown clears TE itself when it ends, so while the copy
+    // says the timer runs, Control 1 has to be read back
+    if (register_address == RV3028_CONTROL1_REG && (control_shadow[0] & RV3028_CONTROL1_TE)) {
+        control_shadow_valid = false;
+    }
+
+    rv3028_result_t result = load_control_shadow();
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    uint8_t *shadow = &control_shadow[register_address - RV3028_CONTROL1_REG];
+    uint8_t register_value = (*shadow & ~mask) | (value & mask);
+    if (register_value == *shadow) {
+        return RV3028_SUCCESS;
+    }
+
+    result = write_register(register_address, register_value);
+    if (result == RV3028_SUCCESS) {
+        *shadow = register_value;
+    } else {
+        control_shadow_valid = false;
+    }
+    return result;
+}
+
+// Snapshot Functions
+// The control registers in an asynchronous burst may be older than writes
+// made while it ran, so only a synchronous read refreshes the shadow
+void rv3028_decode_snapshot(const uint8_t *registers, rv3028_snapshot_t *snapshot) {
+    convert_rtc_registers_to_tm(&registers[RV3028_SECONDS_REG], &snapshot->time);
+    snapshot->status = registers[RV3028_STATUS_REG];
+
+    // The UNIX counter is not held still like the calendar, so it can tick
+    // between its bytes. That tears it by a multiple of 256 s, which puts it
+    // out of step with the calendar's seconds; fall back to the calendar then.
+    const uint8_t *unix_registers = &registers[RV3028_UNIX_TIME0_REG];
+    uint32_t unix_time = (uint32_t)unix_registers[0] | (uint32_t)unix_registers[1] << 8 |
+                         (uint32_t)unix_registers[2] << 16 | (uint32_t)unix_registers[3] << 24;
+    uint32_t ahead = (unix_time % 60 + 60 - (uint32_t)snapshot->time.tm_sec) % 60;
+    snapshot->unix_time = ahead <= 1 ? unix_time : (uint32_t)rv3028_tm_to_epoch(&snapshot->time);
+}
+
+rv3028_result_t rv3028_read_snapshot(rv3028_snapshot_t *snapshot) {
+    if (snapshot == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+
+    uint8_t registers[RV3028_SNAPSHOT_REGISTER_COUNT];
+    rv3028_result_t result = read_registers(RV3028_SECONDS_REG, registers, sizeof(registers));
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    rv3028_decode_snapshot(registers, snapshot);
+
+    // The burst saw the control registers too, so the shadow is current
+    control_shadow[0] = registers[RV3028_CONTROL1_REG];
+    control_shadow[1] = registers[RV3028_CONTROL2_REG];
+    control_shadow_valid = true;
     return RV3028_SUCCESS;
 }
 
 // Alarm Functions
+static rv3028_result_t check_status_flag(uint8_t flag, bool *is_triggered) {
+    if (is_triggered == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+
+    uint8_t status_reg;
+    rv3028_result_t result = read_register(RV3028_STATUS_REG, &status_reg);
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    *is_triggered = (status_reg & flag) != 0;
+    return RV3028_SUCCESS;
+}
+
+// Status flags clear when written with 0 and ignore a 1, so one write clears
+// a flag without a read and without losing any flag raised meanwhile
+static rv3028_result_t clear_status_flag(uint8_t flag) {
+    return write_register(RV3028_STATUS_REG, (uint8_t)~flag);
+}
+
+// The alarm matches minute, hour and day of month, so it next goes off on
+// the first day after now with that date; it cannot match a month or year.
 rv3028_result_t rv3028_set_alarm(const struct tm *unlock_date) {
     rv3028_result_t validation_result = validate_time_input(unlock_date);
     if (validation_result != RV3028_SUCCESS) {
@@ -148,13 +407,17 @@ rv3028_result_t rv3028_set_alarm(const struct tm *unlock_date) {
     }
 
     // Disable alarm interrupt to prevent race conditions
-    uint8_t control_buffer[] = {RV3028_CONTROL2_REG, 0};
-    rv3028_result_t result = write_data_to_device(control_buffer, sizeof(control_buffer));
+    rv3028_result_t result = update_register(RV3028_CONTROL2_REG, RV3028_CONTROL2_AIE, 0);
+    if (result == RV3028_SUCCESS) {
+        result = clear_status_flag(RV3028_STATUS_AF);
+    }
+    if (result == RV3028_SUCCESS) {
+        result = update_register(RV3028_CONTROL1_REG, RV3028_CONTROL1_WADA, RV3028_CONTROL1_WADA);
+    }
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    // Set alarm registers
     // Set alarm registers, enabling minute, hour, and day of month alarms.
     // The AE_x bit is active-low, so we clear it to enable the alarm.
     uint8_t alarm_buffer[] = {
@@ -169,60 +432,229 @@ rv3028_result_t rv3028_set_alarm(const struct tm *unlock_date) {
     }
 
     // Enable alarm interrupt
-    control_buffer[1] = RV3028_STATUS_AIE;
-    return write_data_to_device(control_buffer, sizeof(control_buffer));
+    return update_register(RV3028_CONTROL2_REG, RV3028_CONTROL2_AIE, RV3028_CONTROL2_AIE);
 }
 
 rv3028_result_t rv3028_check_alarm_flag(bool *is_triggered) {
-    if (is_triggered == NULL) {
+    return check_status_flag(RV3028_STATUS_AF, is_triggered);
+}
+
+rv3028_result_t rv3028_clear_alarm_flag(void) {
+    return clear_status_flag(RV3028_STATUS_AF);
+}
+
+rv3028_result_t rv3028_disable_alarm_interrupt(void) {
+    return update_register(RV3028_CONTROL2_REG, RV3028_CONTROL2_AIE, 0);
+}
+
+// Countdown Timer Functions
+// One-shot countdown at 1 Hz, raising the timer flag and interrupt when it
+// reaches zero. The first tick can come early by up to a second.
+rv3028_result_t rv3028_start_countdown(uint16_t seconds) {
+    if (seconds == 0 || seconds > RV3028_TIMER_MAX) {
+        return RV3028_ERROR_INVALID_TIME;
+    }
+
+    // The timer value can only be loaded while the timer is stopped
+    rv3028_result_t result = rv3028_stop_countdown();
+    if (result == RV3028_SUCCESS) {
+        result = clear_status_flag(RV3028_STATUS_TF);
+    }
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    uint8_t timer_buffer[] = {RV3028_TIMER_VALUE0_REG, seconds & 0xFF, seconds >> 8};
+    result = write_data_to_device(timer_buffer, sizeof(timer_buffer));
+    if (result == RV3028_SUCCESS) {
+        result = update_register(RV3028_CONTROL2_REG, RV3028_CONTROL2_TIE, RV3028_CONTROL2_TIE);
+    }
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+    return update_register(RV3028_CONTROL1_REG, RV3028_CONTROL1_TE | RV3028_CONTROL1_TD_MASK,
+                           RV3028_CONTROL1_TE | RV3028_CONTROL1_TD_1HZ);
+}
+
+rv3028_result_t rv3028_stop_countdown(void) {
+    rv3028_result_t result = update_register(RV3028_CONTROL1_REG, RV3028_CONTROL1_TE, 0);
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+    return update_register(RV3028_CONTROL2_REG, RV3028_CONTROL2_TIE, 0);
+}
+
+rv3028_result_t rv3028_check_timer_flag(bool *is_triggered) {
+    return check_status_flag(RV3028_STATUS_TF, is_triggered);
+}
+
+rv3028_result_t rv3028_clear_timer_flag(void) {
+    return clear_status_flag(RV3028_STATUS_TF);
+}
+
+// Periodic Time Update Functions
+rv3028_result_t rv3028_set_update_interrupt(bool enabled) {
+    rv3028_result_t result = update_register(RV3028_CONTROL1_REG, RV3028_CONTROL1_USEL, 0);
+    if (result == RV3028_SUCCESS) {
+        result = update_register(RV3028_CONTROL2_REG, RV3028_CONTROL2_UIE, enabled ? RV3028_CONTROL2_UIE : 0);
+    }
+    if (result != RV3028_SUCCESS || enabled) {
+        return result;
+    }
+    return clear_status_flag(RV3028_STATUS_UF);
+}
+
+// User RAM Functions
+rv3028_result_t rv3028_read_user_ram(uint8_t *buffer) {
+    if (buffer == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+    return read_registers(RV3028_USER_RAM1_REG, buffer, RV3028_USER_RAM_SIZE);
+}
+
+rv3028_result_t rv3028_write_user_ram(const uint8_t *data) {
+    if (data == NULL) {
         return RV3028_ERROR_NULL_POINTER;
     }
+    uint8_t write_buffer[] = {RV3028_USER_RAM1_REG, data[0], data[1]};
+    return write_data_to_device(write_buffer, sizeof(write_buffer));
+}
+
+// User EEPROM Functions
+static rv3028_result_t wait_for_eeprom(void) {
+    for (int elapsed_ms = 0; elapsed_ms < EEPROM_TIMEOUT_MS; elapsed_ms++) {
+        uint8_t status_reg;
+        rv3028_result_t result = read_register(RV3028_STATUS_REG, &status_reg);
+        if (result != RV3028_SUCCESS) {
+            return result;
+        }
+        if ((status_reg & RV3028_STATUS_EEBUSY) == 0) {
+            return RV3028_SUCCESS;
+        }
+        sleep_ms(1);
+    }
+    return RV3028_ERROR_EEPROM_BUSY;
+}
 
-    rv3028_result_t result = write_register_address(RV3028_STATUS_REG);
+static rv3028_result_t set_eeprom_refresh(bool enabled) {
+    // The automatic EEPROM refresh must be off while we access the EEPROM directly
+    rv3028_result_t result = update_register(RV3028_CONTROL1_REG, RV3028_CONTROL1_EERD,
+                                             enabled ? 0 : RV3028_CONTROL1_EERD);
     if (result != RV3028_SUCCESS) {
         return result;
     }
+    return enabled ? RV3028_SUCCESS : wait_for_eeprom();
+}
 
-    uint8_t status_reg;
-    result = read_registers(&status_reg, 1);
+static rv3028_result_t run_eeprom_command(uint8_t command) {
+    rv3028_result_t result = write_register(RV3028_EECMD_REG, 0x00);
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+    result = write_register(RV3028_EECMD_REG, command);
     if (result != RV3028_SUCCESS) {
         return result;
     }
+    return wait_for_eeprom();
+}
 
-    *is_triggered = (status_reg & RV3028_STATUS_AF) != 0;
+static rv3028_result_t validate_eeprom_range(uint8_t address, const void *buffer, size_t length) {
+    if (buffer == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+    if ((size_t)address + length > RV3028_USER_EEPROM_SIZE) {
+        return RV3028_ERROR_INVALID_ADDRESS;
+    }
     return RV3028_SUCCESS;
 }
 
-rv3028_result_t rv3028_clear_alarm_flag(void) {
-    rv3028_result_t result = write_register_address(RV3028_STATUS_REG);
+rv3028_result_t rv3028_read_user_eeprom(uint8_t address, uint8_t *buffer, size_t length) {
+    rv3028_result_t result = validate_eeprom_range(address, buffer, length);
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    uint8_t status_reg;
-    result = read_registers(&status_reg, 1);
+    result = set_eeprom_refresh(false);
+    for (size_t i = 0; i < length && result == RV3028_SUCCESS; i++) {
+        result = write_register(RV3028_EEADDR_REG, address + i);
+        if (result == RV3028_SUCCESS) {
+            result = run_eeprom_command(RV3028_EECMD_READ_ONE);
+        }
+        if (result == RV3028_SUCCESS) {
+            result = read_register(RV3028_EEDATA_REG, &buffer[i]);
+        }
+    }
+
+    rv3028_result_t refresh_result = set_eeprom_refresh(true);
+    return (result != RV3028_SUCCESS) ? result : refresh_result;
+}
+
+rv3028_result_t rv3028_write_user_eeprom(uint8_t address, const uint8_t *data, size_t length) {
+    rv3028_result_t result = validate_eeprom_range(address, data, length);
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    // Write back the status register with the alarm flag cleared
-    uint8_t write_buffer[] = {RV3028_STATUS_REG, status_reg & ~RV3028_STATUS_AF};
-    return write_data_to_device(write_buffer, sizeof(write_buffer));
+    result = set_eeprom_refresh(false);
+    for (size_t i = 0; i < length && result == RV3028_SUCCESS; i++) {
+        // EEADDR and EEDATA are adjacent, so both go out in one transaction
+        uint8_t write_buffer[] = {RV3028_EEADDR_REG, address + i, data[i]};
+        result = write_data_to_device(write_buffer, sizeof(write_buffer));
+        if (result == RV3028_SUCCESS) {
+            result = run_eeprom_command(RV3028_EECMD_WRITE_ONE);
+        }
+    }
+
+    rv3028_result_t refresh_result = set_eeprom_refresh(true);
+    return (result != RV3028_SUCCESS) ? result : refresh_result;
 }
 
-rv3028_result_t rv3028_disable_alarm_interrupt(void) {
-    rv3028_result_t result = write_register_address(RV3028_CONTROL2_REG);
+// Offset Functions
+rv3028_result_t rv3028_get_offset(int16_t *offset) {
+    if (offset == NULL) {
+        return RV3028_ERROR_NULL_POINTER;
+    }
+
+    uint8_t offset_registers[2];
+    rv3028_result_t result = read_registers(RV3028_EEPROM_OFFSET_REG, offset_registers, sizeof(offset_registers));
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    uint8_t control2_reg;
-    result = read_registers(&control2_reg, 1);
+    int16_t value = (offset_registers[0] << 1) | ((offset_registers[1] & RV3028_BACKUP_EEOFFSET0) ? 1 : 0);
+    *offset = (value > RV3028_OFFSET_MAX) ? value - 512 : value; // Sign-extend the 9 bits
+    return RV3028_SUCCESS;
+}
+
+// The offset registers are RAM mirrors of the configuration EEPROM: writing
+// them corrects the clock straight away, and the update command keeps the
+// correction over a power loss.
+rv3028_result_t rv3028_set_offset(int16_t offset) {
+    if (offset < RV3028_OFFSET_MIN || offset > RV3028_OFFSET_MAX) {
+        return RV3028_ERROR_INVALID_ADDRESS;
+    }
+
+    uint8_t backup_reg;
+    rv3028_result_t result = read_register(RV3028_EEPROM_BACKUP_REG, &backup_reg);
     if (result != RV3028_SUCCESS) {
         return result;
     }
 
-    // Write back the control register with the alarm interrupt enable bit cleared
-    uint8_t write_buffer[] = {RV3028_CONTROL2_REG, control2_reg & ~RV3028_STATUS_AIE};
-    return write_data_to_device(write_buffer, sizeof(write_buffer));
-}
\ No newline at end of file
+    uint16_t value = (uint16_t)offset & 0x1FF;
+    uint8_t write_buffer[] = {
+        RV3028_EEPROM_OFFSET_REG,
+        value >> 1,
+        (backup_reg & ~RV3028_BACKUP_EEOFFSET0) | ((value & 1) ? RV3028_BACKUP_EEOFFSET0 : 0)
+    };
+    result = write_data_to_device(write_buffer, sizeof(write_buffer));
+    if (result != RV3028_SUCCESS) {
+        return result;
+    }
+
+    result = set_eeprom_refresh(false);
+    if (result == RV3028_SUCCESS) {
+        result = run_eeprom_command(RV3028_EECMD_UPDATE);
+    }
+    rv3028_result_t refresh_result = set_eeprom_refresh(true);
+    return (result != RV3028_SUCCESS) ? result : refresh_result;
+}
@@ -3,11 +3,15 @@
 
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
+#include "i2c_async.h"
 #include <time.h>
 
 // I2C Configuration
 #define RV3028_I2C_ADDR         0x52
 #define RV3028_I2C_PORT         i2c0
+#ifndef RV3028_I2C_BAUDRATE
+#define RV3028_I2C_BAUDRATE     100000  // 400000 is Fast-mode, the RV-3028's fastest
+#endif
 
 // Register Addresses
 #define RV3028_SECONDS_REG      0x00
@@ -17,16 +21,38 @@
 #define RV3028_DATE_REG         0x04
 #define RV3028_MONTH_REG        0x05
 #define RV3028_YEAR_REG         0x06
+#define RV3028_ALARM_MINUTES_REG 0x07
+#define RV3028_ALARM_HOURS_REG   0x08
+#define RV3028_ALARM_DATE_REG    0x09
+#define RV3028_TIMER_VALUE0_REG  0x0A  // Countdown timer bits 0-7
+#define RV3028_TIMER_VALUE1_REG  0x0B  // Countdown timer bits 8-11
 #define RV3028_STATUS_REG       0x0E
-#define RV3028_ALARM_MINUTES_REG 0x08
-#define RV3028_ALARM_HOURS_REG   0x09
-#define RV3028_ALARM_DATE_REG    0x0A
-#define RV3028_CONTROL2_REG      0x11
+#define RV3028_CONTROL1_REG      0x0F
+#define RV3028_CONTROL2_REG      0x10
+#define RV3028_UNIX_TIME0_REG    0x1B  // 32-bit UNIX time counter, least significant byte first
+#define RV3028_USER_RAM1_REG     0x1F  // Two bytes of battery-backed RAM
+#define RV3028_EEADDR_REG        0x25
+#define RV3028_EEDATA_REG        0x26
+#define RV3028_EECMD_REG         0x27
+#define RV3028_EEPROM_OFFSET_REG 0x36  // Offset bits 8-1, mirrored from the configuration EEPROM
+#define RV3028_EEPROM_BACKUP_REG 0x37  // Bit 7 holds offset bit 0
  
  // Register Bit Masks
 #define RV3028_STATUS_AF        0x04  // Alarm Flag
-#define RV3028_STATUS_AIE       0x04  // Alarm Interrupt Enable
+#define RV3028_STATUS_TF        0x08  // Countdown Timer Flag
+#define RV3028_STATUS_UF        0x10  // Periodic Time Update Flag
+#define RV3028_CONTROL1_TD_1HZ  0x02  // Countdown timer clock, in the TD bits
+#define RV3028_CONTROL1_TD_MASK 0x03
+#define RV3028_CONTROL1_TE      0x04  // Countdown Timer Enable
+#define RV3028_CONTROL1_USEL    0x10  // Periodic time update every minute rather than every second
+#define RV3028_CONTROL1_WADA    0x20  // Alarm on date rather than weekday
+#define RV3028_CONTROL2_AIE     0x08  // Alarm Interrupt Enable
+#define RV3028_CONTROL2_TIE     0x10  // Countdown Timer Interrupt Enable
+#define RV3028_CONTROL2_UIE     0x20  // Periodic Time Update Interrupt Enable
 #define RV3028_ALARM_AE         0x80  // Alarm Enable (in each alarm register)
+#define RV3028_STATUS_EEBUSY    0x80  // EEPROM busy
+#define RV3028_CONTROL1_EERD    0x08  // EEPROM memory refresh disable
+#define RV3028_BACKUP_EEOFFSET0 0x80  // Offset bit 0, in the backup register
 #define RV3028_SECONDS_MASK     0x7F  // Mask VL bit
 #define RV3028_MINUTES_MASK     0x7F  // Mask unused bit
 #define RV3028_HOURS_MASK       0x3F  // 24-hour format, mask AM/PM bits
@@ -34,9 +60,26 @@
 #define RV3028_DATE_MASK        0x3F  // Day of month 1-31
 #define RV3028_MONTH_MASK       0x1F  // Month 1-12
 
+// EEPROM Commands (written to EECMD after a 0x00 write)
+#define RV3028_EECMD_WRITE_ONE  0x21  // Write EEDATA to the EEPROM byte at EEADDR
+#define RV3028_EECMD_READ_ONE   0x22  // Read the EEPROM byte at EEADDR into EEDATA
+#define RV3028_EECMD_UPDATE     0x11  // Copy the configuration RAM mirror into the EEPROM
+
+// User EEPROM (battery-backed, separate from the RP2040 flash)
+#define RV3028_USER_EEPROM_SIZE 43    // Addresses 0x00-0x2A
+#define RV3028_USER_RAM_SIZE    2
+#define RV3028_TIMER_MAX        4095  // The countdown timer is 12 bits wide
+
+// Aging offset: a 9-bit signed count of 0.9537 ppm steps. Positive values
+// slow the clock down, to correct one that runs fast.
+#define RV3028_OFFSET_MIN       -256
+#define RV3028_OFFSET_MAX       255
+#define RV3028_OFFSET_STEP_PPB  954
+
 // Buffer Sizes
 #define RV3028_TIME_REGISTER_COUNT  7
 #define RV3028_WRITE_BUFFER_SIZE    8
+#define RV3028_SNAPSHOT_REGISTER_COUNT 31  // Seconds (00h) through UNIX Time 3 (1Eh)
 
 // Error Codes
 typedef enum {
@@ -45,18 +88,58 @@ typedef enum {
     RV3028_ERROR_INVALID_TIME,
     RV3028_ERROR_I2C_WRITE_FAILED,
     RV3028_ERROR_I2C_READ_FAILED,
-    RV3028_ERROR_DEVICE_NOT_RESPONDING
+    RV3028_ERROR_DEVICE_NOT_RESPONDING,
+    RV3028_ERROR_INVALID_ADDRESS,
+    RV3028_ERROR_EEPROM_BUSY
 } rv3028_result_t;
 
+// A register access running in the background. Keep it alive until polled done.
+typedef struct {
+    i2c_async_transfer_t transfer;
+    uint8_t buffer[2]; // Register address, and the value for a write
+} rv3028_request_t;
+
+// Clock and status from one burst read. The RTC holds the time registers
+// still while they are read, so the time is consistent.
+typedef struct {
+    struct tm time;
+    uint32_t unix_time; // From the UNIX counter, or the calendar if the counter was read mid-tick
+    uint8_t status;
+} rv3028_snapshot_t;
+
 // Public API
 rv3028_result_t rv3028_initialize(void);
 rv3028_result_t rv3028_set_current_time(const struct tm *time_to_set);
 rv3028_result_t rv3028_get_current_time(struct tm *time_buffer);
+rv3028_result_t rv3028_get_unix_time(uint32_t *unix_time);
+rv3028_result_t rv3028_set_unix_time(uint32_t unix_time);
+rv3028_result_t rv3028_sync_unix_time(void);
 rv3028_result_t rv3028_set_alarm(const struct tm *unlock_date);
 rv3028_result_t rv3028_check_alarm_flag(bool *is_triggered);
 rv3028_result_t rv3028_clear_alarm_flag(void);
 rv3028_result_t rv3028_disable_alarm_interrupt(void);
+rv3028_result_t rv3028_start_countdown(uint16_t seconds);
+rv3028_result_t rv3028_stop_countdown(void);
+rv3028_result_t rv3028_check_timer_flag(bool *is_triggered);
+rv3028_result_t rv3028_clear_timer_flag(void);
+rv3028_result_t rv3028_read_user_ram(uint8_t *buffer);
+rv3028_result_t rv3028_write_user_ram(const uint8_t *data);
+uint32_t rv3028_transaction_count(void); // I2C transfers since boot, for measuring bus traffic
+uint32_t rv3028_byte_count(void);        // Bytes those transfers put on the bus, addresses included
+rv3028_result_t rv3028_read_snapshot(rv3028_snapshot_t *snapshot);
+void rv3028_decode_snapshot(const uint8_t *registers, rv3028_snapshot_t *snapshot); // For a snapshot read with rv3028_read_async
+rv3028_result_t rv3028_read_async(rv3028_request_t *request, uint8_t register_address, uint8_t *buffer, size_t length);
+rv3028_result_t rv3028_write_register_async(rv3028_request_t *request, uint8_t register_address, uint8_t value);
+bool rv3028_poll(rv3028_request_t *request, rv3028_result_t *result); // True once the access has finished
+rv3028_result_t rv3028_set_update_interrupt(bool enabled); // INT every second, at the seconds rollover
+rv3028_result_t rv3028_get_offset(int16_t *offset);
+rv3028_result_t rv3028_set_offset(int16_t offset); // Takes effect at once and is stored in the EEPROM
+rv3028_result_t rv3028_read_user_eeprom(uint8_t address, uint8_t *buffer, size_t length);
+rv3028_result_t rv3028_write_user_eeprom(uint8_t address, const uint8_t *data, size_t length);
  
+// Seconds since 1970-01-01, treating the calendar time as UTC
+int64_t rv3028_tm_to_epoch(const struct tm *time_data);
+
  // BCD Conversion Utilities
  uint8_t decimal_to_bcd(uint8_t decimal_value);
 uint8_t bcd_to_decimal(uint8_t bcd_value);
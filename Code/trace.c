@@ -0,0 +1,73 @@
+#include "trace.h"
+
+#if TRACE
+trace_record_t trace_ring[TRACE_EVENTS];
+volatile uint32_t trace_head = 0;
+volatile bool trace_frozen = false;
+
+typedef struct {
+    const char* name;
+    const char* category;
+    const char* arg; // What the argument holds, for the viewer
+} trace_event_info_t;
+
+static const trace_event_info_t event_info[TRACE_EVENT_COUNT] = {
+    [TRACE_MSC_READ] = {"msc_read", "msc", "lba"},
+    [TRACE_MSC_WRITE] = {"msc_write", "msc", "lba"},
+    [TRACE_FLASH_ERASE] = {"flash_erase", "flash", "offset"},
+    [TRACE_FLASH_PROGRAM] = {"flash_program", "flash", "offset"},
+    [TRACE_FS_MOUNT] = {"fs_mount", "fs", "result"},
+    [TRACE_FS_RESUME] = {"fs_resume", "fs", "resumed"},
+    [TRACE_FS_LOCK] = {"fs_lock", "fs", "ok"},
+    [TRACE_FS_UNLOCK] = {"fs_unlock", "fs", "ok"},
+    [TRACE_FS_STABLE] = {"fs_stable", "fs", "stable"},
+    [TRACE_RTC_TRANSFER] = {"rtc_transfer", "rtc", "register"},
+    [TRACE_RTC_ASYNC] = {"rtc_async", "rtc", "register"},
+};
+
+// Flash calls are traced wherever they are made, by linking with
+// --wrap=flash_range_erase --wrap=flash_range_program
+void __real_flash_range_erase(uint32_t flash_offs, size_t count);
+void __real_flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count);
+
+void __wrap_flash_range_erase(uint32_t flash_offs, size_t count) {
+    TRACE_BEGIN(TRACE_FLASH_ERASE, flash_offs);
+    __real_flash_range_erase(flash_offs, count);
+    TRACE_END(TRACE_FLASH_ERASE, flash_offs);
+}
+
+void __wrap_flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    TRACE_BEGIN(TRACE_FLASH_PROGRAM, flash_offs);
+    __real_flash_range_program(flash_offs, data, count);
+    TRACE_END(TRACE_FLASH_PROGRAM, flash_offs);
+}
+
+void trace_dump(FILE* out) {
+    trace_frozen = true;
+    uint32_t head = trace_head;
+    uint32_t first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+
+    // Timestamps wrap every 71 minutes; each one is taken as following the last
+    uint64_t time_us = first < head ? trace_ring[first & (TRACE_EVENTS - 1)].time_us : 0;
+    uint32_t last_us = (uint32_t)time_us;
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (uint32_t slot = first; slot < head; slot++) {
+        const trace_record_t* record = &trace_ring[slot & (TRACE_EVENTS - 1)];
+        time_us += (uint32_t)(record->time_us - last_us);
+        last_us = record->time_us;
+
+        const trace_event_info_t* info = &event_info[record->event];
+        fprintf(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":1,%s\"args\":{\"%s\":%lu}}%s\n",
+                info->name, info->category, record->phase, (unsigned long long)time_us,
+                record->phase == 'i' ? "\"s\":\"t\"," : "", info->arg, (unsigned long)record->arg,
+                slot + 1 < head ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    fflush(out);
+    trace_frozen = false;
+}
+
+void trace_clear(void) {
+    trace_head = 0;
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// A ring of timestamped events from the paths a stalled copy goes through:
+// the MSC callbacks, every flash erase and program, the file system's
+// operations and the RTC's bus transfers. Each event is a few stores into
+// RAM; once the ring is full the oldest events are overwritten. Built in
+// with TRACE=1, and compiled out otherwise.
+//
+// Recording never blocks or masks interrupts. A record claims its slot by
+// moving the head on before filling it, so an event from an interrupt only
+// collides with another in the two instructions that takes.
+
+typedef enum {
+    TRACE_MSC_READ,      // Block address
+    TRACE_MSC_WRITE,     // Block address
+    TRACE_FLASH_ERASE,   // Flash offset
+    TRACE_FLASH_PROGRAM, // Flash offset
+    TRACE_FS_MOUNT,      // At the end, the FatFs result
+    TRACE_FS_RESUME,     // At the end, whether a transfer was finished
+    TRACE_FS_LOCK,       // At the end, whether the file was locked
+    TRACE_FS_UNLOCK,     // At the end, whether the capsule was restored
+    TRACE_FS_STABLE,     // At the end, whether the file's size held
+    TRACE_RTC_TRANSFER,  // First register, and bytes read in the next byte up
+    TRACE_RTC_ASYNC,     // First register, when a transfer is started in the background
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+// Events kept; a power of two
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 1024
+#endif
+
+#if TRACE
+#include "pico/stdlib.h"
+
+typedef struct {
+    uint32_t time_us; // time_us_32()
+    uint32_t arg;
+    uint8_t event;
+    char phase;       // 'B' begins a span, 'E' ends it and 'i' is an instant
+} trace_record_t;
+
+extern trace_record_t trace_ring[TRACE_EVENTS];
+extern volatile uint32_t trace_head;
+extern volatile bool trace_frozen;
+
+static inline void trace_record(trace_event_t event, char phase, uint32_t arg) {
+    if (trace_frozen) return;
+    uint32_t slot = trace_head;
+    trace_head = slot + 1;
+    trace_record_t* record = &trace_ring[slot & (TRACE_EVENTS - 1)];
+    record->time_us = time_us_32();
+    record->arg = arg;
+    record->event = (uint8_t)event;
+    record->phase = phase;
+}
+
+#define TRACE_BEGIN(event, arg) trace_record((event), 'B', (uint32_t)(arg))
+#define TRACE_END(event, arg) trace_record((event), 'E', (uint32_t)(arg))
+#define TRACE_INSTANT(event, arg) trace_record((event), 'i', (uint32_t)(arg))
+
+// Write the ring out, oldest event first, as Chrome trace event JSON, which
+// chrome://tracing and Perfetto open as a timeline. Recording stops while
+// it is written.
+void trace_dump(FILE* out);
+
+// Drop every event recorded so far
+void trace_clear(void);
+#else
+#define TRACE_BEGIN(event, arg) ((void)0)
+#define TRACE_END(event, arg) ((void)0)
+#define TRACE_INSTANT(event, arg) ((void)0)
+#endif
+
+#endif // TRACE_H
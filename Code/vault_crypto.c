@@ -0,0 +1,333 @@
+#include "vault_crypto.h"
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "rv3028.h"
+#include <string.h>
+
+// The key lives in the RTC's user EEPROM so a dump of the RP2040 flash alone
+// cannot decrypt a capsule.
+#define VAULT_KEY_EEPROM_ADDR 0x00
+
+#define POLY1305_LIMB_MASK 0x3ffffff
+
+static uint8_t vault_key[VAULT_KEY_SIZE];
+static bool key_loaded = false;
+
+static inline uint32_t load_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_le32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static bool is_blank_key(const uint8_t* key) {
+    uint8_t all_or = 0, all_and = 0xFF;
+    for (int i = 0; i < VAULT_KEY_SIZE; i++) {
+        all_or |= key[i];
+        all_and &= key[i];
+    }
+    return all_or == 0x00 || all_and == 0xFF;
+}
+
+bool vault_crypto_init(void) {
+    if (rv3028_read_user_eeprom(VAULT_KEY_EEPROM_ADDR, vault_key, VAULT_KEY_SIZE) != RV3028_SUCCESS) {
+        printf("Error: could not read vault key from RTC\n");
+        return false;
+    }
+
+    if (is_blank_key(vault_key)) {
+        printf("Generating vault key...\n");
+        for (int i = 0; i < VAULT_KEY_SIZE; i += 4) {
+            store_le32(&vault_key[i], get_rand_32());
+        }
+        if (rv3028_write_user_eeprom(VAULT_KEY_EEPROM_ADDR, vault_key, VAULT_KEY_SIZE) != RV3028_SUCCESS) {
+            printf("Error: could not store vault key in RTC\n");
+            return false;
+        }
+    }
+
+    key_loaded = true;
+    return true;
+}
+
+bool vault_crypto_ready(void) {
+    return key_loaded;
+}
+
+void vault_crypto_new_nonce(uint8_t nonce[VAULT_NONCE_SIZE]) {
+    for (int i = 0; i < VAULT_NONCE_SIZE; i += 4) {
+        store_le32(&nonce[i], get_rand_32());
+    }
+}
+
+// ChaCha20
+// The M0+ has a single-cycle ROR and 32-bit adds, so the plain ARX rounds compile
+// well. The block function runs from RAM to avoid XIP cache misses mid-stream.
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER_ROUND(a, b, c, d)               \
+    a += b; d ^= a; d = ROTL32(d, 16);          \
+    c += d; b ^= c; b = ROTL32(b, 12);          \
+    a += b; d ^= a; d = ROTL32(d, 8);           \
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+static void __not_in_flash_func(chacha20_block)(uint32_t state[16], uint8_t keystream[64]) {
+    uint32_t x0 = state[0], x1 = state[1], x2 = state[2], x3 = state[3];
+    uint32_t x4 = state[4], x5 = state[5], x6 = state[6], x7 = state[7];
+    uint32_t x8 = state[8], x9 = state[9], x10 = state[10], x11 = state[11];
+    uint32_t x12 = state[12], x13 = state[13], x14 = state[14], x15 = state[15];
+
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x0, x4, x8, x12);
+        QUARTER_ROUND(x1, x5, x9, x13);
+        QUARTER_ROUND(x2, x6, x10, x14);
+        QUARTER_ROUND(x3, x7, x11, x15);
+        QUARTER_ROUND(x0, x5, x10, x15);
+        QUARTER_ROUND(x1, x6, x11, x12);
+        QUARTER_ROUND(x2, x7, x8, x13);
+        QUARTER_ROUND(x3, x4, x9, x14);
+    }
+
+    store_le32(&keystream[0], x0 + state[0]);
+    store_le32(&keystream[4], x1 + state[1]);
+    store_le32(&keystream[8], x2 + state[2]);
+    store_le32(&keystream[12], x3 + state[3]);
+    store_le32(&keystream[16], x4 + state[4]);
+    store_le32(&keystream[20], x5 + state[5]);
+    store_le32(&keystream[24], x6 + state[6]);
+    store_le32(&keystream[28], x7 + state[7]);
+    store_le32(&keystream[32], x8 + state[8]);
+    store_le32(&keystream[36], x9 + state[9]);
+    store_le32(&keystream[40], x10 + state[10]);
+    store_le32(&keystream[44], x11 + state[11]);
+    store_le32(&keystream[48], x12 + state[12]);
+    store_le32(&keystream[52], x13 + state[13]);
+    store_le32(&keystream[56], x14 + state[14]);
+    store_le32(&keystream[60], x15 + state[15]);
+    state[12]++;
+}
+
+static void __not_in_flash_func(chacha20_xor)(vault_cipher_t* cipher, uint8_t* data, size_t len) {
+    while (len > 0) {
+        if (cipher->keystream_used == sizeof(cipher->keystream)) {
+            chacha20_block(cipher->state, cipher->keystream);
+            cipher->keystream_used = 0;
+        }
+
+        size_t n = sizeof(cipher->keystream) - cipher->keystream_used;
+        if (n > len) n = len;
+        const uint8_t* ks = &cipher->keystream[cipher->keystream_used];
+
+        // Whole blocks into word-aligned buffers (the usual case) XOR a word at a time
+        if (n == sizeof(cipher->keystream) && ((uintptr_t)data & 3) == 0) {
+            uint32_t* d = (uint32_t*)data;
+            const uint32_t* k = (const uint32_t*)ks;
+            for (int i = 0; i < 16; i++) d[i] ^= k[i];
+        } else {
+            for (size_t i = 0; i < n; i++) data[i] ^= ks[i];
+        }
+
+        cipher->keystream_used += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// Poly1305, 26-bit limbs (after poly1305-donna)
+static void __not_in_flash_func(poly1305_blocks)(vault_cipher_t* cipher, const uint8_t* m, size_t bytes, uint32_t hibit) {
+    const uint32_t r0 = cipher->r[0], r1 = cipher->r[1], r2 = cipher->r[2], r3 = cipher->r[3], r4 = cipher->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = cipher->h[0], h1 = cipher->h[1], h2 = cipher->h[2], h3 = cipher->h[3], h4 = cipher->h[4];
+
+    while (bytes >= 16) {
+        h0 += load_le32(m + 0) & POLY1305_LIMB_MASK;
+        h1 += (load_le32(m + 3) >> 2) & POLY1305_LIMB_MASK;
+        h2 += (load_le32(m + 6) >> 4) & POLY1305_LIMB_MASK;
+        h3 += (load_le32(m + 9) >> 6) & POLY1305_LIMB_MASK;
+        h4 += (load_le32(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c;
+        c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & POLY1305_LIMB_MASK;
+        d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & POLY1305_LIMB_MASK;
+        d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & POLY1305_LIMB_MASK;
+        d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & POLY1305_LIMB_MASK;
+        d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & POLY1305_LIMB_MASK;
+        h0 += c * 5; c = h0 >> 26; h0 &= POLY1305_LIMB_MASK;
+        h1 += c;
+
+        m += 16;
+        bytes -= 16;
+    }
+
+    cipher->h[0] = h0; cipher->h[1] = h1; cipher->h[2] = h2; cipher->h[3] = h3; cipher->h[4] = h4;
+}
+
+static void poly1305_update(vault_cipher_t* cipher, const uint8_t* m, size_t bytes) {
+    if (cipher->mac_buffered > 0) {
+        size_t want = 16 - cipher->mac_buffered;
+        if (want > bytes) want = bytes;
+        memcpy(&cipher->mac_buffer[cipher->mac_buffered], m, want);
+        cipher->mac_buffered += want;
+        m += want;
+        bytes -= want;
+        if (cipher->mac_buffered < 16) return;
+        poly1305_blocks(cipher, cipher->mac_buffer, 16, 1 << 24);
+        cipher->mac_buffered = 0;
+    }
+
+    size_t whole = bytes & ~(size_t)15;
+    if (whole > 0) {
+        poly1305_blocks(cipher, m, whole, 1 << 24);
+        m += whole;
+        bytes -= whole;
+    }
+
+    memcpy(cipher->mac_buffer, m, bytes);
+    cipher->mac_buffered = bytes;
+}
+
+static void chacha20_setup(uint32_t state[16], uint32_t counter, const uint8_t nonce[VAULT_NONCE_SIZE]) {
+    state[0] = 0x61707865; // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        state[4 + i] = load_le32(&vault_key[i * 4]);
+    }
+    state[12] = counter;
+    state[13] = load_le32(&nonce[0]);
+    state[14] = load_le32(&nonce[4]);
+    state[15] = load_le32(&nonce[8]);
+}
+
+// The last block counter is never reached by a payload (chunks are a few
+// KB), so fingerprints use it with the input as the nonce.
+void vault_crypto_fingerprint(const uint32_t input[3], uint32_t fingerprint[2]) {
+    uint32_t state[16];
+    uint8_t nonce[VAULT_NONCE_SIZE];
+    uint8_t block[64];
+    for (int i = 0; i < 3; i++) {
+        store_le32(&nonce[i * 4], input[i]);
+    }
+    chacha20_setup(state, 0xFFFFFFFF, nonce);
+    chacha20_block(state, block);
+    fingerprint[0] = load_le32(&block[0]);
+    fingerprint[1] = load_le32(&block[4]);
+}
+
+void vault_cipher_begin(vault_cipher_t* cipher, const uint8_t nonce[VAULT_NONCE_SIZE]) {
+    chacha20_setup(cipher->state, 0, nonce);
+
+    // Block 0 keys Poly1305; the payload is encrypted from block 1 onwards
+    uint8_t poly_key[64];
+    chacha20_block(cipher->state, poly_key);
+    cipher->r[0] = load_le32(&poly_key[0]) & 0x3ffffff;
+    cipher->r[1] = (load_le32(&poly_key[3]) >> 2) & 0x3ffff03;
+    cipher->r[2] = (load_le32(&poly_key[6]) >> 4) & 0x3ffc0ff;
+    cipher->r[3] = (load_le32(&poly_key[9]) >> 6) & 0x3f03fff;
+    cipher->r[4] = (load_le32(&poly_key[12]) >> 8) & 0x00fffff;
+    for (int i = 0; i < 4; i++) {
+        cipher->pad[i] = load_le32(&poly_key[16 + i * 4]);
+    }
+    memset(poly_key, 0, sizeof(poly_key));
+
+    memset(cipher->h, 0, sizeof(cipher->h));
+    cipher->keystream_used = sizeof(cipher->keystream);
+    cipher->mac_buffered = 0;
+    cipher->aad_length = 0;
+    cipher->length = 0;
+}
+
+void vault_cipher_associate(vault_cipher_t* cipher, const uint8_t* data, size_t len) {
+    static const uint8_t zeros[16] = {0};
+    poly1305_update(cipher, data, len);
+    if (len % 16) {
+        poly1305_update(cipher, zeros, 16 - (len % 16));
+    }
+    cipher->aad_length = len;
+}
+
+void vault_cipher_encrypt(vault_cipher_t* cipher, uint8_t* data, size_t len) {
+    chacha20_xor(cipher, data, len);
+    vault_cipher_authenticate(cipher, data, len);
+}
+
+void vault_cipher_authenticate(vault_cipher_t* cipher, const uint8_t* data, size_t len) {
+    poly1305_update(cipher, data, len);
+    cipher->length += len;
+}
+
+void vault_cipher_xor(vault_cipher_t* cipher, uint8_t* data, size_t len) {
+    chacha20_xor(cipher, data, len);
+}
+
+void vault_cipher_finish(vault_cipher_t* cipher, uint8_t tag[VAULT_TAG_SIZE]) {
+    // Pad the ciphertext to 16 bytes, then append le64(aad_len) || le64(ciphertext_len)
+    static const uint8_t zeros[16] = {0};
+    if (cipher->length % 16) {
+        poly1305_update(cipher, zeros, 16 - (cipher->length % 16));
+    }
+    uint8_t lengths[16];
+    store_le32(&lengths[0], (uint32_t)cipher->aad_length);
+    store_le32(&lengths[4], (uint32_t)(cipher->aad_length >> 32));
+    store_le32(&lengths[8], (uint32_t)cipher->length);
+    store_le32(&lengths[12], (uint32_t)(cipher->length >> 32));
+    poly1305_update(cipher, lengths, sizeof(lengths));
+
+    uint32_t h0 = cipher->h[0], h1 = cipher->h[1], h2 = cipher->h[2], h3 = cipher->h[3], h4 = cipher->h[4];
+    uint32_t c;
+
+    // Fully carry h
+    c = h1 >> 26; h1 &= POLY1305_LIMB_MASK;
+    h2 += c; c = h2 >> 26; h2 &= POLY1305_LIMB_MASK;
+    h3 += c; c = h3 >> 26; h3 &= POLY1305_LIMB_MASK;
+    h4 += c; c = h4 >> 26; h4 &= POLY1305_LIMB_MASK;
+    h0 += c * 5; c = h0 >> 26; h0 &= POLY1305_LIMB_MASK;
+    h1 += c;
+
+    // Compute h - p and select it if h >= p, without branching
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= POLY1305_LIMB_MASK;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= POLY1305_LIMB_MASK;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= POLY1305_LIMB_MASK;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= POLY1305_LIMB_MASK;
+    uint32_t g4 = h4 + c - (1UL << 26);
+
+    uint32_t select = (g4 >> 31) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+
+    // tag = (h + pad) mod 2^128
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    uint64_t f;
+    f = (uint64_t)h0 + cipher->pad[0];             store_le32(&tag[0], (uint32_t)f);
+    f = (uint64_t)h1 + cipher->pad[1] + (f >> 32); store_le32(&tag[4], (uint32_t)f);
+    f = (uint64_t)h2 + cipher->pad[2] + (f >> 32); store_le32(&tag[8], (uint32_t)f);
+    f = (uint64_t)h3 + cipher->pad[3] + (f >> 32); store_le32(&tag[12], (uint32_t)f);
+}
+
+bool vault_cipher_verify(vault_cipher_t* cipher, const uint8_t expected_tag[VAULT_TAG_SIZE]) {
+    uint8_t tag[VAULT_TAG_SIZE];
+    vault_cipher_finish(cipher, tag);
+
+    uint8_t diff = 0;
+    for (int i = 0; i < VAULT_TAG_SIZE; i++) {
+        diff |= tag[i] ^ expected_tag[i];
+    }
+    return diff == 0;
+}
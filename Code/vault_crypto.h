@@ -0,0 +1,67 @@
+#ifndef VAULT_CRYPTO_H
+#define VAULT_CRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define VAULT_KEY_SIZE   32
+#define VAULT_NONCE_SIZE 12
+#define VAULT_TAG_SIZE   16
+
+#ifndef VAULT_ENCRYPTION
+#define VAULT_ENCRYPTION 0
+#endif
+
+// Streaming ChaCha20-Poly1305 (RFC 8439) over one capsule.
+typedef struct {
+    uint32_t state[16];      // ChaCha20 input block; state[12] is the block counter
+    uint8_t keystream[64];
+    size_t keystream_used;
+    uint32_t r[5];           // Poly1305 key and accumulator, 26-bit limbs
+    uint32_t h[5];
+    uint32_t pad[4];
+    uint8_t mac_buffer[16];
+    size_t mac_buffered;
+    uint64_t aad_length;     // Bytes of associated data
+    uint64_t length;         // Bytes authenticated so far
+} vault_cipher_t;
+
+// Load the vault key from the RTC's user EEPROM, generating it on first use.
+// Must be called after the RTC is initialized.
+bool vault_crypto_init(void);
+
+// Returns true once a vault key is available.
+bool vault_crypto_ready(void);
+
+// Fill a fresh random nonce for a new capsule.
+void vault_crypto_new_nonce(uint8_t nonce[VAULT_NONCE_SIZE]);
+
+// Keyed 64-bit fingerprint of a short input, so the dedup index does not
+// reveal which chunks hold known content.
+void vault_crypto_fingerprint(const uint32_t input[3], uint32_t fingerprint[2]);
+
+// Start processing a capsule from its first byte.
+void vault_cipher_begin(vault_cipher_t* cipher, const uint8_t nonce[VAULT_NONCE_SIZE]);
+
+// Add associated data to the MAC, once, before anything is encrypted or
+// authenticated. The vault has none; the RFC's test vectors do.
+void vault_cipher_associate(vault_cipher_t* cipher, const uint8_t* data, size_t len);
+
+// Encrypt data in place and add the ciphertext to the MAC.
+void vault_cipher_encrypt(vault_cipher_t* cipher, uint8_t* data, size_t len);
+
+// Add ciphertext to the MAC without decrypting it.
+void vault_cipher_authenticate(vault_cipher_t* cipher, const uint8_t* data, size_t len);
+
+// Encrypt or decrypt data in place without touching the MAC. Ciphertext
+// must be authenticated before its plaintext is used.
+void vault_cipher_xor(vault_cipher_t* cipher, uint8_t* data, size_t len);
+
+// Produce the tag over everything encrypted or authenticated since vault_cipher_begin().
+void vault_cipher_finish(vault_cipher_t* cipher, uint8_t tag[VAULT_TAG_SIZE]);
+
+// Finish the MAC and compare it to an expected tag in constant time.
+bool vault_cipher_verify(vault_cipher_t* cipher, const uint8_t expected_tag[VAULT_TAG_SIZE]);
+
+#endif // VAULT_CRYPTO_H
@@ -0,0 +1,772 @@
+#include "vault_dedup.h"
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "hardware/flash.h"
+#include "dma_crc.h"
+#include "partition.h"
+#include "vault_crypto.h"
+#include <string.h>
+
+#define CDC_AVERAGE_BITS 11     // Past the minimum, a boundary every 2 KB on average
+#define GEAR_WINDOW 32          // The gear hash only depends on this many trailing bytes
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+#define ENTRY_SIZE 32
+#define MAX_ENTRIES 1024
+#define ENTRY_LIVE 0xFFFF
+#define ENTRY_REUSABLE 0x00FF   // Left by compaction in a dropped entry's slot; a new entry is programmed over it
+#define ENTRY_DEAD 0x0000       // Programmed over live once the chunk's bytes are gone
+#define INDEX_MAGIC 0x48584449  // "IDXH"
+
+#define PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define MAX_STORE_SECTORS (FLASH_TOTAL_SIZE / FLASH_SECTOR_SIZE)
+#define NO_SECTOR 0xFFFFFFFF
+
+// Last slot of each index half, naming the half that is current
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint8_t reserved[ENTRY_SIZE - 12];
+    uint32_t crc; // CRC-32 of everything above
+} index_header_t;
+
+typedef enum {
+    COMPACT_IDLE = 0,
+    COMPACT_TOMBSTONE,      // Mark the victim's unreferenced entries dead
+    COMPACT_MOVE,           // Copy the victim's live chunks nearer the end
+    COMPACT_INDEX_ERASE,    // Erase the other index half
+    COMPACT_INDEX_WRITE,    // Copy the referenced entries into it with their new locations
+    COMPACT_INDEX_COMMIT,   // Write its header, making it current
+    COMPACT_ERASE           // Erase the victim
+} compact_phase_t;
+
+typedef struct {
+    uint16_t id;
+    uint32_t location;
+} relocation_t;
+
+static uint32_t gear[256];
+
+static uint32_t index_offset;
+static uint32_t half_size;          // Each index half, a whole number of sectors
+static uint32_t index_capacity;     // Entries per half, not counting the header slot
+static uint32_t active_half;
+static uint32_t generation;
+static uint32_t free_entries;       // Erased and reusable slots in the current half
+static uint16_t refcounts[MAX_ENTRIES];
+
+// The store is handed out a sector at a time, counted from its end so the
+// numbering survives the start moving. Chunks are packed into the open
+// sector and never straddle two.
+static uint32_t store_offset;
+static uint32_t store_size;
+static uint32_t store_sectors;
+static uint32_t sector_bitmap[(MAX_STORE_SECTORS + 31) / 32]; // Set if the sector is not free
+static uint8_t sector_live[MAX_STORE_SECTORS];                 // Pages of referenced chunks
+static uint32_t free_hint;          // No free sector below this one
+static uint32_t open_sector = NO_SECTOR;
+static uint32_t open_page;
+
+static struct {
+    compact_phase_t phase;
+    uint32_t victim;
+    uint32_t cursor;
+    uint32_t moves;
+    relocation_t relocations[PAGES_PER_SECTOR];
+    uint32_t erasable[(MAX_ENTRIES + 31) / 32]; // Dropped slots the new half can leave erased
+    bool idle;              // Nothing to do until the store changes
+} compact;
+static uint8_t compact_buffer[FLASH_SECTOR_SIZE];
+
+// Content-defined chunking
+
+// Boundaries must fall in the same places on every boot, so the table comes
+// from a fixed xorshift sequence rather than the random number generator.
+static void init_gear(void) {
+    uint32_t x = 0x9E3779B9;
+    for (int i = 0; i < 256; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        gear[i] = x;
+    }
+}
+
+void vault_chunker_reset(vault_chunker_t* chunker) {
+    chunker->gear_hash = 0;
+    chunker->content_hash = FNV_OFFSET_BASIS;
+    chunker->length = 0;
+}
+
+size_t __not_in_flash_func(vault_chunker_scan)(vault_chunker_t* chunker, const uint8_t* data, size_t len, bool* boundary) {
+    uint32_t gear_hash = chunker->gear_hash;
+    uint32_t content_hash = chunker->content_hash;
+    uint32_t length = chunker->length;
+    size_t i = 0;
+
+    *boundary = false;
+    while (i < len) {
+        uint8_t byte = data[i++];
+        content_hash = (content_hash ^ byte) * FNV_PRIME;
+        length++;
+
+        // No boundary can fall before the minimum, so the rolling hash only
+        // needs to see the window leading up to it.
+        if (length <= VAULT_CHUNK_MIN - GEAR_WINDOW) continue;
+        gear_hash = (gear_hash << 1) + gear[byte];
+
+        if (length >= VAULT_CHUNK_MAX || (length >= VAULT_CHUNK_MIN && (gear_hash >> (32 - CDC_AVERAGE_BITS)) == 0)) {
+            *boundary = true;
+            break;
+        }
+    }
+
+    chunker->gear_hash = gear_hash;
+    chunker->content_hash = content_hash;
+    chunker->length = length;
+    return i;
+}
+
+// Chunk index
+
+static const vault_chunk_t* half_entry_at(uint32_t half, uint32_t id) {
+    return (const vault_chunk_t*)(XIP_BASE + index_offset + half * half_size + id * ENTRY_SIZE);
+}
+
+static const vault_chunk_t* entry_at(uint32_t id) {
+    return half_entry_at(active_half, id);
+}
+
+static const index_header_t* header_at(uint32_t half) {
+    return (const index_header_t*)half_entry_at(half, index_capacity);
+}
+
+static uint32_t entry_check(const vault_chunk_t* entry) {
+    return dma_crc32(entry, NULL, offsetof(vault_chunk_t, live));
+}
+
+static bool is_valid_header(const index_header_t* header) {
+    return header->magic == INDEX_MAGIC && header->crc == dma_crc32(header, NULL, offsetof(index_header_t, crc));
+}
+
+static bool is_erased_entry(const vault_chunk_t* entry) {
+    const uint32_t* words = (const uint32_t*)entry;
+    for (size_t i = 0; i < ENTRY_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+static uint32_t stored_size(uint32_t length) {
+    return (length + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+}
+
+static uint32_t sector_address(uint32_t sector) {
+    return store_offset + store_size - (sector + 1) * FLASH_SECTOR_SIZE;
+}
+
+static uint32_t sector_of(uint32_t location) {
+    return (store_offset + store_size - 1 - location) / FLASH_SECTOR_SIZE;
+}
+
+static bool is_valid_entry(const vault_chunk_t* entry) {
+    if (entry->length == 0 || entry->length > VAULT_CHUNK_MAX) return false;
+    if (entry->location < store_offset || entry->location >= store_offset + store_size) return false;
+    if (entry->location % FLASH_PAGE_SIZE) return false;
+    uint32_t sector_end = sector_address(sector_of(entry->location)) + FLASH_SECTOR_SIZE;
+    return entry->location + stored_size(entry->length) <= sector_end && entry->check == entry_check(entry);
+}
+
+static bool is_live_entry(const vault_chunk_t* entry) {
+    return entry->live != ENTRY_DEAD && is_valid_entry(entry);
+}
+
+static bool is_reusable_entry(const vault_chunk_t* entry) {
+    vault_chunk_t reusable;
+    memset(&reusable, 0xFF, sizeof(reusable));
+    reusable.live = ENTRY_REUSABLE;
+    return memcmp(entry, &reusable, sizeof(reusable)) == 0;
+}
+
+static bool is_encrypted_entry(const vault_chunk_t* entry) {
+    return entry->nonce[0] != 0 || entry->nonce[1] != 0;
+}
+
+static void begin_chunk_cipher(vault_cipher_t* cipher, const vault_chunk_t* entry) {
+    uint8_t nonce[VAULT_NONCE_SIZE] = {0};
+    memcpy(nonce, entry->nonce, sizeof(entry->nonce));
+    vault_cipher_begin(cipher, nonce);
+}
+
+// Fingerprints are 64 bits, but a false match would silently corrupt a
+// capsule, so a candidate is compared byte for byte, a block at a time.
+static bool same_content(const vault_chunk_t* entry, const uint8_t* chunk, size_t len) {
+    const uint8_t* stored = vault_dedup_data(entry);
+    if (!is_encrypted_entry(entry)) {
+        return memcmp(stored, chunk, len) == 0;
+    }
+
+    vault_cipher_t cipher;
+    uint8_t block[64];
+    begin_chunk_cipher(&cipher, entry);
+    for (size_t offset = 0; offset < len; offset += sizeof(block)) {
+        size_t n = len - offset < sizeof(block) ? len - offset : sizeof(block);
+        memcpy(block, stored + offset, n);
+        vault_cipher_xor(&cipher, block, n);
+        if (memcmp(block, chunk + offset, n) != 0) return false;
+    }
+    return true;
+}
+
+static void erase_sector(uint32_t offset) {
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+}
+
+// Program a 32-byte slot's whole page with everything else left at 0xFF,
+// as the journal does.
+static void program_slot(uint32_t half, uint32_t id, const void* slot) {
+    uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t slot_offset = half * half_size + id * ENTRY_SIZE;
+    uint32_t page_offset = slot_offset & ~(FLASH_PAGE_SIZE - 1);
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page + (slot_offset - page_offset), slot, ENTRY_SIZE);
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(index_offset + page_offset, page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+}
+
+// Store allocation
+
+static bool is_sector_used(uint32_t sector) {
+    return sector_bitmap[sector / 32] & (1u << (sector % 32));
+}
+
+static void set_sector_used(uint32_t sector) {
+    sector_bitmap[sector / 32] |= 1u << (sector % 32);
+}
+
+static void set_sector_free(uint32_t sector) {
+    sector_bitmap[sector / 32] &= ~(1u << (sector % 32));
+    if (sector < free_hint) free_hint = sector;
+}
+
+// Sectors nearest the end are used first, so live data stays packed there
+// and free space gathers towards the disk.
+static uint32_t first_free_sector(void) {
+    for (uint32_t word = free_hint / 32; word * 32 < store_sectors; word++) {
+        uint32_t free_bits = ~sector_bitmap[word];
+        if (word == free_hint / 32) free_bits &= ~0u << (free_hint % 32);
+        if (free_bits == 0) continue;
+
+        uint32_t sector = word * 32 + __builtin_ctz(free_bits);
+        free_hint = sector;
+        return sector < store_sectors ? sector : NO_SECTOR;
+    }
+    free_hint = store_sectors;
+    return NO_SECTOR;
+}
+
+static bool is_erased_sector(uint32_t sector) {
+    const uint32_t* words = (const uint32_t*)(XIP_BASE + sector_address(sector));
+    for (size_t i = 0; i < FLASH_SECTOR_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+// Find room for a chunk in a sector below limit. A free sector can still
+// hold bytes from an interrupted move that no entry points at, so it is
+// checked before use.
+static uint32_t allocate(uint32_t size, uint32_t limit) {
+    uint32_t pages = size / FLASH_PAGE_SIZE;
+    if (open_sector == NO_SECTOR || open_sector >= limit || open_page + pages > PAGES_PER_SECTOR) {
+        uint32_t sector = first_free_sector();
+        if (sector == NO_SECTOR || sector >= limit) return 0;
+        if (!is_erased_sector(sector)) erase_sector(sector_address(sector));
+        set_sector_used(sector);
+        open_sector = sector;
+        open_page = 0;
+    }
+
+    uint32_t location = sector_address(open_sector) + open_page * FLASH_PAGE_SIZE;
+    open_page += pages;
+    return location;
+}
+
+static void add_live(const vault_chunk_t* entry, int sign) {
+    uint32_t sector = sector_of(entry->location);
+    sector_live[sector] += sign * (int)(stored_size(entry->length) / FLASH_PAGE_SIZE);
+}
+
+static void erase_range(uint32_t offset, uint32_t size) {
+    for (uint32_t end = offset + size; offset < end; offset += FLASH_SECTOR_SIZE) {
+        erase_sector(offset);
+    }
+}
+
+void vault_dedup_init(uint32_t index_flash_offset, uint32_t index_size, uint32_t store_flash_offset, uint32_t store_flash_size) {
+    init_gear();
+    index_offset = index_flash_offset;
+    half_size = (index_size / 2) & ~(FLASH_SECTOR_SIZE - 1);
+    index_capacity = half_size / ENTRY_SIZE - 1;
+    if (index_capacity > MAX_ENTRIES) index_capacity = MAX_ENTRIES;
+    memset(refcounts, 0, sizeof(refcounts));
+    memset(&compact, 0, sizeof(compact));
+
+    // The half with the newest header is current. Until the first
+    // compaction neither has one and the first half is used.
+    active_half = 0;
+    generation = 0;
+    for (uint32_t half = 0; half < 2; half++) {
+        const index_header_t* header = header_at(half);
+        if (is_valid_header(header) && (int32_t)(header->generation - generation) > 0) {
+            active_half = half;
+            generation = header->generation;
+        }
+    }
+
+    // An entry is programmed before its chunk, so every sector holding bytes
+    // has an entry pointing into it. A torn entry never got its chunk.
+    memset(sector_bitmap, 0, sizeof(sector_bitmap));
+    memset(sector_live, 0, sizeof(sector_live));
+    open_sector = NO_SECTOR;
+    free_hint = 0;
+    vault_dedup_set_store(store_flash_offset, store_flash_size);
+    free_entries = 0;
+    for (uint32_t id = 0; id < index_capacity; id++) {
+        const vault_chunk_t* entry = entry_at(id);
+        if (is_live_entry(entry)) set_sector_used(sector_of(entry->location));
+        if (is_erased_entry(entry) || is_reusable_entry(entry)) free_entries++;
+    }
+}
+
+uint16_t vault_dedup_put(uint8_t* chunk, size_t len, uint32_t content_hash) {
+    bool encrypt = VAULT_ENCRYPTION && vault_crypto_ready();
+    uint32_t input[3] = { dma_crc32(chunk, NULL, len), content_hash, len };
+    uint32_t fingerprint[2];
+    if (encrypt) {
+        vault_crypto_fingerprint(input, fingerprint);
+    } else {
+        fingerprint[0] = input[0];
+        fingerprint[1] = input[1];
+    }
+
+    // Linear probing from the fingerprint's home slot. The first erased slot
+    // ends the search; a new chunk goes there, or in the first reusable slot
+    // passed on the way.
+    uint32_t home = fingerprint[0] % index_capacity;
+    uint32_t id = index_capacity;
+    for (uint32_t probe = 0; probe < index_capacity; probe++) {
+        uint32_t candidate = (home + probe) % index_capacity;
+        const vault_chunk_t* entry = entry_at(candidate);
+        if (is_erased_entry(entry)) {
+            if (id == index_capacity) id = candidate;
+            break;
+        }
+        if (is_reusable_entry(entry)) {
+            if (id == index_capacity) id = candidate;
+            continue;
+        }
+        if (entry->live != ENTRY_DEAD && entry->length == len &&
+            entry->fingerprint[0] == fingerprint[0] && entry->fingerprint[1] == fingerprint[1] &&
+            is_valid_entry(entry) && same_content(entry, chunk, len)) {
+            vault_dedup_ref(candidate);
+            return candidate;
+        }
+    }
+
+    if (id == index_capacity) {
+        printf("Vault chunk index full\n");
+        return VAULT_NO_CHUNK;
+    }
+
+    uint32_t size = stored_size(len);
+    vault_chunk_t entry;
+    entry.location = allocate(size, store_sectors);
+    if (entry.location == 0) {
+        printf("Vault chunk store full\n");
+        return VAULT_NO_CHUNK;
+    }
+    entry.fingerprint[0] = fingerprint[0];
+    entry.fingerprint[1] = fingerprint[1];
+    entry.nonce[0] = encrypt ? get_rand_32() : 0;
+    entry.nonce[1] = encrypt ? get_rand_32() : 0;
+    entry.length = len;
+    entry.live = is_reusable_entry(entry_at(id)) ? ENTRY_REUSABLE : ENTRY_LIVE;
+
+    if (is_encrypted_entry(&entry)) {
+        vault_cipher_t cipher;
+        begin_chunk_cipher(&cipher, &entry);
+        vault_cipher_xor(&cipher, chunk, len);
+    }
+
+    // Pad the tail to a whole page; erased flash is 0xFF so the padding is a no-op
+    memset(chunk + len, 0xFF, size - len);
+    entry.crc = dma_crc32(chunk, NULL, len);
+    entry.check = entry_check(&entry);
+
+    // The entry goes first, so the sector is known to be in use even if the
+    // chunk write is interrupted
+    program_slot(active_half, id, &entry);
+    free_entries--;
+    if (!is_valid_entry(entry_at(id))) {
+        printf("Vault chunk index write failed\n");
+        return VAULT_NO_CHUNK;
+    }
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(entry.location, chunk, size);
+    restore_interrupts(ints);
+
+    if (dma_crc32(vault_dedup_data(&entry), NULL, len) != entry.crc) {
+        printf("Vault chunk write failed\n");
+        return VAULT_NO_CHUNK;
+    }
+
+    vault_dedup_ref(id);
+    return id;
+}
+
+void vault_dedup_ref(uint16_t id) {
+    if (id >= index_capacity) return;
+    if (refcounts[id]++ == 0) {
+        const vault_chunk_t* entry = entry_at(id);
+        if (is_live_entry(entry)) add_live(entry, 1);
+    }
+}
+
+void vault_dedup_unref(uint16_t id) {
+    if (id >= index_capacity || refcounts[id] == 0) return;
+    if (--refcounts[id] == 0) {
+        const vault_chunk_t* entry = entry_at(id);
+        if (is_live_entry(entry)) add_live(entry, -1);
+        compact.idle = false;
+    }
+}
+
+void vault_dedup_set_store(uint32_t store_flash_offset, uint32_t store_flash_size) {
+    store_offset = store_flash_offset;
+    store_size = store_flash_size;
+    store_sectors = store_size / FLASH_SECTOR_SIZE;
+    if (store_sectors > MAX_STORE_SECTORS) store_sectors = MAX_STORE_SECTORS;
+    if (free_hint > store_sectors) free_hint = store_sectors;
+    compact.idle = false;
+}
+
+uint32_t vault_dedup_bytes_stored(void) {
+    uint32_t pages = 0;
+    for (uint32_t sector = 0; sector < store_sectors; sector++) {
+        pages += sector_live[sector];
+    }
+    return pages * FLASH_PAGE_SIZE;
+}
+
+void vault_dedup_room(uint32_t* bytes, uint32_t* entries) {
+    uint32_t free_sectors = 0;
+    for (uint32_t sector = 0; sector < store_sectors; sector++) {
+        if (!is_sector_used(sector)) free_sectors++;
+    }
+    *bytes = free_sectors * FLASH_SECTOR_SIZE;
+    if (open_sector != NO_SECTOR && open_sector < store_sectors) {
+        *bytes += (PAGES_PER_SECTOR - open_page) * FLASH_PAGE_SIZE;
+    }
+    *entries = free_entries;
+}
+
+uint32_t vault_dedup_extent(void) {
+    for (uint32_t sector = store_sectors; sector > 0; sector--) {
+        if (is_sector_used(sector - 1)) return sector * FLASH_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+// Compaction
+
+// Whether an index rewrite copies a slot's entry: only chunks something
+// still references are kept.
+static bool is_kept(uint32_t id) {
+    return refcounts[id] > 0 && is_live_entry(entry_at(id));
+}
+
+// Entries an index rewrite would drop: dead ones, and live ones nothing
+// references.
+static uint32_t droppable_entries(void) {
+    uint32_t count = 0;
+    for (uint32_t id = 0; id < index_capacity; id++) {
+        const vault_chunk_t* entry = entry_at(id);
+        if (!is_kept(id) && !is_erased_entry(entry) && !is_reusable_entry(entry)) count++;
+    }
+    return count;
+}
+
+// A victim is either a sector holding nothing referenced, which only needs
+// its entries marked dead and an erase, or the used sector furthest from
+// the end while there is a free sector nearer to it, or room for all of it
+// in the open one. Moving chunks only ever towards the end means compaction
+// always finishes, with the free space left in one run next to the disk.
+static bool pick_victim(void) {
+    uint32_t first_free = first_free_sector();
+    if (open_sector != NO_SECTOR && first_free != NO_SECTOR && open_sector > first_free) {
+        open_sector = NO_SECTOR; // Close it so it can be moved too
+    }
+
+    for (uint32_t sector = store_sectors; sector > 0; sector--) {
+        uint32_t victim = sector - 1;
+        if (!is_sector_used(victim) || victim == open_sector) continue;
+        if (sector_live[victim] == 0) {
+            compact.phase = COMPACT_TOMBSTONE;
+        } else if ((first_free != NO_SECTOR && first_free < victim) ||
+                   (open_sector < victim && open_page + sector_live[victim] <= PAGES_PER_SECTOR)) {
+            compact.phase = COMPACT_MOVE;
+        } else {
+            continue;
+        }
+        compact.victim = victim;
+        compact.cursor = 0;
+        compact.moves = 0;
+        return true;
+    }
+
+    // With no sector to work on, the index is rewritten on its own once the
+    // entries it would drop outnumber its free slots
+    if (droppable_entries() > free_entries) {
+        compact.phase = COMPACT_INDEX_ERASE;
+        compact.victim = NO_SECTOR;
+        compact.cursor = 0;
+        compact.moves = 0;
+        return true;
+    }
+    return false;
+}
+
+static bool in_victim(const vault_chunk_t* entry) {
+    return is_live_entry(entry) && sector_of(entry->location) == compact.victim;
+}
+
+// Mark the next unreferenced entry in the victim dead, so nothing can match
+// it once the sector is erased and reused.
+static void tombstone_step(void) {
+    for (; compact.cursor < index_capacity; compact.cursor++) {
+        const vault_chunk_t* entry = entry_at(compact.cursor);
+        if (!in_victim(entry)) continue;
+
+        vault_chunk_t dead = *entry;
+        dead.live = ENTRY_DEAD;
+        program_slot(active_half, compact.cursor++, &dead);
+        return;
+    }
+    compact.phase = COMPACT_ERASE;
+}
+
+// Copy the victim's next referenced chunk into a sector nearer the end. Its
+// entry only changes when the new index half is committed.
+static void move_step(void) {
+    for (; compact.cursor < index_capacity; compact.cursor++) {
+        const vault_chunk_t* entry = entry_at(compact.cursor);
+        if (!in_victim(entry) || refcounts[compact.cursor] == 0) continue;
+
+        uint32_t size = stored_size(entry->length);
+        uint32_t location = allocate(size, compact.victim);
+        if (location == 0) break; // No room nearer the end after all
+
+        memcpy(compact_buffer, vault_dedup_data(entry), size);
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_program(location, compact_buffer, size);
+        restore_interrupts(ints);
+
+        if (dma_crc32((const void*)(XIP_BASE + location), NULL, entry->length) == entry->crc) {
+            compact.relocations[compact.moves].id = compact.cursor;
+            compact.relocations[compact.moves].location = location;
+            compact.moves++;
+        }
+        compact.cursor++;
+        return;
+    }
+
+    compact.phase = compact.moves > 0 ? COMPACT_INDEX_ERASE : COMPACT_IDLE;
+    compact.cursor = 0;
+}
+
+// A dropped slot can be left erased in the new half if the first slot after
+// it that is not dropped is erased too, since then no probe chain runs
+// through it to a kept entry. Otherwise it is left reusable, which probing
+// passes over.
+static void plan_index_rewrite(void) {
+    memset(compact.erasable, 0, sizeof(compact.erasable));
+    bool erased_after = true;
+    for (uint32_t i = 2 * index_capacity; i > 0; i--) {
+        uint32_t id = (i - 1) % index_capacity;
+        if (is_kept(id)) {
+            erased_after = false;
+        } else if (is_erased_entry(entry_at(id))) {
+            erased_after = true;
+        } else if (erased_after && i <= index_capacity) {
+            compact.erasable[id / 32] |= 1u << (id % 32);
+        }
+    }
+}
+
+// Fill one sector of the new half. Each kept entry goes to the same slot, so
+// chunk ids and probe sequences are unchanged, with a moved chunk's new
+// location. Dead and unreferenced entries are dropped, so their slots can
+// take new chunks.
+static void index_write_step(void) {
+    uint32_t target = active_half ^ 1;
+    uint32_t first = compact.cursor * (FLASH_SECTOR_SIZE / ENTRY_SIZE);
+    if (compact.cursor == 0) plan_index_rewrite();
+    memset(compact_buffer, 0xFF, sizeof(compact_buffer));
+
+    for (uint32_t i = 0; i < FLASH_SECTOR_SIZE / ENTRY_SIZE && first + i < index_capacity; i++) {
+        uint32_t id = first + i;
+        const vault_chunk_t* entry = entry_at(id);
+        vault_chunk_t* copy = (vault_chunk_t*)(compact_buffer + i * ENTRY_SIZE);
+        if (!is_kept(id)) {
+            bool erasable = compact.erasable[id / 32] & (1u << (id % 32));
+            if (!is_erased_entry(entry) && !erasable) copy->live = ENTRY_REUSABLE;
+            continue;
+        }
+
+        *copy = *entry;
+        copy->live = ENTRY_LIVE;
+        for (uint32_t m = 0; m < compact.moves; m++) {
+            if (compact.relocations[m].id == id) {
+                copy->location = compact.relocations[m].location;
+                copy->check = entry_check(copy);
+            }
+        }
+    }
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(index_offset + target * half_size + compact.cursor * FLASH_SECTOR_SIZE, compact_buffer, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+
+    if (++compact.cursor * FLASH_SECTOR_SIZE >= half_size) {
+        compact.phase = COMPACT_INDEX_COMMIT;
+    }
+}
+
+// The new half becomes current with its header. Until then the old half
+// and the victim's bytes are untouched, so stopping anywhere before this
+// loses nothing but the copies.
+static void index_commit_step(void) {
+    uint32_t target = active_half ^ 1;
+    index_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_MAGIC;
+    header.generation = generation + 1;
+    header.crc = dma_crc32(&header, NULL, offsetof(index_header_t, crc));
+    program_slot(target, index_capacity, &header);
+
+    if (!is_valid_header(header_at(target))) {
+        printf("Vault index commit failed\n");
+        compact.phase = COMPACT_IDLE;
+        return;
+    }
+
+    active_half = target;
+    generation = header.generation;
+    free_entries = 0;
+    for (uint32_t id = 0; id < index_capacity; id++) {
+        if (is_erased_entry(entry_at(id)) || is_reusable_entry(entry_at(id))) free_entries++;
+    }
+    for (uint32_t m = 0; m < compact.moves; m++) {
+        uint32_t pages = stored_size(entry_at(compact.relocations[m].id)->length) / FLASH_PAGE_SIZE;
+        sector_live[compact.victim] -= pages;
+        sector_live[sector_of(compact.relocations[m].location)] += pages;
+    }
+    bool emptied = compact.victim != NO_SECTOR && sector_live[compact.victim] == 0;
+    compact.phase = emptied ? COMPACT_ERASE : COMPACT_IDLE;
+}
+
+bool vault_dedup_compact_step(void) {
+    switch (compact.phase) {
+    case COMPACT_IDLE:
+        if (compact.idle) return false;
+        if (!pick_victim()) {
+            compact.idle = true;
+            return false;
+        }
+        break;
+    case COMPACT_TOMBSTONE:
+        tombstone_step();
+        break;
+    case COMPACT_MOVE:
+        move_step();
+        break;
+    case COMPACT_INDEX_ERASE:
+        erase_sector(index_offset + (active_half ^ 1) * half_size + compact.cursor * FLASH_SECTOR_SIZE);
+        if (++compact.cursor * FLASH_SECTOR_SIZE >= half_size) {
+            compact.phase = COMPACT_INDEX_WRITE;
+            compact.cursor = 0;
+        }
+        break;
+    case COMPACT_INDEX_WRITE:
+        index_write_step();
+        break;
+    case COMPACT_INDEX_COMMIT:
+        index_commit_step();
+        break;
+    case COMPACT_ERASE:
+        erase_sector(sector_address(compact.victim));
+        set_sector_free(compact.victim);
+        compact.phase = COMPACT_IDLE;
+        break;
+    }
+    return true;
+}
+
+void vault_dedup_compact_abort(void) {
+    compact.phase = COMPACT_IDLE;
+    compact.idle = false;
+}
+
+static bool index_is_erased(void) {
+    for (uint32_t id = 0; id <= index_capacity; id++) {
+        if (!is_erased_entry(entry_at(id))) return false;
+    }
+    return true;
+}
+
+// Chunks nobody references stay in place and can still be matched by a
+// later capsule until compaction reclaims their sector. Once the whole vault
+// is empty everything goes at once.
+void vault_dedup_reset_if_unused(void) {
+    for (uint32_t id = 0; id < index_capacity; id++) {
+        if (refcounts[id] > 0) return;
+    }
+    uint32_t extent = vault_dedup_extent();
+    if (extent == 0 && index_is_erased()) return;
+
+    vault_dedup_compact_abort();
+    erase_range(index_offset, 2 * half_size);
+    erase_range(store_offset + store_size - extent, extent);
+    memset(sector_bitmap, 0, sizeof(sector_bitmap));
+    memset(sector_live, 0, sizeof(sector_live));
+    open_sector = NO_SECTOR;
+    free_hint = 0;
+    active_half = 0;
+    generation = 0;
+    free_entries = index_capacity;
+}
+
+const vault_chunk_t* vault_dedup_chunk(uint16_t id) {
+    if (id >= index_capacity) return NULL;
+    const vault_chunk_t* entry = entry_at(id);
+    return is_live_entry(entry) ? entry : NULL;
+}
+
+const uint8_t* vault_dedup_data(const vault_chunk_t* chunk) {
+    return (const uint8_t*)(XIP_BASE + chunk->location);
+}
+
+void vault_dedup_decrypt(const vault_chunk_t* chunk, uint8_t* data) {
+    if (!is_encrypted_entry(chunk)) return;
+
+    vault_cipher_t cipher;
+    begin_chunk_cipher(&cipher, chunk);
+    vault_cipher_xor(&cipher, data, chunk->length);
+}
@@ -0,0 +1,96 @@
+#ifndef VAULT_DEDUP_H
+#define VAULT_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Capsules are split into content-defined chunks: a boundary falls wherever
+// a gear rolling hash over the last few dozen bytes hits a fixed pattern, so
+// an edit only changes the chunks around it and identical content chunks the
+// same way in every file. Chunks average about 3 KB.
+#define VAULT_CHUNK_MIN 1024
+#define VAULT_CHUNK_MAX 4096
+
+#define VAULT_NO_CHUNK 0xFFFF
+
+typedef struct {
+    uint32_t gear_hash;
+    uint32_t content_hash;   // FNV-1a over the whole chunk, half of its fingerprint
+    uint32_t length;
+} vault_chunker_t;
+
+// Index entry for a stored chunk. Entries live in flash in an open-addressed
+// table keyed by fingerprint; lookups probe flash directly, so the only RAM
+// per chunk is its reference count. The index has two halves: compaction
+// writes a copy with moved chunks' new locations into the other half, so a
+// chunk keeps its id (its slot) wherever its bytes end up. Entries nothing
+// references are left out of the copy, and their slots take new chunks.
+typedef struct {
+    uint32_t fingerprint[2];
+    uint32_t nonce[2];       // Random per-chunk nonce, zero if the chunk is stored in the clear
+    uint32_t crc;            // CRC-32 of the stored bytes
+    uint32_t location;       // Flash offset of the stored bytes
+    uint16_t length;
+    uint16_t live;           // Not zero while the chunk may be referenced
+    uint32_t check;          // CRC-32 of the fields before live
+} vault_chunk_t;
+
+void vault_chunker_reset(vault_chunker_t* chunker);
+
+// Consume data up to the end of the current chunk and return how many bytes
+// belong to it. Sets *boundary if the chunk ends there.
+size_t vault_chunker_scan(vault_chunker_t* chunker, const uint8_t* data, size_t len, bool* boundary);
+
+// Pick the current index half and rebuild the store's allocation bitmap
+// from it. Reference counts start at zero; the caller adds one per use from
+// its capsule recipes.
+void vault_dedup_init(uint32_t index_offset, uint32_t index_size, uint32_t store_offset, uint32_t store_size);
+
+// Store a chunk, or find an identical one already stored, and take a
+// reference to it. The buffer must hold VAULT_CHUNK_MAX bytes; it is
+// encrypted in place when the chunk is new. Returns VAULT_NO_CHUNK if the
+// store or index is full.
+uint16_t vault_dedup_put(uint8_t* chunk, size_t len, uint32_t content_hash);
+
+void vault_dedup_ref(uint16_t id);
+void vault_dedup_unref(uint16_t id);
+
+// Resize the chunk store. It is allocated a sector at a time from its end,
+// so the end must stay put and the start must not cut into
+// vault_dedup_extent().
+void vault_dedup_set_store(uint32_t store_offset, uint32_t store_size);
+
+// Bytes of referenced chunks, in whole pages as stored.
+uint32_t vault_dedup_bytes_stored(void);
+
+// Room left for new chunks: bytes in free sectors and the open one, and
+// free index slots. Both are kept in RAM, so this is cheap to call.
+void vault_dedup_room(uint32_t* bytes, uint32_t* entries);
+
+// Bytes from the end of the store to the start of its furthest sector in use.
+uint32_t vault_dedup_extent(void);
+
+// Do one bounded step of compaction: erase a sector holding only
+// unreferenced chunks, move one live chunk towards the end of the store,
+// or write one sector of the new index half. The index is also rewritten
+// when more of it is unreferenced than free. Returns false when there is
+// nothing left to do. Safe to stop between any two steps.
+bool vault_dedup_compact_step(void);
+
+// Drop a compaction in progress, before the index or reference counts change.
+void vault_dedup_compact_abort(void);
+
+// Erase the index and store once no capsule references any chunk.
+void vault_dedup_reset_if_unused(void);
+
+// The index entry for a chunk, or NULL if id is not a valid chunk.
+const vault_chunk_t* vault_dedup_chunk(uint16_t id);
+
+// Where a chunk's stored bytes can be read through XIP.
+const uint8_t* vault_dedup_data(const vault_chunk_t* chunk);
+
+// Decrypt a copy of a chunk's stored bytes in place.
+void vault_dedup_decrypt(const vault_chunk_t* chunk, uint8_t* data);
+
+#endif // VAULT_DEDUP_H
@@ -0,0 +1,180 @@
+#include "vault_meta.h"
+#include "pico/stdlib.h"
+#include "dma_crc.h"
+#include <stddef.h>
+#include <string.h>
+
+#define RECORD_MAGIC 0x54435652 // "RVCT"
+#define RECORD_SIZE 32
+#define RECORDS_PER_SECTOR ((int)(FLASH_SECTOR_SIZE / RECORD_SIZE))
+#define JOURNAL_SECTORS (VAULT_META_SIZE / FLASH_SECTOR_SIZE)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint8_t capsule;
+    uint8_t state;
+    uint8_t reserved0[2];
+    uint32_t progress;
+    uint8_t reserved[RECORD_SIZE - 20];
+    uint32_t crc; // CRC-32 of everything above
+} vault_record_t;
+
+static uint32_t journal_offset;
+static uint32_t sequence;           // Newest sequence number in the journal
+static uint32_t active_sector;      // Sector the next record goes into
+static int next_slot;               // Free slot in the active sector, or -1 if it is full
+
+// Newest record for each capsule, zeroed if it has none
+static vault_record_t capsules[VAULT_MAX_CAPSULES];
+static uint32_t capsule_sectors[VAULT_MAX_CAPSULES];
+
+static const vault_record_t* record_at(uint32_t sector, int slot) {
+    return (const vault_record_t*)(XIP_BASE + journal_offset + sector * FLASH_SECTOR_SIZE + slot * RECORD_SIZE);
+}
+
+static uint32_t record_crc(const vault_record_t* record) {
+    return dma_crc32(record, NULL, offsetof(vault_record_t, crc));
+}
+
+static bool is_valid_record(const vault_record_t* record) {
+    return record->magic == RECORD_MAGIC && record->capsule < VAULT_MAX_CAPSULES && record->crc == record_crc(record);
+}
+
+// Slots whose newest record has to survive a sector switch
+static bool is_kept(const vault_record_t* record) {
+    return record->state == VAULT_STATE_LOCKED || record->state == VAULT_STATE_INGESTING ||
+           record->state == VAULT_STATE_RESTORING || record->state == VAULT_STATE_FAILED;
+}
+
+static bool is_erased_slot(const vault_record_t* record) {
+    const uint32_t* words = (const uint32_t*)record;
+    for (size_t i = 0; i < RECORD_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+// Records can only be appended after the last slot that was ever programmed,
+// including torn records from an interrupted write.
+static int find_free_slot(uint32_t sector) {
+    int last_used = -1;
+    for (int slot = 0; slot < RECORDS_PER_SECTOR; slot++) {
+        if (!is_erased_slot(record_at(sector, slot))) last_used = slot;
+    }
+    return (last_used + 1 < RECORDS_PER_SECTOR) ? last_used + 1 : -1;
+}
+
+// Program one record into the next free slot of the active sector, with the
+// rest of its page left at 0xFF; programming 0xFF over existing records
+// leaves them untouched.
+static bool program_record(uint32_t capsule, vault_state_t state, uint32_t progress) {
+    vault_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = RECORD_MAGIC;
+    record.sequence = sequence + 1;
+    record.capsule = capsule;
+    record.state = state;
+    record.progress = progress;
+    record.crc = record_crc(&record);
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t slot_offset = active_sector * FLASH_SECTOR_SIZE + next_slot * RECORD_SIZE;
+    uint32_t page_offset = slot_offset & ~(FLASH_PAGE_SIZE - 1);
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page + (slot_offset - page_offset), &record, sizeof(record));
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(journal_offset + page_offset, page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+
+    if (!is_valid_record(record_at(active_sector, next_slot))) {
+        printf("Vault journal write failed\n");
+        next_slot = find_free_slot(active_sector);
+        return false;
+    }
+
+    sequence = record.sequence;
+    capsules[capsule] = record;
+    capsule_sectors[capsule] = active_sector;
+    next_slot = (next_slot + 1 < RECORDS_PER_SECTOR) ? next_slot + 1 : -1;
+    return true;
+}
+
+// When the active sector is full, continue in the other one. Its older
+// records are erased first, so every locked capsule is carried over before
+// anything else is appended; until that is done the sector we are leaving
+// still holds them. Transfers in progress are carried over the same way.
+static bool switch_sector(void) {
+    active_sector = (active_sector + 1) % JOURNAL_SECTORS;
+    next_slot = 0;
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(journal_offset + active_sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        const vault_record_t* record = &capsules[capsule];
+        if (is_kept(record) && !program_record(capsule, record->state, record->progress)) return false;
+    }
+    return true;
+}
+
+void vault_meta_init(uint32_t flash_offset) {
+    journal_offset = flash_offset;
+    sequence = 0;
+    active_sector = 0;
+    memset(capsules, 0, sizeof(capsules));
+
+    bool found = false;
+    for (uint32_t sector = 0; sector < JOURNAL_SECTORS; sector++) {
+        for (int slot = 0; slot < RECORDS_PER_SECTOR; slot++) {
+            const vault_record_t* record = record_at(sector, slot);
+            if (!is_valid_record(record)) continue;
+            if (!found || (int32_t)(record->sequence - sequence) > 0) {
+                sequence = record->sequence;
+                active_sector = sector;
+                found = true;
+            }
+
+            vault_record_t* newest = &capsules[record->capsule];
+            if (newest->magic != RECORD_MAGIC || (int32_t)(record->sequence - newest->sequence) > 0) {
+                *newest = *record;
+                capsule_sectors[record->capsule] = sector;
+            }
+        }
+    }
+
+    next_slot = find_free_slot(active_sector);
+
+    // A switch interrupted before every locked capsule was carried over
+    // leaves some of them only in the other sector; copy them now, before
+    // the next switch erases it.
+    for (uint32_t capsule = 0; capsule < VAULT_MAX_CAPSULES; capsule++) {
+        const vault_record_t* record = &capsules[capsule];
+        if (is_kept(record) && capsule_sectors[capsule] != active_sector) {
+            vault_meta_checkpoint(capsule, (vault_state_t)record->state, record->progress);
+        }
+    }
+}
+
+vault_state_t vault_meta_state(uint32_t capsule) {
+    return (vault_state_t)capsules[capsule].state;
+}
+
+uint32_t vault_meta_progress(uint32_t capsule) {
+    return capsules[capsule].progress;
+}
+
+uint32_t vault_meta_generation(void) {
+    return sequence;
+}
+
+bool vault_meta_commit(uint32_t capsule, vault_state_t state) {
+    return vault_meta_checkpoint(capsule, state, 0);
+}
+
+bool vault_meta_checkpoint(uint32_t capsule, vault_state_t state, uint32_t progress) {
+    if (next_slot < 0 && !switch_sector()) return false;
+    return program_record(capsule, state, progress);
+}
@@ -0,0 +1,47 @@
+#ifndef VAULT_META_H
+#define VAULT_META_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/flash.h"
+
+// The vault's state is kept in a two-sector journal of small sequence-numbered
+// records. Each state change appends one record with a single page program;
+// a sector is only erased when the journal wraps to the other one.
+#define VAULT_META_SIZE (2 * FLASH_SECTOR_SIZE)
+
+// Number of capsules the vault can hold at once. Each has its own header
+// sector and its own state in the journal.
+#define VAULT_MAX_CAPSULES 8
+
+typedef enum {
+    VAULT_STATE_EMPTY = 0,
+    VAULT_STATE_LOCKED,    // A complete capsule is stored and waiting for its date
+    VAULT_STATE_RELEASED,  // The capsule has been restored to the public disk
+    VAULT_STATE_INGESTING, // A file is being stored; progress counts the chunks in its recipe
+    VAULT_STATE_RESTORING, // A capsule is being restored; progress counts the chunks written out
+    VAULT_STATE_FAILED     // The capsule can never be restored; its chunks are kept, but it no longer holds up the rest
+} vault_state_t;
+
+// Scan the journal at the given flash offset and cache the newest valid record
+// for each capsule slot.
+void vault_meta_init(uint32_t flash_offset);
+
+// A capsule slot's state from its newest record, without touching flash.
+vault_state_t vault_meta_state(uint32_t capsule);
+
+// Progress saved with a capsule slot's newest record.
+uint32_t vault_meta_progress(uint32_t capsule);
+
+// Sequence number of the newest record. It changes with every record
+// appended, so it tells whether anything has changed since it was taken.
+uint32_t vault_meta_generation(void);
+
+// Append a record moving a capsule slot to a new state.
+bool vault_meta_commit(uint32_t capsule, vault_state_t state);
+
+// Append a record saving how far an ingest or restore has got, so it can
+// carry on from there after a power cut.
+bool vault_meta_checkpoint(uint32_t capsule, vault_state_t state, uint32_t progress);
+
+#endif // VAULT_META_H
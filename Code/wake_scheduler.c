@@ -0,0 +1,205 @@
+#include "wake_scheduler.h"
+#include "rv3028.h"
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include <stdio.h>
+#include <time.h>
+
+#define RETRY_SECONDS 3600 // A capsule that is due but could not be restored is tried again this often
+#define MONTHS_TO_SEARCH 4 // Any day of the month comes round within three months (31 May to 31 July)
+#define POLL_INTERVAL_US 1000000 // How often the flags are read when INT is not wired up
+
+// Set from the INT falling edge. It starts out set so the first check looks
+// at the flags, since the wake that powered the board up came before the IRQ.
+static volatile bool wake_pending = true;
+
+#if WAKE_INT_GPIO >= 0
+static void (*edge_handler)(void) = NULL;
+
+static void wake_irq_handler(void) {
+    if (gpio_get_irq_event_mask(WAKE_INT_GPIO) & GPIO_IRQ_EDGE_FALL) {
+        gpio_acknowledge_irq(WAKE_INT_GPIO, GPIO_IRQ_EDGE_FALL);
+        wake_pending = true;
+        if (edge_handler) edge_handler();
+    }
+}
+
+void wake_set_edge_handler(void (*handler)(void)) {
+    edge_handler = handler;
+}
+#endif
+
+static bool current_epoch(int64_t* now) {
+    uint32_t unix_time;
+    if (rv3028_get_unix_time(&unix_time) != RV3028_SUCCESS) return false;
+    *now = unix_time;
+    return true;
+}
+
+// When an alarm for this day of the month, hour and minute would next go
+// off after now, or INT64_MAX if the day never comes.
+static int64_t next_alarm(int64_t now, int day, int hour, int minute) {
+    time_t now_time = (time_t)now;
+    struct tm today;
+    gmtime_r(&now_time, &today);
+
+    for (int months = 0; months < MONTHS_TO_SEARCH; months++) {
+        struct tm date = {
+            .tm_min = minute, .tm_hour = hour, .tm_mday = day,
+            .tm_mon = (today.tm_mon + months) % 12, .tm_year = today.tm_year + (today.tm_mon + months) / 12
+        };
+        int64_t wake = rv3028_tm_to_epoch(&date);
+
+        // Days past the end of a short month roll over into the next one
+        time_t wake_time = (time_t)wake;
+        struct tm check;
+        gmtime_r(&wake_time, &check);
+        if (check.tm_mday == day && wake > now) return wake;
+    }
+    return INT64_MAX;
+}
+
+// Wakes are tallied per year in the RTC's user RAM, which the backup battery
+// keeps: the year since 2000, then the count, which stops at 255.
+static void count_wake(int64_t now) {
+    uint8_t tally[RV3028_USER_RAM_SIZE];
+    if (rv3028_read_user_ram(tally) != RV3028_SUCCESS) return;
+
+    time_t now_time = (time_t)now;
+    struct tm current_time;
+    gmtime_r(&now_time, &current_time);
+
+    uint8_t year = current_time.tm_year - 100;
+    if (tally[0] != year) {
+        tally[0] = year;
+        tally[1] = 0;
+    }
+    if (tally[1] < UINT8_MAX) tally[1]++;
+    rv3028_write_user_ram(tally);
+    printf("Wake %u this year\n", tally[1]);
+}
+
+bool wake_schedule(int64_t unlock_time) {
+    int64_t now;
+    if (!current_epoch(&now)) return false;
+
+    int64_t delay = unlock_time - now;
+    if (delay <= 0) delay = RETRY_SECONDS;
+    if (delay <= RV3028_TIMER_MAX) {
+        rv3028_disable_alarm_interrupt();
+        printf("Next wake in %lu s\n", (unsigned long)delay);
+        return rv3028_start_countdown((uint16_t)delay) == RV3028_SUCCESS;
+    }
+
+    // The alarm goes off on the minute, so round up to make sure the capsule
+    // is due when it does
+    int64_t target = (unlock_time + 59) / 60 * 60;
+    time_t target_time = (time_t)target;
+    struct tm alarm;
+    gmtime_r(&target_time, &alarm);
+
+    // The alarm cannot match a month, so a capsule more than a month away
+    // gets woken for early. Of all the days it could be set to, take the one
+    // that goes off last without passing the unlock; over long waits that
+    // tends to be the 31st, which skips the short months. Once the capsule's
+    // own day is the latest, the wake is the unlock itself.
+    int64_t best = 0;
+    int best_day = alarm.tm_mday;
+    for (int day = 1; day <= 31; day++) {
+        int64_t wake = next_alarm(now, day, alarm.tm_hour, alarm.tm_min);
+        if (wake <= target && wake > best) {
+            best = wake;
+            best_day = day;
+        }
+    }
+    alarm.tm_mday = best_day;
+
+    rv3028_stop_countdown();
+    printf("Next wake on day %d at %02d:%02d%s\n", alarm.tm_mday, alarm.tm_hour, alarm.tm_min,
+           best == target ? "" : ", before the unlock");
+    return rv3028_set_alarm(&alarm) == RV3028_SUCCESS;
+}
+
+void wake_cancel(void) {
+    rv3028_disable_alarm_interrupt();
+    rv3028_stop_countdown();
+}
+
+void wake_init(void) {
+#if WAKE_INT_GPIO >= 0
+    gpio_init(WAKE_INT_GPIO);
+    gpio_set_dir(WAKE_INT_GPIO, GPIO_IN);
+    gpio_pull_up(WAKE_INT_GPIO);
+    gpio_add_raw_irq_handler(WAKE_INT_GPIO, wake_irq_handler);
+    gpio_set_irq_enabled(WAKE_INT_GPIO, GPIO_IRQ_EDGE_FALL, true);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+#endif
+}
+
+// Whether the flags are worth reading yet
+static bool take_pending(void) {
+#if WAKE_INT_GPIO >= 0
+    if (!wake_pending) return false;
+    wake_pending = false;
+    return true;
+#else
+    static uint64_t last_poll_us = 0;
+    uint64_t now_us = time_us_64();
+    if (!wake_pending && now_us - last_poll_us < POLL_INTERVAL_US) return false;
+    wake_pending = false;
+    last_poll_us = now_us;
+    return true;
+#endif
+}
+
+// The flags and the time come from one burst read that runs in the
+// background across calls, so a wake never holds up USB while the bus is busy
+static rv3028_request_t snapshot_request;
+static uint8_t snapshot_registers[RV3028_SNAPSHOT_REGISTER_COUNT];
+static bool snapshot_pending = false;
+
+bool wake_check(int64_t* wake_time) {
+    if (!snapshot_pending) {
+        if (!take_pending()) return false;
+        if (rv3028_read_async(&snapshot_request, RV3028_SECONDS_REG, snapshot_registers,
+                              sizeof(snapshot_registers)) != RV3028_SUCCESS) {
+            return false;
+        }
+        snapshot_pending = true;
+    }
+
+    rv3028_result_t result;
+    if (!rv3028_poll(&snapshot_request, &result)) return false;
+    snapshot_pending = false;
+    if (result != RV3028_SUCCESS) {
+#if WAKE_INT_GPIO >= 0
+        // INT stays low until the flags are cleared, so try again
+        wake_pending = true;
+#endif
+        return false;
+    }
+
+    rv3028_snapshot_t snapshot;
+    rv3028_decode_snapshot(snapshot_registers, &snapshot);
+    if (!wake_acknowledge(&snapshot)) return false;
+    *wake_time = snapshot.unix_time;
+    return true;
+}
+
+bool wake_acknowledge(const rv3028_snapshot_t* snapshot) {
+    bool alarm = (snapshot->status & RV3028_STATUS_AF) != 0;
+    bool timer = (snapshot->status & RV3028_STATUS_TF) != 0;
+    if (!alarm && !timer) return false;
+
+    // Clear the flags first to avoid re-triggering
+    if (alarm) rv3028_clear_alarm_flag();
+    if (timer) rv3028_clear_timer_flag();
+#if WAKE_INT_GPIO >= 0
+    // A flag raised while these were being cleared keeps INT low, so no new
+    // edge will come for it
+    if (!gpio_get(WAKE_INT_GPIO)) wake_pending = true;
+#endif
+    count_wake(snapshot->unix_time);
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef WAKE_SCHEDULER_H
+#define WAKE_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rv3028.h"
+
+// GPIO wired to the RV-3028's open-drain INT output, or -1 to poll the RTC
+// once a second. On the stock board INT only drives the power latch, so
+// polling is the default; a board with a wire from INT to a GPIO can set it.
+#ifndef WAKE_INT_GPIO
+#define WAKE_INT_GPIO -1
+#endif
+
+// Watch the INT pin for wakes. Call it once the RTC is set up.
+void wake_init(void);
+
+#if WAKE_INT_GPIO >= 0
+// Also call handler, from the GPIO interrupt, on every falling edge of INT.
+void wake_set_edge_handler(void (*handler)(void));
+#endif
+
+// Program the RTC to wake the device for a capsule that unlocks at
+// unlock_time, in seconds since 1970. Within the countdown timer's range
+// the wake is exact to the second; further out it uses the date alarm.
+bool wake_schedule(int64_t unlock_time);
+
+// Turn both wake sources off, for when nothing is locked.
+void wake_cancel(void);
+
+// Returns true if the RTC has raised a wake since the last call, with the
+// time it was seen in wake_time. The flag is cleared and the wake counted
+// towards this year's total. The RTC is only read once INT has fired, so
+// this is cheap to call every loop.
+bool wake_check(int64_t* wake_time);
+
+// Clear and count a wake seen in a snapshot read by the caller. Returns
+// false if the snapshot shows no wake.
+bool wake_acknowledge(const rv3028_snapshot_t* snapshot);
+
+#endif // WAKE_SCHEDULER_H